@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+// Skyline bottom-left rectangle packer: the free space is kept as a list of horizontal
+// segments (the "skyline") and each rectangle goes where it ends lowest, ties broken by
+// the narrowest segment. Rectangles can't be removed individually; to reclaim space,
+// Reset and add the live ones again.
+class AtlasPacker
+{
+public:
+	AtlasPacker() : nWidth(0), nHeight(0), nUsedArea(0) {}
+
+	void Reset(int w, int h);
+	bool Add(int w, int h, int * pX, int * pY);
+
+	int GetWidth() const { return nWidth; }
+	int GetHeight() const { return nHeight; }
+	int GetUsedArea() const { return nUsedArea; }
+
+private:
+	struct Node
+	{
+		int x, y, width;
+	};
+	int RectFits(int i, int w, int h) const;
+	void AddSkylineLevel(int i, int x, int y, int w, int h);
+
+	std::vector<Node> skyline;
+	int nWidth;
+	int nHeight;
+	int nUsedArea;
+};
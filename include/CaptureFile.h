@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+// Lossless frame captures (.sfc). Every frame is an independent chunk of QOI ops, so frames
+// encode in parallel, and a chunk between a QOI header and end marker is a valid .qoi image.
+// An index at the end of the file gives random access; a file without one (the recording
+// was cut short) is indexed by walking its chunks instead.
+//
+//   header   "SHADESFC", u32 version, f32 frame rate
+//   chunk    "SFRM", u32 number, u32 width, u32 height, u32 size, size bytes of QOI ops
+//   index    "SIDX", u32 count, per frame { u64 chunk offset, u32 number, u32 width, u32 height, u32 size }
+//   trailer  u64 index offset, "SFCINDEX"
+//
+// All values are little-endian. Pixels are top-down RGBA, stored opaque like the other
+// recording formats: alpha decodes as 255. Frames are at most 16384 pixels on a side.
+
+typedef struct
+{
+	float fFrameRate;          // stored in the header
+	int nThreads;              // encoder threads; 0 = 3
+	int nMaxFramesInFlight;    // frames queued for or being encoded; 0 = twice the threads
+} CAPTUREFILE_SETTINGS;
+
+typedef struct
+{
+	int nFrames;
+	long long nRawBytes;       // RGBA bytes taken in
+	long long nEncodedBytes;   // chunk payloads written
+	float fEncodeTime;         // seconds of encoding, summed over the threads
+} CAPTUREFILE_STATS;
+
+namespace CaptureFile
+{
+	// The codec. EncodeFrame returns the bytes written to pOut, which must hold
+	// GetMaxEncodedSize bytes (0 for a frame too large); DecodeFrame fails on data that
+	// doesn't make up the frame.
+	int GetMaxEncodedSize(int width, int height);
+	int EncodeFrame(const unsigned char * pRGBA, int width, int height, unsigned char * pOut);
+	bool DecodeFrame(const unsigned char * pData, int nSize, int width, int height, unsigned char * pRGBA);
+
+	// Writes a capture into an open file or pipe, which the caller closes after CloseWriter.
+	// WriteFrame takes the pixels by swapping the vector with an idle buffer, hands them to
+	// the encoder threads and writes whatever they finished, in order; it only waits when
+	// nMaxFramesInFlight frames are already being encoded.
+	bool OpenWriter(FILE * file, CAPTUREFILE_SETTINGS * settings);
+	bool WriteFrame(std::vector<unsigned char> & pixels, int width, int height, int nNumber);
+	bool CloseWriter(CAPTUREFILE_STATS * stats);
+
+	// Reads a capture back, by position in the file
+	bool OpenReader(const char * szFilename);
+	int GetFrameCount();
+	float GetFrameRate();
+	bool GetFrameInfo(int nIndex, int * pNumber, int * pWidth, int * pHeight);
+	bool ReadFrame(int nIndex, std::vector<unsigned char> & pixels);
+	void CloseReader();
+
+	// Command line tools. Benchmark encodes every frame of a capture, a PPM stream or a
+	// printf pattern of PPM files, single-threaded and through the writer with nThreads
+	// threads, checks the round trip and prints MB/s; the re-encoded capture goes to
+	// szOutput if given. Extract writes the frames of a capture out as PPM files.
+	bool Benchmark(const char * szInput, int nThreads, const char * szOutput);
+	bool Extract(const char * szInput, const char * szOutputPattern);
+}
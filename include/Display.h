@@ -0,0 +1,37 @@
+#pragma once
+
+typedef enum {
+	DISPLAY_BACKEND_APPLET = 0, // Switch: follows the console's docked/handheld operation mode
+	DISPLAY_BACKEND_SIMULATED,  // test backend: mode switches are scripted or requested by hand
+} DISPLAY_BACKEND;
+
+typedef enum {
+	DISPLAY_MODE_HANDHELD = 0,
+	DISPLAY_MODE_DOCKED,
+} DISPLAY_MODE;
+
+typedef struct
+{
+	DISPLAY_BACKEND backend;
+	DISPLAY_MODE initialMode;
+	float fSimulatedSwitchInterval; // simulated backend only: toggle the mode every n seconds (0 = never)
+} DISPLAY_SETTINGS;
+
+namespace Display
+{
+	void GetDefaultSettings(DISPLAY_SETTINGS * settings);
+	bool Open(DISPLAY_SETTINGS * settings);
+
+	// Pumps system events once per frame; returns false when the system asks us to quit.
+	bool Update();
+
+	// Returns true (once) when the display mode has changed since the last call, and
+	// reports the output resolution of the new mode. The first call always reports.
+	bool PollModeChange(int * pWidth, int * pHeight);
+
+	DISPLAY_MODE GetMode();
+	void GetModeResolution(DISPLAY_MODE mode, int * pWidth, int * pHeight);
+
+	// Simulated backend: queue a switch to the given mode, delivered on the next poll.
+	void SimulateModeChange(DISPLAY_MODE mode);
+}
\ No newline at end of file
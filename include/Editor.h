@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+
+typedef struct
+{
+	float fX, fY;              // panel position in GUI pixels
+	float fWidth, fHeight;     // 0 fills the rest of the screen
+	float fFontSize;           // 0 uses the text renderer's size
+	unsigned int nBackgroundColor;
+} EDITOR_SETTINGS;
+
+typedef struct
+{
+	int nLines;
+	int nLinesLexed;           // lines tokenised in the last frame
+	int nRunsBuilt;            // lines laid out in the last frame
+	float fLastTime;           // CPU milliseconds spent in the editor in the last frame
+	float fAverageTime;        // since the last ResetStats
+	float fWorstTime;
+	int nFrames;
+} EDITOR_STATS;
+
+typedef enum
+{
+	EDITOR_KEY_LEFT,
+	EDITOR_KEY_RIGHT,
+	EDITOR_KEY_UP,
+	EDITOR_KEY_DOWN,
+	EDITOR_KEY_HOME,
+	EDITOR_KEY_END,
+	EDITOR_KEY_PAGEUP,
+	EDITOR_KEY_PAGEDOWN,
+	EDITOR_KEY_BACKSPACE,
+	EDITOR_KEY_DELETE,
+	EDITOR_KEY_ENTER,
+	EDITOR_KEY_TAB,
+} EDITOR_KEY;
+
+namespace Editor
+{
+	// On-screen shader editor. The text lives in a piece table; every line keeps its GLSL
+	// tokens and its laid out glyphs, and an edit only invalidates the lines it touched.
+	// Tokenising is lazy and stops at the last visible line, or earlier once a line ends
+	// in the same state (inside a block comment or not) as before, so a keystroke costs
+	// a line or two of work whatever the size of the file. Needs an open TextRenderer.
+	bool Open(EDITOR_SETTINGS * settings);
+	void Close();
+	bool IsOpen();
+
+	void SetVisible(bool bVisible);
+	bool IsVisible();
+
+	// Replaces the text, keeping the caret on the same line where possible
+	void SetText(const char * szText, int nLength);
+	std::string GetText();
+
+	void InsertText(const char * szText);
+	void HandleKey(EDITOR_KEY key);
+	void SetCaret(int nLine, int nColumn);
+
+	// Draws the panel, between Renderer::StartTextRendering and EndTextRendering
+	void Draw();
+
+	void GetStats(EDITOR_STATS * stats);
+	void ResetStats();
+}
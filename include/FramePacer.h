@@ -0,0 +1,35 @@
+#pragma once
+
+typedef struct
+{
+	float fFrameRateLimit;   // CPU-side limiter, frames per second; 0 = off
+	int nMaxFramesInFlight;  // frames the CPU may run ahead of the GPU; 0 = unlimited
+} FRAMEPACER_SETTINGS;
+
+typedef struct
+{
+	int nFrames;             // frames recorded in the histogram
+	float fAverage;          // all times in milliseconds
+	float fJitter;           // standard deviation of the frame time
+	float fMin;
+	float fP50;
+	float fP90;
+	float fP99;
+	float fMax;
+	int nLimiterWaits;       // frames the limiter had to hold back
+	int nFenceWaits;         // frames that blocked on the frames-in-flight limit
+} FRAMEPACER_STATS;
+
+namespace FramePacer
+{
+	void Open(FRAMEPACER_SETTINGS * settings);
+	void Close();
+
+	// Call right after presenting: bounds the frames in flight, waits out the rest of the
+	// frame period if a limit is set, and records the frame time.
+	void EndFrame();
+
+	void GetStats(FRAMEPACER_STATS * stats);
+	void ResetStats();
+	void DumpHistogram();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+typedef struct
+{
+	int nStartFrame;               // first frame rendered
+	int nEndFrame;                 // one past the last frame rendered
+	float fFrameRate;              // fixed timestep: frame n is rendered at fGlobalTime = n / fFrameRate
+} OFFLINE_SETTINGS;
+
+namespace Offline
+{
+	// Renders frames [start, end) as fast as the GPU allows instead of presenting them.
+	// Open freezes Timer::GetTime() at the first frame's time and EndFrame, called in place
+	// of Renderer::EndFrame, advances it by exactly one frame, so a render is reproducible
+	// whatever the machine. The frames go out through the Recorder, opened alongside.
+	bool Open(OFFLINE_SETTINGS * settings);
+	bool IsOpen();
+
+	// bAdvance = false renders the same frame again, for the recorder's slow policy.
+	// Returns false once the last frame is done or recording has failed.
+	bool EndFrame(bool bAdvance);
+
+	bool Close();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Text buffer for the editor. The text is a sequence of pieces, each a span of either
+// the original text or an append-only buffer of everything inserted since, so edits
+// never move the bulk of the text. Typing at the end of the last insert just grows
+// that piece. Line starts are kept in an index that edits update in place.
+class PieceTable
+{
+public:
+	PieceTable() : nLength(0) { lineStarts.push_back(0); }
+
+	void SetText(const char * szText, int nTextLength);
+	std::string GetText() const;
+	void GetText(int nOffset, int nCount, std::string & sOut) const;
+	int GetLength() const { return nLength; }
+
+	void Insert(int nOffset, const char * szText, int nTextLength);
+	void Erase(int nOffset, int nCount);
+
+	int GetLineCount() const { return (int)lineStarts.size(); }
+	int GetLineStart(int nLine) const { return lineStarts[nLine]; }
+	int GetLineLength(int nLine) const; // excluding the line break
+	int GetLineFromOffset(int nOffset) const;
+	void GetLine(int nLine, std::string & sOut) const;
+
+private:
+	struct Piece
+	{
+		bool bAdded;
+		int nStart;
+		int nLength;
+	};
+	const char * GetPieceText(const Piece & piece) const { return (piece.bAdded ? added.c_str() : original.c_str()) + piece.nStart; }
+	int FindPiece(int nOffset, int * pPieceOffset) const;
+	void SplitPiece(int nOffset);
+
+	std::string original;
+	std::string added;
+	std::vector<Piece> pieces;
+	std::vector<int> lineStarts;
+	int nLength;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+typedef struct
+{
+	// A printf pattern with the frame number ("frames/%05d.png") for a file per frame, or
+	// NULL to write the PNGs back to back into stream (an image2pipe style stream)
+	const char * szOutputPattern;
+	FILE * stream;
+	int nThreads;              // 0 = one per core
+	int nMaxFramesInFlight;    // frames being compressed at once; 0 = 4
+	int nCompressionLevel;     // zlib level, 1-9; 0 = 6
+} PNGEXPORTER_SETTINGS;
+
+typedef struct
+{
+	int nFrames;
+	long long nRawBytes;       // filtered image data compressed
+	long long nCompressedBytes;
+	float fCompressTime;       // seconds of filtering and compressing, summed over the threads
+} PNGEXPORTER_STATS;
+
+namespace PngExporter
+{
+	// Writes PNG sequences the way pigz compresses: every frame is cut into blocks of rows
+	// that are filtered and deflated independently on a pool of threads, each primed with
+	// the 32 KB before it as its dictionary, and stitched back into one zlib stream with
+	// the checksums combined. Blocks of several frames are in flight at once, so the pool
+	// stays busy across frame boundaries. Frames are written out in order, as RGB.
+	bool Open(PNGEXPORTER_SETTINGS * settings);
+
+	// Takes the pixels (top-down RGBA) by swapping the vector with an idle buffer, and
+	// writes out whatever frames are finished; only waits when nMaxFramesInFlight frames
+	// are already being compressed
+	bool WriteFrame(std::vector<unsigned char> & pixels, int width, int height, int nNumber);
+
+	bool Close(PNGEXPORTER_STATS * stats);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+typedef struct
+{
+	int nWidth;
+	int nHeight;
+	int nTileSize;                 // clamped to what the GPU supports
+	float fTime;                   // fGlobalTime the poster is rendered at
+	const char * szOutputFilename; // binary PPM (P6)
+} POSTER_SETTINGS;
+
+namespace Poster
+{
+	// Renders the current shader into an image of arbitrary size, tile by tile, and streams
+	// it to disk one strip of tiles at a time, so neither the GPU nor RAM ever has to hold
+	// the whole image.
+	bool Render(POSTER_SETTINGS * settings);
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+typedef struct
+{
+	const char * szName;
+	float fLast;     // milliseconds, per frame (a marker hit several times in a frame is summed)
+	float fMin;
+	float fAverage;
+	float fP99;
+	int nSamples;    // frames in the rolling window
+} PROFILER_STATS;
+
+namespace Profiler
+{
+	// GPU timings come from GL_TIMESTAMP queries kept in a ring nLatency frames deep, so
+	// results are read that many frames late and the CPU never waits for them. Needs a
+	// current GL context; while closed every call is a no-op.
+	bool Open(int nLatency);
+	void Close();
+	bool IsOpen();
+
+	typedef int Marker;
+	Marker RegisterMarker(const char * szName);
+	void BeginMarker(Marker marker);
+	void EndMarker(Marker marker);
+
+	// Call once per frame after the last marker; collects the oldest frame in the ring
+	void NewFrame();
+
+	int GetStats(PROFILER_STATS * pStats, int nMaxStats);
+
+	// The marker's time in the most recently collected frame, in milliseconds; 0 until
+	// one has been collected
+	float GetLastTime(Marker marker);
+	void DumpStats();
+
+	class ScopedMarker
+	{
+	public:
+		ScopedMarker(Marker marker) : marker(marker) { BeginMarker(marker); }
+		~ScopedMarker() { EndMarker(marker); }
+	private:
+		Marker marker;
+	};
+}
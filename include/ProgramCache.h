@@ -0,0 +1,26 @@
+#pragma once
+
+typedef struct
+{
+	const char * szDirectory;  // created if missing
+	unsigned int nMaxSize;     // bytes; least recently used binaries are evicted beyond this
+} PROGRAMCACHE_SETTINGS;
+
+namespace ProgramCache
+{
+	// Needs a current GL context: the driver's vendor/renderer/version strings are part of
+	// every key, so a driver update invalidates the whole cache.
+	bool Open(PROGRAMCACHE_SETTINGS * settings);
+	void Close();
+
+	// Key for a program built from the given sources, in attachment order
+	unsigned long long MakeKey(const char ** szSources, const int * nSourceSizes, int nSources);
+
+	// Returns a linked program from a cached binary, or 0 on a miss. A binary the driver
+	// rejects is deleted from the cache and reported as a miss.
+	GLuint Load(unsigned long long key);
+
+	// Call before glLinkProgram on a program that will be stored
+	void PrepareProgram(GLuint program);
+	void Store(unsigned long long key, GLuint program);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+// Uses RENDERER_CHROMASITING: include Renderer.h first
+
+typedef enum {
+	RECORDER_FORMAT_PPM = 0, // binary PPM (P6) frames
+	RECORDER_FORMAT_Y4M,     // YUV4MPEG2, 4:2:0 BT.709 limited range
+	RECORDER_FORMAT_RAW,     // top-down RGBA frames, described by a sidecar file
+	RECORDER_FORMAT_NV12,    // top-down NV12 frames, BT.709 limited range, described by a sidecar file
+	RECORDER_FORMAT_SFC,     // lossless frame capture, encoded on worker threads (see CaptureFile.h)
+	RECORDER_FORMAT_PNG      // RGB PNG frames, compressed on worker threads (see PngExporter.h)
+} RECORDER_FORMAT;
+
+typedef enum {
+	RECORDER_BACKPRESSURE_BLOCK = 0, // wait for the writer: every frame is recorded, the main loop stalls
+	RECORDER_BACKPRESSURE_DROP,      // leave the frame out of the recording
+	RECORDER_BACKPRESSURE_SLOW       // turn the frame away so a fixed-step clock renders it again
+} RECORDER_BACKPRESSURE;
+
+typedef struct
+{
+	// A file or named pipe, "|command" (Linux only) to pipe into a program, or for PPM and
+	// PNG a printf pattern with the frame number ("frames/%05d.ppm") to write a file per frame
+	const char * szOutputFilename;
+	RECORDER_FORMAT format;
+	float fFrameRate;          // stored in the Y4M header and the sidecar
+	int nFirstFrame;           // number of the first frame recorded, for file patterns
+	int nQueueDepth;           // frames buffered for the writer, including readbacks in flight; 0 = 8
+	RECORDER_BACKPRESSURE backpressure;
+	RENDERER_CHROMASITING chromaSiting; // Y4M and NV12
+	bool bConvertOnCPU;        // capture RGBA and convert to YUV on the writer thread, instead of on the GPU
+	int nEncoderThreads;       // SFC and PNG; 0 = 3 for SFC, one per core for PNG
+	int nCompressionLevel;     // PNG, zlib level 1-9; 0 = 6
+} RECORDER_SETTINGS;
+
+typedef struct
+{
+	int nCaptured;             // frames queued for the writer
+	int nWritten;
+	int nDropped;              // left out by the drop policy, or at a resolution the stream can't take
+	int nHeld;                 // turned away by the slow policy
+	int nBlocked;              // frames the block policy had to wait on
+	float fBlockedTime;        // seconds the main loop spent waiting, in total
+	float fWriteTime;          // seconds the writer thread spent converting and writing, in total
+} RECORDER_STATS;
+
+namespace Recorder
+{
+	// Records the output. Captures are read back asynchronously through the renderer's
+	// capture ring, copied into a bounded queue and handed to a writer thread that does
+	// any conversion left and all the file I/O, so disk or encoder speed only reaches the
+	// main loop through the backpressure policy once the queue is full. YUV outputs are
+	// converted on the GPU and read back as planes unless bConvertOnCPU is set.
+	bool Open(RECORDER_SETTINGS * settings);
+	bool IsOpen();
+
+	// Call after drawing what should be recorded, before Renderer::EndFrame. Returns false
+	// when the frame was turned away by the slow policy, in which case a fixed-step clock
+	// should render the same frame again. (Without one, "slow" simply drops the frame.)
+	bool CaptureFrame();
+
+	// True once writing has failed; later frames are thrown away
+	bool HasFailed();
+
+	void GetStats(RECORDER_STATS * stats);
+
+	// The CPU conversion used with bConvertOnCPU, which the GPU's matches byte for byte:
+	// top-down RGBA to the Y plane followed by the U and V planes, or by interleaved UV
+	void ConvertToYUV420(const unsigned char * pRGBA, int w, int h, RENDERER_CHROMASITING siting, bool bInterleaved, unsigned char * pOut);
+
+	// Writes out everything still queued or in flight; returns false if anything failed
+	bool Close();
+}
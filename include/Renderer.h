@@ -7,14 +7,105 @@ typedef enum {
 	RENDERER_WINDOWMODE_BORDERLESS
 } RENDERER_WINDOWMODE;
 
+typedef enum {
+	RENDERER_RENDERMODE_FULL = 0,     // shade every pixel every frame
+	RENDERER_RENDERMODE_CHECKERBOARD, // shade half the pixels per frame in an alternating checkerboard
+	RENDERER_RENDERMODE_INTERLACED    // shade every other row per frame
+} RENDERER_RENDERMODE;
+
+typedef enum {
+	RENDERER_PROFILE_RELEASE = 0, // no GL error checking, no logging, optimized shaders
+	RENDERER_PROFILE_PROFILE,     // release plus frame timers
+	RENDERER_PROFILE_DEBUG        // driver logging, debug context, unoptimized shaders
+} RENDERER_PROFILE;
+
+typedef enum {
+	RENDERER_TARGETFORMAT_RGBA8 = 0,
+	RENDERER_TARGETFORMAT_RGBA16F,
+	RENDERER_TARGETFORMAT_RGBA32F
+} RENDERER_TARGETFORMAT;
+
+typedef enum {
+	RENDERER_RESAMPLE_LINEAR = 0,  // bilinear when upscaling, box filter when downscaling
+	RENDERER_RESAMPLE_NEAREST      // hard pixels, e.g. for deliberately low resolutions
+} RENDERER_RESAMPLE;
+
+typedef enum {
+	RENDERER_CAPTUREFORMAT_RGBA = 0, // 4 bytes per pixel
+	RENDERER_CAPTUREFORMAT_YUV420,   // planar Y, U, V at 4:2:0, BT.709 limited range; 1.5 bytes per pixel
+	RENDERER_CAPTUREFORMAT_NV12      // the Y plane, then one plane of interleaved U and V
+} RENDERER_CAPTUREFORMAT;
+
+typedef enum {
+	RENDERER_CHROMASITING_CENTER = 0, // between the four luma samples it covers (JPEG, Y4M C420jpeg)
+	RENDERER_CHROMASITING_LEFT,       // on the left column, between the rows (MPEG-2, H.264; C420mpeg2)
+	RENDERER_CHROMASITING_TOPLEFT     // on the top left luma sample (DV; C420paldv)
+} RENDERER_CHROMASITING;
+
+// The user shader renders into an offscreen target of its own size and format, which is
+// resampled to the window: a scale above 1 supersamples, one below renders fewer pixels.
+// A width or height of 0 follows the output resolution times the scale. With the defaults
+// (0, 0, 1, RGBA8) the shader renders straight into the window, unless dynamic resolution
+// needs the target anyway.
+typedef struct
+{
+	int nWidth;
+	int nHeight;
+	float fScale;              // 0 counts as 1
+	RENDERER_TARGETFORMAT format;
+	RENDERER_RESAMPLE resample;
+} RENDERER_RENDERTARGET;
+
 typedef struct
 {
 	int nWidth;
 	int nHeight;
 	RENDERER_WINDOWMODE windowMode;
+	RENDERER_PROFILE profile;
+
+	// Frame pacing (see FramePacer.h)
 	bool bVsync;
+	int nSwapInterval;         // vblanks per frame when bVsync is set
+	float fFrameRateLimit;     // CPU-side limiter, frames per second; 0 = off
+	int nMaxFramesInFlight;    // 0 = unlimited
+	RENDERER_RENDERMODE renderMode;
+
+	// Dynamic resolution: the shader renders offscreen at a scale that is adjusted
+	// every frame to hold the target frame rate, then gets upscaled to the window.
+	bool bDynamicResolution;
+	float fTargetFrameRate;
+	float fMinRenderScale;
+	float fMaxRenderScale;
+
+	RENDERER_RENDERTARGET renderTarget;
+
+	int nFrameGrabDepth;       // frame captures GrabFrame can have in flight; 0 = 3
+
+	// Linked programs are cached on disk as driver binaries; NULL disables the cache
+	const char * szProgramCacheDirectory;
+	unsigned int nProgramCacheSize;
 } RENDERER_SETTINGS;
 
+typedef struct
+{
+	bool bEnabled;
+	float fScale;              // current render scale (per axis)
+	int nRenderWidth;
+	int nRenderHeight;
+	float fTargetFrameTime;    // seconds
+	float fFrameTime;          // last measured frame time, seconds
+	float fSmoothedFrameTime;  // exponentially smoothed frame time the controller acts on
+	float fError;              // relative error of the smoothed frame time against the target
+	int nAdjustments;          // number of frames the scale was changed on
+} RENDERER_DYNAMIC_RESOLUTION_STATS;
+
+typedef struct
+{
+	float fCpuFrameTime;       // seconds between the last two EndFrame calls
+	float fGpuFrameTime;       // seconds the GPU spent between StartFrame and EndFrame, a few frames ago
+	int nDrawCalls;            // GUI draw calls in the last frame; counted in every profile
+} RENDERER_FRAME_TIMINGS;
+
 namespace Renderer
 {
 	extern std::string defaultShaderFilename;
@@ -23,20 +114,108 @@ namespace Renderer
 	extern int nWidth;
 	extern int nHeight;
 
+	// Resolution the user shader is currently rendered at; differs from nWidth/nHeight
+	// with an offscreen render target or dynamic resolution. This is what v2Resolution
+	// should report.
+	extern int nRenderWidth;
+	extern int nRenderHeight;
+
 	bool OpenSetupDialog(RENDERER_SETTINGS * settings);
 	bool Open(RENDERER_SETTINGS * settings);
 
 	void StartFrame();
-	void EndFrame();
+	void EndFrame(bool bPresent = true); // offline rendering neither presents nor paces frames
 	bool WantsToQuit();
 
 	void RenderFullscreenQuad();
+	void SetRenderMode(RENDERER_RENDERMODE mode);
+
+	void GetDynamicResolutionStats(RENDERER_DYNAMIC_RESOLUTION_STATS * stats);
+
+	void SetRenderTarget(const RENDERER_RENDERTARGET * target);
+	void GetRenderTarget(RENDERER_RENDERTARGET * target);
+
+	// Frame timings are only measured with RENDERER_PROFILE_PROFILE
+	RENDERER_PROFILE GetProfile();
+	void GetFrameTimings(RENDERER_FRAME_TIMINGS * timings);
+
+	// Render graph: extra shader passes rendered into offscreen targets before the main
+	// shader. A pass input binds a sampler uniform of the pass to another pass's output,
+	// "name" for this frame's or "name:previous" for last frame's; the main shader reads
+	// a pass through a sampler named after it. Passes nothing reads are skipped.
+	enum PASSFORMAT
+	{
+		PASSFORMAT_RGBA8 = 0,
+		PASSFORMAT_RGBA16F,
+		PASSFORMAT_RGBA32F,
+	};
+	bool AddRenderPass(const char * szName, char * szShaderCode, int nShaderCodeSize, float fScale, PASSFORMAT format, char * szErrorBuffer, int nErrorBufferSize);
+	bool AddRenderPassInput(const char * szPass, const char * szUniform, const char * szSource);
+
+	// Tiled offscreen rendering, for images larger than the GPU can render in one go.
+	// RenderTile renders the region [x, x + w) x [y, y + h) (bottom-up, like gl_FragCoord)
+	// of the virtual image and queues an asynchronous readback; it returns false when all
+	// readback slots are in flight. Completed tiles come back oldest first, as tightly
+	// packed bottom-up RGBA rows that stay valid until UnmapCompletedTile. Waiting for one
+	// only fails when no tile is in flight or the readback itself failed. Tiles don't run
+	// the render graph, so BeginTiles fails while the main shader samples passes.
+	struct TILE
+	{
+		int x, y;
+		int width, height;
+		const unsigned char * pData;
+	};
+	int GetMaxTileSize();
+	bool BeginTiles(int nTileWidth, int nTileHeight, int nReadbackDepth);
+	bool RenderTile(int x, int y, int w, int h);
+	bool MapCompletedTile(bool bWait, TILE * pTile);
+	void UnmapCompletedTile();
+	void EndTiles();
 
 	bool ReloadShader(char * szShaderCode, int nShaderCodeSize, char * szErrorBuffer, int nErrorBufferSize);
+
+	// Non-blocking reload: the previous shader keeps rendering until the new one has linked,
+	// then the programs are swapped in StartFrame and the callback is invoked from there.
+	// A newer request supersedes one still compiling (its callback is not invoked).
+	typedef void (*ShaderReloadCallback)(bool bSuccess, const char * szErrorLog, void * pUserData);
+	void ReloadShaderAsync(const char * szShaderCode, int nShaderCodeSize, ShaderReloadCallback callback, void * pUserData);
+	bool IsShaderReloadPending();
 	void SetShaderConstant(std::string szConstName, float x);
 	void SetShaderConstant(std::string szConstName, float x, float y);
 
-	bool GrabFrame(void * pPixelBuffer); // input buffer must be able to hold w * h * 4 bytes of 0xAABBGGRR data
+	// Uniform handles: a name is registered once and its location is resolved whenever a
+	// program is linked, so per-frame updates are a table lookup instead of a string query.
+	typedef int UniformHandle;
+	UniformHandle RegisterUniform(const char * szName);
+	void SetShaderConstant(UniformHandle hUniform, float x);
+	void SetShaderConstant(UniformHandle hUniform, float x, float y);
+
+	// Frame capture. GrabFrame, called after drawing and before EndFrame, flips the output
+	// into a readback target on the GPU and queues its transfer; it returns false, and the
+	// frame isn't captured, while nFrameGrabDepth captures are in flight. TryGrabFrame maps
+	// the oldest capture once the GPU is done with it, waiting for it only with bWait. The
+	// data is tightly packed top-down rows at the size the frame was captured at, and stays
+	// valid until ReleaseGrabbedFrame: 0xAABBGGRR pixels for RGBA, otherwise the planes of
+	// the YUV conversion, which runs on the GPU so only those come back. Chroma planes are
+	// (width + 1) / 2 by (height + 1) / 2, repeating the last column and row at odd sizes.
+	struct GRABBEDFRAME
+	{
+		int nFrame;                // number of frames ended before this one
+		float fTime;               // Timer::GetTime() at capture: the frame time in offline renders
+		int width, height;
+		RENDERER_CAPTUREFORMAT format;
+		int nSize;                 // bytes of data
+		const unsigned char * pData;
+	};
+	bool GrabFrame(RENDERER_CAPTUREFORMAT format = RENDERER_CAPTUREFORMAT_RGBA, RENDERER_CHROMASITING siting = RENDERER_CHROMASITING_CENTER);
+	bool TryGrabFrame(GRABBEDFRAME * pFrame, bool bWait = false);
+	void ReleaseGrabbedFrame();
+	int GetFrameGrabsInFlight();
+	int GetFrameGrabSize(RENDERER_CAPTUREFORMAT format, int width, int height);
+
+	// BT.709 RGB to limited range Y, Cb, Cr as rows of 16.16 fixed point weights for 8 bit
+	// values. The GPU conversion and any CPU converter share them, so the two agree exactly.
+	void GetYUVMatrix(int matrix[3][3]);
 
 	enum TEXTURETYPE
 	{
@@ -56,8 +235,18 @@ namespace Renderer
 	Texture * Create1DR32Texture(int w);
 	bool UpdateR32Texture(Texture * tex, float * data);
 	void SetShaderTexture(std::string szTextureName, Texture * tex);
+	void SetShaderTexture(UniformHandle hUniform, Texture * tex);
 	void BindTexture(Texture * tex); // temporary function until all the quad rendering is moved to the renderer
 	void ReleaseTexture(Texture * tex);
+
+	// GUI images packed into one shared atlas texture, so that switching between them (or
+	// to untextured quads) doesn't break the GUI batch. They bind and release like other
+	// textures, but only for GUI drawing, and their texture coordinates must stay in [0, 1].
+	Texture * CreateAtlasRGBA8TextureFromData(int w, int h, const unsigned char * data);
+	// Distance field images keep the distance to the shape's edge in alpha (0.5 on the
+	// edge) and stay sharp at any scale
+	Texture * CreateAtlasA8TextureFromData(int w, int h, const unsigned char * data, bool bDistanceField = false);
+	bool UpdateAtlasA8Texture(Texture * tex, int x, int y, int w, int h, const unsigned char * data);
 	struct Vertex
 	{
 		Vertex(float _x, float _y, unsigned int _c = 0xFFFFFFFF, float _u = 0.0, float _v = 0.0) :
@@ -66,6 +255,11 @@ namespace Renderer
 		float u, v;
 		unsigned int c;
 	};
+	// GUI drawing in window pixels (origin top left) goes between these two calls
+	void StartTextRendering();
+	void EndTextRendering();
+	void RenderRect(float x, float y, float w, float h, unsigned int c = 0xFFFFFFFF, float u0 = 0.0f, float v0 = 0.0f, float u1 = 1.0f, float v1 = 1.0f);
 	void RenderQuad(const Vertex & a, const Vertex & b, const Vertex & c, const Vertex & d);
-	void RenderLine(const Vertex & a, const Vertex & b);
+	// Antialiased, fWidth pixels wide, batched with RenderRect
+	void RenderLine(const Vertex & a, const Vertex & b, float fWidth = 1.0f);
 }
@@ -1,7 +1,16 @@
+#pragma once
+
+#ifdef __SWITCH__
 #include <switch.h>
+#endif
 #include <EGL/egl.h>    // EGL library
 #include <EGL/eglext.h> // EGL extensions
+#ifdef __SWITCH__
 #include <glad/glad.h>  // glad library (OpenGL loader)
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h> // desktop Linux: core entry points are exported by libGL/libOpenGL
+#endif
 
 #ifdef ENABLE_NXLINK
 #include <unistd.h>
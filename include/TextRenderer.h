@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+typedef struct
+{
+	const char * szFontFile;   // TrueType/OpenType file; NULL uses the system font on Switch
+	float fSize;               // pixel height glyphs are rasterised at
+	bool bDistanceField;       // cache distance field glyphs, which stay sharp at any size
+	int nCacheSize;            // glyph cache page, pixels square
+} TEXTRENDERER_SETTINGS;
+
+typedef struct
+{
+	int nGlyphs;               // glyphs in the cache
+	int nGlyphMisses;          // glyphs rasterised since Open
+	int nGlyphEvictions;
+	int nLayouts;              // strings with a cached layout
+	int nLayoutMisses;         // strings laid out since Open
+} TEXTRENDERER_STATS;
+
+typedef struct
+{
+	float x, y, w, h;          // GUI pixels from the top left of the run; empty for spaces
+	float u0, v0, u1, v1;
+	float fPen;                // pen position before the glyph, for placing a caret
+	int nOffset;               // byte offset of the glyph in the text
+	int nCell;                 // glyph cache cell, -1 for none; DrawRun keeps it in the cache
+	unsigned int nColor;       // filled in by the caller
+} TEXTRENDERER_GLYPHQUAD;
+
+namespace TextRenderer
+{
+	// Glyphs are rasterised on first use into a page of the GUI atlas, split into cells
+	// that are recycled least recently used first; text therefore batches with other GUI
+	// drawing. Layouts (advances and kerning) are cached per string and size, so static
+	// labels are only shaped once. Needs an open renderer.
+	bool Open(TEXTRENDERER_SETTINGS * settings);
+	void Close();
+	bool IsOpen();
+
+	// Draws UTF-8 text with its top left corner at (x, y) in GUI pixels, between
+	// Renderer::StartTextRendering and EndTextRendering; '\n' starts a new line. A size of
+	// 0 draws at the cached size; without distance fields other sizes are scaled from it.
+	// Returns the width of the widest line.
+	float DrawString(float x, float y, const char * szText, unsigned int nColor, float fSize = 0.0f);
+	void MeasureString(const char * szText, float fSize, float * pWidth, float * pHeight);
+	float GetLineHeight(float fSize = 0.0f);
+
+	// Lays a single line out into quads for callers that keep their own cache of drawn
+	// text (the editor keeps one run per line); tabs stop every four spaces. The quads
+	// point into the glyph cache, so they must be laid out again once GetCacheGeneration
+	// changes. Returns the pen position at the end of the run.
+	float LayoutRun(const char * szText, int nLength, float fSize, std::vector<TEXTRENDERER_GLYPHQUAD> & quads);
+	void DrawRun(float x, float y, const TEXTRENDERER_GLYPHQUAD * pQuads, int nQuads);
+	unsigned int GetCacheGeneration();
+
+	void GetStats(TEXTRENDERER_STATS * stats);
+}
@@ -2,4 +2,12 @@ namespace Timer
 {
   void Start();
   float GetTime();
+  double GetTimePrecise();
+
+  // Coarse OS sleep; wakes up late by up to the scheduler's granularity
+  void Sleep(double fSeconds);
+
+  // While frozen, GetTime() returns the given time instead of the clock (offline renders)
+  void Freeze(float fTime);
+  void Unfreeze();
 }
\ No newline at end of file
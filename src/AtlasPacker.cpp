@@ -0,0 +1,98 @@
+#include "AtlasPacker.h"
+
+void AtlasPacker::Reset(int w, int h)
+{
+	nWidth = w;
+	nHeight = h;
+	nUsedArea = 0;
+	skyline.clear();
+	Node node = { 0, 0, w };
+	skyline.push_back(node);
+}
+
+// Returns the y a rectangle starting at node i would sit at, or -1 if it doesn't fit
+int AtlasPacker::RectFits(int i, int w, int h) const
+{
+	int x = skyline[i].x;
+	if (x + w > nWidth)
+		return -1;
+
+	int y = skyline[i].y;
+	int nSpaceLeft = w;
+	while (nSpaceLeft > 0)
+	{
+		if (i == (int)skyline.size())
+			return -1;
+		if (skyline[i].y > y)
+			y = skyline[i].y;
+		if (y + h > nHeight)
+			return -1;
+		nSpaceLeft -= skyline[i].width;
+		i++;
+	}
+	return y;
+}
+
+void AtlasPacker::AddSkylineLevel(int i, int x, int y, int w, int h)
+{
+	Node node = { x, y + h, w };
+	skyline.insert(skyline.begin() + i, node);
+
+	// Cut the segments the new one now covers
+	for (int j = i + 1; j < (int)skyline.size(); j++)
+	{
+		int nPrevEnd = skyline[j - 1].x + skyline[j - 1].width;
+		if (skyline[j].x >= nPrevEnd)
+			break;
+
+		int nShrink = nPrevEnd - skyline[j].x;
+		skyline[j].x += nShrink;
+		skyline[j].width -= nShrink;
+		if (skyline[j].width > 0)
+			break;
+		skyline.erase(skyline.begin() + j);
+		j--;
+	}
+
+	// Merge neighbours at the same height
+	for (int j = 0; j + 1 < (int)skyline.size(); j++)
+	{
+		if (skyline[j].y == skyline[j + 1].y)
+		{
+			skyline[j].width += skyline[j + 1].width;
+			skyline.erase(skyline.begin() + j + 1);
+			j--;
+		}
+	}
+}
+
+bool AtlasPacker::Add(int w, int h, int * pX, int * pY)
+{
+	int nBestBottom = nHeight;
+	int nBestWidth = nWidth;
+	int nBest = -1;
+	int nBestX = 0;
+	int nBestY = 0;
+	for (int i = 0; i < (int)skyline.size(); i++)
+	{
+		int y = RectFits(i, w, h);
+		if (y == -1)
+			continue;
+		if (y + h < nBestBottom || (y + h == nBestBottom && skyline[i].width < nBestWidth))
+		{
+			nBest = i;
+			nBestBottom = y + h;
+			nBestWidth = skyline[i].width;
+			nBestX = skyline[i].x;
+			nBestY = y;
+		}
+	}
+	if (nBest == -1)
+		return false;
+
+	AddSkylineLevel(nBest, nBestX, nBestY, w, h);
+	nUsedArea += w * h;
+	*pX = nBestX;
+	*pY = nBestY;
+	return true;
+}
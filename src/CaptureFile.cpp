@@ -0,0 +1,865 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "Timer.h"
+#include "CaptureFile.h"
+
+namespace CaptureFile
+{
+	//////////////////////////////////////////////////////////////////////////
+	// codec
+
+	// QOI's ops: a pixel is a repeat of the previous one, a recently seen colour, a small
+	// difference to the previous one, or spelled out
+	#define QOI_OP_INDEX 0x00 // 00iiiiii
+	#define QOI_OP_DIFF  0x40 // 01rrggbb, each -2..1
+	#define QOI_OP_LUMA  0x80 // 10gggggg rrrrbbbb, green -32..31, red and blue -8..7 relative to green
+	#define QOI_OP_RUN   0xC0 // 11nnnnnn, 1..62 repeats
+	#define QOI_OP_RGB   0xFE
+	#define QOI_OP_RGBA  0xFF
+
+	// Pixels are handled as little-endian words, 0xAABBGGRR, and the per-channel arithmetic
+	// works on all four bytes of a word at once without carries between them
+	static inline unsigned int LoadPixel(const unsigned char * p)
+	{
+		unsigned int px;
+		memcpy(&px, p, 4);
+		return px;
+	}
+
+	static inline unsigned long long LoadPixelPair(const unsigned char * p)
+	{
+		unsigned long long pair;
+		memcpy(&pair, p, 8);
+		return pair;
+	}
+
+	static inline unsigned int AddBytes(unsigned int a, unsigned int b)
+	{
+		return ((a & 0x7F7F7F7Fu) + (b & 0x7F7F7F7Fu)) ^ ((a ^ b) & 0x80808080u);
+	}
+
+	static inline unsigned int SubtractBytes(unsigned int a, unsigned int b)
+	{
+		return ((a | 0x80808080u) - (b & 0x7F7F7F7Fu)) ^ ((a ^ ~b) & 0x80808080u);
+	}
+
+	static inline int Hash(unsigned int px)
+	{
+		return ((px & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + ((px >> 16) & 0xFF) * 7 + (px >> 24) * 11) & 63;
+	}
+
+	// Frames are at most this many pixels on a side, which keeps every size the codec deals
+	// with, up to 4 bytes a pixel, inside an int. Sizes read from a file are checked against
+	// it before anything is allocated for them.
+	static const int nMaxFrameDimension = 16384;
+
+	static bool IsValidFrameSize(int width, int height)
+	{
+		return width > 0 && height > 0 && width <= nMaxFrameDimension && height <= nMaxFrameDimension;
+	}
+
+	int GetMaxEncodedSize(int width, int height)
+	{
+		if (!IsValidFrameSize(width, height))
+			return 0;
+		return (int)((long long)width * height * 4);
+	}
+
+	// Alpha is forced to opaque: the output's alpha is whatever the shader left in it and
+	// isn't shown, and noise there would turn cheap ops into 5 byte RGBA ones
+	int EncodeFrame(const unsigned char * pRGBA, int width, int height, unsigned char * pOut)
+	{
+		const unsigned int nOpaque = 0xFF000000u;
+		const unsigned long long nOpaquePair = 0xFF000000FF000000ull;
+		unsigned int index[64];
+		memset(index, 0, sizeof(index));
+		unsigned int prev = nOpaque;
+		unsigned long long prevPair = prev * 0x100000001ull;
+		unsigned char * out = pOut;
+
+		int nPixels = width * height;
+		int i = 0;
+		while (i < nPixels)
+		{
+			unsigned int px = LoadPixel(pRGBA + i * 4) | nOpaque;
+			if (px == prev)
+			{
+				// Flat areas are common in shader output: measure the run two pixels at a
+				// time, then emit it in QOI's pieces of at most 62
+				int nRun = 1;
+				while (i + nRun + 2 <= nPixels && (LoadPixelPair(pRGBA + (i + nRun) * 4) | nOpaquePair) == prevPair)
+					nRun += 2;
+				if (i + nRun < nPixels && (LoadPixel(pRGBA + (i + nRun) * 4) | nOpaque) == prev)
+					nRun++;
+				i += nRun;
+				while (nRun > 0)
+				{
+					int n = nRun < 62 ? nRun : 62;
+					*out++ = (unsigned char)(QOI_OP_RUN | (n - 1));
+					nRun -= n;
+				}
+				continue;
+			}
+
+			int h = Hash(px);
+			if (index[h] == px)
+			{
+				*out++ = (unsigned char)(QOI_OP_INDEX | h);
+			}
+			else
+			{
+				index[h] = px;
+
+				// All three differences within -2..1 is all three biased ones within 0..3
+				unsigned int d = SubtractBytes(px, prev);
+				unsigned int biased = AddBytes(d, 0x00020202u);
+				int dg = (signed char)(d >> 8);
+				int drg = (signed char)d - dg;
+				int dbg = (signed char)(d >> 16) - dg;
+				if ((biased & 0x00FCFCFCu) == 0)
+				{
+					*out++ = (unsigned char)(QOI_OP_DIFF | (biased & 3) << 4 | ((biased >> 8) & 3) << 2 | ((biased >> 16) & 3));
+				}
+				else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+				{
+					*out++ = (unsigned char)(QOI_OP_LUMA | (dg + 32));
+					*out++ = (unsigned char)((drg + 8) << 4 | (dbg + 8));
+				}
+				else
+				{
+					*out++ = QOI_OP_RGB;
+					*out++ = (unsigned char)px;
+					*out++ = (unsigned char)(px >> 8);
+					*out++ = (unsigned char)(px >> 16);
+				}
+			}
+			prev = px;
+			prevPair = px * 0x100000001ull;
+			i++;
+		}
+		return (int)(out - pOut);
+	}
+
+	bool DecodeFrame(const unsigned char * pData, int nSize, int width, int height, unsigned char * pRGBA)
+	{
+		if (!IsValidFrameSize(width, height))
+			return false;
+
+		unsigned int index[64];
+		memset(index, 0, sizeof(index));
+		unsigned int px = 0xFF000000u;
+		const unsigned char * p = pData;
+		const unsigned char * pEnd = pData + nSize;
+
+		int nPixels = width * height;
+		int i = 0;
+		while (i < nPixels)
+		{
+			if (p == pEnd)
+				return false;
+
+			int b1 = *p++;
+			int nRepeat = 1;
+			if (b1 == QOI_OP_RGB)
+			{
+				if (pEnd - p < 3)
+					return false;
+				px = (px & 0xFF000000u) | p[0] | p[1] << 8 | p[2] << 16;
+				p += 3;
+			}
+			else if (b1 == QOI_OP_RGBA)
+			{
+				if (pEnd - p < 4)
+					return false;
+				px = LoadPixel(p);
+				p += 4;
+			}
+			else
+			{
+				switch (b1 & 0xC0)
+				{
+				case QOI_OP_INDEX:
+					px = index[b1];
+					break;
+				case QOI_OP_DIFF:
+					px = SubtractBytes(AddBytes(px, ((b1 >> 4) & 3) | ((b1 >> 2) & 3) << 8 | (b1 & 3) << 16), 0x00020202u);
+					break;
+				case QOI_OP_LUMA:
+				{
+					if (p == pEnd)
+						return false;
+					int b2 = *p++;
+					int dg = (b1 & 0x3F) - 32;
+					int dr = dg - 8 + (b2 >> 4);
+					int db = dg - 8 + (b2 & 0x0F);
+					px = AddBytes(px, (dr & 0xFF) | (dg & 0xFF) << 8 | (db & 0xFF) << 16);
+					break;
+				}
+				case QOI_OP_RUN:
+					nRepeat = (b1 & 0x3F) + 1;
+					if (nRepeat > nPixels - i)
+						return false;
+					break;
+				}
+			}
+
+			index[Hash(px)] = px;
+			for (int n = 0; n < nRepeat; n++, i++)
+				memcpy(pRGBA + i * 4, &px, 4);
+		}
+		return p == pEnd;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// file layout
+
+	static const char szFileMagic[] = "SHADESFC";
+	static const char szChunkMagic[] = "SFRM";
+	static const char szIndexMagic[] = "SIDX";
+	static const char szTrailerMagic[] = "SFCINDEX";
+	static const int nFileVersion = 1;
+	static const int nHeaderSize = 16;
+	static const int nChunkHeaderSize = 20;
+	static const int nIndexEntrySize = 24;
+	static const int nTrailerSize = 16;
+
+	struct IndexEntry
+	{
+		unsigned long long nOffset; // of the chunk header
+		int nNumber;
+		int width, height;
+		int nSize;                  // of the encoded data
+	};
+
+	static void PutU32(unsigned char * p, unsigned int n)
+	{
+		p[0] = (unsigned char)n;
+		p[1] = (unsigned char)(n >> 8);
+		p[2] = (unsigned char)(n >> 16);
+		p[3] = (unsigned char)(n >> 24);
+	}
+
+	static void PutU64(unsigned char * p, unsigned long long n)
+	{
+		PutU32(p, (unsigned int)n);
+		PutU32(p + 4, (unsigned int)(n >> 32));
+	}
+
+	static unsigned int GetU32(const unsigned char * p)
+	{
+		return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+	}
+
+	static unsigned long long GetU64(const unsigned char * p)
+	{
+		return GetU32(p) | (unsigned long long)GetU32(p + 4) << 32;
+	}
+
+	static void PutChunkHeader(unsigned char * p, const IndexEntry & entry)
+	{
+		memcpy(p, szChunkMagic, 4);
+		PutU32(p + 4, entry.nNumber);
+		PutU32(p + 8, entry.width);
+		PutU32(p + 12, entry.height);
+		PutU32(p + 16, entry.nSize);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// writer
+
+	// Frames go round a ring of jobs: the caller submits at nSubmitted, the encoder threads
+	// claim from nClaimed, and the caller writes them out from nRetired once encoded, so
+	// the file keeps submission order however the threads finish. The counters only grow;
+	// slots are counter % depth. All of it is guarded by jobMutex.
+	struct EncodeJob
+	{
+		std::vector<unsigned char> pixels;
+		std::vector<unsigned char> encoded;
+		int nNumber;
+		int width, height;
+		int nEncodedSize;
+		bool bEncoded;
+	};
+	static std::vector<EncodeJob> jobs;
+	static int nSubmitted = 0;
+	static int nClaimed = 0;
+	static int nRetired = 0;
+	static bool bStopping = false;
+	static pthread_mutex_t jobMutex;
+	static pthread_cond_t jobSubmitted;
+	static pthread_cond_t jobEncoded;
+	static std::vector<pthread_t> encoderThreads;
+
+	static bool bWriterOpen = false;
+	static FILE * fWriter = NULL;
+	static bool bWriteFailed = false;
+	static unsigned long long nWriteOffset = 0;
+	static std::vector<IndexEntry> writtenFrames;
+	static CAPTUREFILE_STATS writerStats;
+
+	static void * EncoderThreadMain(void *)
+	{
+		pthread_mutex_lock(&jobMutex);
+		for (;;)
+		{
+			while (nClaimed == nSubmitted && !bStopping)
+				pthread_cond_wait(&jobSubmitted, &jobMutex);
+			if (nClaimed == nSubmitted)
+				break;
+
+			EncodeJob & job = jobs[nClaimed % jobs.size()];
+			nClaimed++;
+			pthread_mutex_unlock(&jobMutex);
+
+			double fStart = Timer::GetTimePrecise();
+			job.nEncodedSize = EncodeFrame(&job.pixels[0], job.width, job.height, &job.encoded[0]);
+			float fTime = (float)(Timer::GetTimePrecise() - fStart);
+
+			pthread_mutex_lock(&jobMutex);
+			job.bEncoded = true;
+			writerStats.fEncodeTime += fTime;
+			pthread_cond_signal(&jobEncoded);
+		}
+		pthread_mutex_unlock(&jobMutex);
+		return NULL;
+	}
+
+	static bool WriteBytes(const void * pData, size_t nSize)
+	{
+		if (!bWriteFailed && fwrite(pData, 1, nSize, fWriter) != nSize)
+		{
+			printf("[CaptureFile] Writing the capture failed\n");
+			bWriteFailed = true;
+		}
+		nWriteOffset += nSize;
+		return !bWriteFailed;
+	}
+
+	// Writes out every encoded frame at the head of the ring, first waiting for the
+	// oldest ones until no more than nMaxInFlight are left
+	static void RetireFrames(int nMaxInFlight)
+	{
+		for (;;)
+		{
+			pthread_mutex_lock(&jobMutex);
+			EncodeJob & job = jobs[nRetired % jobs.size()];
+			while (nSubmitted - nRetired > nMaxInFlight && !job.bEncoded)
+				pthread_cond_wait(&jobEncoded, &jobMutex);
+			bool bReady = nRetired < nSubmitted && job.bEncoded;
+			pthread_mutex_unlock(&jobMutex);
+			if (!bReady)
+				return;
+
+			IndexEntry entry;
+			entry.nOffset = nWriteOffset;
+			entry.nNumber = job.nNumber;
+			entry.width = job.width;
+			entry.height = job.height;
+			entry.nSize = job.nEncodedSize;
+			unsigned char header[nChunkHeaderSize];
+			PutChunkHeader(header, entry);
+			if (WriteBytes(header, sizeof(header)) && WriteBytes(&job.encoded[0], job.nEncodedSize))
+			{
+				writtenFrames.push_back(entry);
+				writerStats.nFrames++;
+				writerStats.nRawBytes += (long long)job.width * job.height * 4;
+				writerStats.nEncodedBytes += job.nEncodedSize;
+			}
+
+			pthread_mutex_lock(&jobMutex);
+			nRetired++;
+			pthread_mutex_unlock(&jobMutex);
+		}
+	}
+
+	bool OpenWriter(FILE * file, CAPTUREFILE_SETTINGS * settings)
+	{
+		int nThreads = settings->nThreads > 0 ? settings->nThreads : 3;
+		int nDepth = settings->nMaxFramesInFlight > 0 ? settings->nMaxFramesInFlight : nThreads * 2;
+
+		fWriter = file;
+		bWriteFailed = false;
+		nWriteOffset = 0;
+		writtenFrames.clear();
+		memset(&writerStats, 0, sizeof(writerStats));
+
+		unsigned char header[nHeaderSize];
+		memcpy(header, szFileMagic, 8);
+		PutU32(header + 8, nFileVersion);
+		unsigned int nFrameRateBits;
+		memcpy(&nFrameRateBits, &settings->fFrameRate, 4);
+		PutU32(header + 12, nFrameRateBits);
+		if (!WriteBytes(header, sizeof(header)))
+			return false;
+
+		jobs.resize(nDepth);
+		for (int i = 0; i < nDepth; i++)
+			jobs[i].bEncoded = false;
+		nSubmitted = 0;
+		nClaimed = 0;
+		nRetired = 0;
+		bStopping = false;
+		pthread_mutex_init(&jobMutex, NULL);
+		pthread_cond_init(&jobSubmitted, NULL);
+		pthread_cond_init(&jobEncoded, NULL);
+
+		encoderThreads.clear();
+		for (int i = 0; i < nThreads; i++)
+		{
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, EncoderThreadMain, NULL) != 0)
+				break;
+			encoderThreads.push_back(thread);
+		}
+		if (encoderThreads.empty())
+		{
+			printf("[CaptureFile] Unable to start the encoder threads\n");
+			pthread_mutex_destroy(&jobMutex);
+			pthread_cond_destroy(&jobSubmitted);
+			pthread_cond_destroy(&jobEncoded);
+			return false;
+		}
+
+		bWriterOpen = true;
+		return true;
+	}
+
+	bool WriteFrame(std::vector<unsigned char> & pixels, int width, int height, int nNumber)
+	{
+		if (!bWriterOpen || !IsValidFrameSize(width, height) || pixels.size() < (size_t)width * height * 4)
+			return false;
+
+		// Make room, writing out whatever is finished along the way
+		RetireFrames((int)jobs.size() - 1);
+
+		// The slot is idle: nothing but this thread touches it until it's submitted
+		EncodeJob & job = jobs[nSubmitted % jobs.size()];
+		job.pixels.swap(pixels);
+		if ((int)job.encoded.size() < GetMaxEncodedSize(width, height))
+			job.encoded.resize(GetMaxEncodedSize(width, height));
+		job.nNumber = nNumber;
+		job.width = width;
+		job.height = height;
+		job.bEncoded = false;
+
+		pthread_mutex_lock(&jobMutex);
+		nSubmitted++;
+		pthread_cond_signal(&jobSubmitted);
+		pthread_mutex_unlock(&jobMutex);
+		return !bWriteFailed;
+	}
+
+	bool CloseWriter(CAPTUREFILE_STATS * stats)
+	{
+		if (!bWriterOpen)
+			return false;
+
+		RetireFrames(0);
+		pthread_mutex_lock(&jobMutex);
+		bStopping = true;
+		pthread_cond_broadcast(&jobSubmitted);
+		pthread_mutex_unlock(&jobMutex);
+		for (size_t i = 0; i < encoderThreads.size(); i++)
+			pthread_join(encoderThreads[i], NULL);
+		encoderThreads.clear();
+		pthread_mutex_destroy(&jobMutex);
+		pthread_cond_destroy(&jobSubmitted);
+		pthread_cond_destroy(&jobEncoded);
+
+		// The index, then the trailer pointing at it
+		unsigned long long nIndexOffset = nWriteOffset;
+		std::vector<unsigned char> index(8 + writtenFrames.size() * nIndexEntrySize + nTrailerSize);
+		memcpy(&index[0], szIndexMagic, 4);
+		PutU32(&index[4], (unsigned int)writtenFrames.size());
+		unsigned char * p = &index[8];
+		for (size_t i = 0; i < writtenFrames.size(); i++, p += nIndexEntrySize)
+		{
+			PutU64(p, writtenFrames[i].nOffset);
+			PutU32(p + 8, writtenFrames[i].nNumber);
+			PutU32(p + 12, writtenFrames[i].width);
+			PutU32(p + 16, writtenFrames[i].height);
+			PutU32(p + 20, writtenFrames[i].nSize);
+		}
+		PutU64(p, nIndexOffset);
+		memcpy(p + 8, szTrailerMagic, 8);
+		WriteBytes(&index[0], index.size());
+		if (!bWriteFailed && fflush(fWriter) != 0)
+			bWriteFailed = true;
+
+		if (stats)
+			*stats = writerStats;
+		std::vector<EncodeJob>().swap(jobs);
+		std::vector<IndexEntry>().swap(writtenFrames);
+		fWriter = NULL;
+		bWriterOpen = false;
+		return !bWriteFailed;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// reader
+
+	static FILE * fReader = NULL;
+	static float fReaderFrameRate = 0.0f;
+	static std::vector<IndexEntry> readerFrames;
+	static std::vector<unsigned char> readBuffer;
+
+	static bool ReadBytes(long nOffset, unsigned char * pData, size_t nSize)
+	{
+		return fseek(fReader, nOffset, SEEK_SET) == 0 && fread(pData, 1, nSize, fReader) == nSize;
+	}
+
+	static bool ReadIndex(long nFileSize)
+	{
+		unsigned char trailer[nTrailerSize];
+		if (nFileSize < nHeaderSize + 8 + nTrailerSize || !ReadBytes(nFileSize - nTrailerSize, trailer, sizeof(trailer)) || memcmp(trailer + 8, szTrailerMagic, 8) != 0)
+			return false;
+
+		unsigned long long nIndexOffset = GetU64(trailer);
+		unsigned char header[8];
+		if (nIndexOffset > (unsigned long long)(nFileSize - nTrailerSize - 8) || !ReadBytes((long)nIndexOffset, header, sizeof(header)) || memcmp(header, szIndexMagic, 4) != 0)
+			return false;
+		unsigned int nCount = GetU32(header + 4);
+		if (nCount > (nFileSize - nIndexOffset - 8 - nTrailerSize) / nIndexEntrySize)
+			return false;
+
+		std::vector<unsigned char> index(nCount * nIndexEntrySize + 1);
+		if (fread(&index[0], nIndexEntrySize, nCount, fReader) != nCount)
+			return false;
+		readerFrames.resize(nCount);
+		for (unsigned int i = 0; i < nCount; i++)
+		{
+			const unsigned char * p = &index[i * nIndexEntrySize];
+			readerFrames[i].nOffset = GetU64(p);
+			readerFrames[i].nNumber = GetU32(p + 8);
+			readerFrames[i].width = GetU32(p + 12);
+			readerFrames[i].height = GetU32(p + 16);
+			readerFrames[i].nSize = GetU32(p + 20);
+		}
+		return true;
+	}
+
+	// Without an index, the chunks are walked from the start; a torn last one is left out
+	static void ScanChunks(long nFileSize)
+	{
+		readerFrames.clear();
+		long nOffset = nHeaderSize;
+		unsigned char header[nChunkHeaderSize];
+		while (nOffset + nChunkHeaderSize <= nFileSize && ReadBytes(nOffset, header, sizeof(header)) && memcmp(header, szChunkMagic, 4) == 0)
+		{
+			IndexEntry entry;
+			entry.nOffset = nOffset;
+			entry.nNumber = GetU32(header + 4);
+			entry.width = GetU32(header + 8);
+			entry.height = GetU32(header + 12);
+			entry.nSize = GetU32(header + 16);
+			nOffset += nChunkHeaderSize + (long)(unsigned int)entry.nSize;
+			if (nOffset > nFileSize)
+				break;
+			readerFrames.push_back(entry);
+		}
+	}
+
+	bool OpenReader(const char * szFilename)
+	{
+		CloseReader();
+		fReader = fopen(szFilename, "rb");
+		if (!fReader)
+		{
+			printf("[CaptureFile] Unable to open %s\n", szFilename);
+			return false;
+		}
+
+		unsigned char header[nHeaderSize];
+		if (fread(header, 1, sizeof(header), fReader) != sizeof(header) || memcmp(header, szFileMagic, 8) != 0 || GetU32(header + 8) != nFileVersion)
+		{
+			printf("[CaptureFile] %s is not a frame capture\n", szFilename);
+			CloseReader();
+			return false;
+		}
+		unsigned int nFrameRateBits = GetU32(header + 12);
+		memcpy(&fReaderFrameRate, &nFrameRateBits, 4);
+
+		fseek(fReader, 0, SEEK_END);
+		long nFileSize = ftell(fReader);
+		if (!ReadIndex(nFileSize))
+		{
+			printf("[CaptureFile] %s has no index, scanning its frames\n", szFilename);
+			ScanChunks(nFileSize);
+		}
+		return true;
+	}
+
+	int GetFrameCount()
+	{
+		return (int)readerFrames.size();
+	}
+
+	float GetFrameRate()
+	{
+		return fReaderFrameRate;
+	}
+
+	bool GetFrameInfo(int nIndex, int * pNumber, int * pWidth, int * pHeight)
+	{
+		if (nIndex < 0 || nIndex >= (int)readerFrames.size())
+			return false;
+		*pNumber = readerFrames[nIndex].nNumber;
+		*pWidth = readerFrames[nIndex].width;
+		*pHeight = readerFrames[nIndex].height;
+		return true;
+	}
+
+	bool ReadFrame(int nIndex, std::vector<unsigned char> & pixels)
+	{
+		if (!fReader || nIndex < 0 || nIndex >= (int)readerFrames.size())
+			return false;
+
+		const IndexEntry & entry = readerFrames[nIndex];
+		if (!IsValidFrameSize(entry.width, entry.height) || entry.nSize <= 0 || entry.nSize > GetMaxEncodedSize(entry.width, entry.height))
+			return false;
+		readBuffer.resize(entry.nSize);
+		if (!ReadBytes((long)entry.nOffset + nChunkHeaderSize, &readBuffer[0], entry.nSize))
+			return false;
+		pixels.resize((size_t)entry.width * entry.height * 4);
+		return DecodeFrame(&readBuffer[0], entry.nSize, entry.width, entry.height, &pixels[0]);
+	}
+
+	void CloseReader()
+	{
+		if (fReader)
+			fclose(fReader);
+		fReader = NULL;
+		readerFrames.clear();
+		std::vector<unsigned char>().swap(readBuffer);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// tools
+
+	struct Frame
+	{
+		std::vector<unsigned char> pixels;
+		int nNumber;
+		int width, height;
+	};
+
+	// Reads a binary PPM as RGBA; returns false at the end of the stream
+	static bool ReadPPM(FILE * f, Frame & frame)
+	{
+		char szMagic[3];
+		int nMax = 0;
+		if (fscanf(f, "%2s %d %d %d", szMagic, &frame.width, &frame.height, &nMax) != 4 || strcmp(szMagic, "P6") != 0 || nMax != 255 || !IsValidFrameSize(frame.width, frame.height))
+			return false;
+		fgetc(f);
+
+		int nPixels = frame.width * frame.height;
+		frame.pixels.resize((size_t)nPixels * 4);
+		unsigned char * p = &frame.pixels[0];
+		if (fread(p, 3, nPixels, f) != (size_t)nPixels)
+			return false;
+		for (int i = nPixels - 1; i >= 0; i--)
+		{
+			p[i * 4 + 3] = 255;
+			p[i * 4 + 2] = p[i * 3 + 2];
+			p[i * 4 + 1] = p[i * 3 + 1];
+			p[i * 4 + 0] = p[i * 3 + 0];
+		}
+		return true;
+	}
+
+	// A capture, a printf pattern of PPM files (numbered from the first one that exists)
+	// or a PPM stream; at most nMaxFrames, since they're all held in memory
+	static bool LoadFrames(const char * szInput, std::vector<Frame> & frames, int nMaxFrames)
+	{
+		std::string sInput = szInput;
+		if (sInput.size() > 4 && sInput.compare(sInput.size() - 4, 4, ".sfc") == 0)
+		{
+			if (!OpenReader(szInput))
+				return false;
+			for (int i = 0; i < GetFrameCount() && (int)frames.size() < nMaxFrames; i++)
+			{
+				Frame frame;
+				GetFrameInfo(i, &frame.nNumber, &frame.width, &frame.height);
+				if (!ReadFrame(i, frame.pixels))
+				{
+					printf("[CaptureFile] Frame %d of %s is damaged\n", i, szInput);
+					break;
+				}
+				frames.push_back(frame);
+			}
+			CloseReader();
+			return !frames.empty();
+		}
+
+		if (sInput.find('%') != std::string::npos)
+		{
+			bool bStarted = false;
+			for (int n = 0; n < 1000000 && (int)frames.size() < nMaxFrames; n++)
+			{
+				char szFilename[1024];
+				snprintf(szFilename, sizeof(szFilename), szInput, n);
+				FILE * f = fopen(szFilename, "rb");
+				if (!f)
+				{
+					if (bStarted)
+						break;
+					continue;
+				}
+				Frame frame;
+				frame.nNumber = n;
+				bool bRead = ReadPPM(f, frame);
+				fclose(f);
+				if (!bRead)
+					break;
+				frames.push_back(frame);
+				bStarted = true;
+			}
+			return !frames.empty();
+		}
+
+		FILE * f = fopen(szInput, "rb");
+		if (!f)
+		{
+			printf("[CaptureFile] Unable to open %s\n", szInput);
+			return false;
+		}
+		Frame frame;
+		frame.nNumber = 0;
+		while ((int)frames.size() < nMaxFrames && ReadPPM(f, frame))
+		{
+			frames.push_back(frame);
+			frame.nNumber++;
+		}
+		fclose(f);
+		return !frames.empty();
+	}
+
+	bool Benchmark(const char * szInput, int nThreads, const char * szOutput)
+	{
+		const int nMaxFrames = 120;
+		std::vector<Frame> frames;
+		if (!LoadFrames(szInput, frames, nMaxFrames))
+		{
+			printf("[CaptureFile] No frames in %s\n", szInput);
+			return false;
+		}
+
+		long long nRawBytes = 0;
+		for (size_t i = 0; i < frames.size(); i++)
+			nRawBytes += frames[i].pixels.size();
+		printf("[CaptureFile] %d frames from %s, %dx%d, %.1f MB\n", (int)frames.size(), szInput, frames[0].width, frames[0].height, nRawBytes / (1024.0 * 1024.0));
+
+		// One thread: the codec on its own, and the round trip
+		std::vector<unsigned char> encoded;
+		std::vector<unsigned char> decoded;
+		long long nEncodedBytes = 0;
+		double fEncodeTime = 0.0, fDecodeTime = 0.0;
+		bool bLossless = true;
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			const Frame & frame = frames[i];
+			encoded.resize(GetMaxEncodedSize(frame.width, frame.height));
+			decoded.resize(frame.pixels.size());
+
+			double fStart = Timer::GetTimePrecise();
+			int nSize = EncodeFrame(&frame.pixels[0], frame.width, frame.height, &encoded[0]);
+			double fEncoded = Timer::GetTimePrecise();
+			bool bDecoded = DecodeFrame(&encoded[0], nSize, frame.width, frame.height, &decoded[0]);
+			fDecodeTime += Timer::GetTimePrecise() - fEncoded;
+			fEncodeTime += fEncoded - fStart;
+			nEncodedBytes += nSize;
+
+			if (!bDecoded || decoded != frame.pixels)
+			{
+				printf("[CaptureFile] Frame %d doesn't survive the round trip\n", frame.nNumber);
+				bLossless = false;
+			}
+		}
+		double fMB = nRawBytes / (1024.0 * 1024.0);
+		printf("[CaptureFile] 1 thread: encode %.1f MB/s (%.1f fps), decode %.1f MB/s, %.2f:1 (%.2f bits per pixel)\n",
+			fMB / fEncodeTime, frames.size() / fEncodeTime, fMB / fDecodeTime, (double)nRawBytes / nEncodedBytes, nEncodedBytes * 32.0 / nRawBytes);
+
+		// The writer: encoder threads, in-order chunks and the index
+		FILE * f = szOutput ? fopen(szOutput, "wb") : tmpfile();
+		if (!f)
+		{
+			printf("[CaptureFile] Unable to open %s for writing\n", szOutput ? szOutput : "a temporary file");
+			return false;
+		}
+		CAPTUREFILE_SETTINGS settings;
+		settings.fFrameRate = 60.0f;
+		settings.nThreads = nThreads;
+		settings.nMaxFramesInFlight = 0;
+		CAPTUREFILE_STATS stats;
+		double fStart = Timer::GetTimePrecise();
+		bool bWritten = OpenWriter(f, &settings);
+		for (size_t i = 0; bWritten && i < frames.size(); i++)
+		{
+			// The writer takes the buffer it's given, so give it a copy
+			std::vector<unsigned char> pixels(frames[i].pixels);
+			bWritten = WriteFrame(pixels, frames[i].width, frames[i].height, frames[i].nNumber);
+		}
+		bWritten = CloseWriter(&stats) && bWritten;
+		double fWriteTime = Timer::GetTimePrecise() - fStart;
+		if (fclose(f) != 0)
+			bWritten = false;
+		int nWriterThreads = nThreads > 0 ? nThreads : 3;
+		printf("[CaptureFile] %d thread%s: write %.1f MB/s (%.1f fps) including copies and file I/O\n",
+			nWriterThreads, nWriterThreads > 1 ? "s" : "", fMB / fWriteTime, frames.size() / fWriteTime);
+		if (bWritten && szOutput)
+			printf("[CaptureFile] Wrote %s\n", szOutput);
+
+		return bLossless && bWritten;
+	}
+
+	bool Extract(const char * szInput, const char * szOutputPattern)
+	{
+		if (!OpenReader(szInput))
+			return false;
+
+		std::vector<unsigned char> pixels;
+		std::vector<unsigned char> rgb;
+		int nExtracted = 0;
+		bool bSuccess = true;
+		for (int i = 0; i < GetFrameCount() && bSuccess; i++)
+		{
+			int nNumber, width, height;
+			GetFrameInfo(i, &nNumber, &width, &height);
+			if (!ReadFrame(i, pixels))
+			{
+				printf("[CaptureFile] Frame %d of %s is damaged\n", i, szInput);
+				bSuccess = false;
+				break;
+			}
+
+			rgb.resize((size_t)width * height * 3);
+			for (int p = 0; p < width * height; p++)
+			{
+				rgb[p * 3 + 0] = pixels[p * 4 + 0];
+				rgb[p * 3 + 1] = pixels[p * 4 + 1];
+				rgb[p * 3 + 2] = pixels[p * 4 + 2];
+			}
+
+			char szFilename[1024];
+			snprintf(szFilename, sizeof(szFilename), szOutputPattern, nNumber);
+			FILE * f = fopen(szFilename, "wb");
+			if (!f)
+			{
+				printf("[CaptureFile] Unable to open %s for writing\n", szFilename);
+				bSuccess = false;
+				break;
+			}
+			bSuccess = fprintf(f, "P6\n%d %d\n255\n", width, height) > 0 && fwrite(&rgb[0], width * 3, height, f) == (size_t)height;
+			if (fclose(f) != 0)
+				bSuccess = false;
+			nExtracted += bSuccess;
+		}
+		printf("[CaptureFile] Extracted %d of %d frames at %g fps from %s\n", nExtracted, GetFrameCount(), GetFrameRate(), szInput);
+		CloseReader();
+		return bSuccess;
+	}
+}
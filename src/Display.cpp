@@ -0,0 +1,143 @@
+#include <stdio.h>
+
+#include "Shade.h"
+#include "Display.h"
+#include "Timer.h"
+
+namespace Display
+{
+	static DISPLAY_BACKEND backend = DISPLAY_BACKEND_SIMULATED;
+	static DISPLAY_MODE currentMode = DISPLAY_MODE_HANDHELD;
+	static bool bModeChanged = true;
+
+	static float fSimulatedSwitchInterval = 0.0f;
+	static float fNextSimulatedSwitch = -1.0f;
+
+	void GetDefaultSettings(DISPLAY_SETTINGS * settings)
+	{
+#ifdef __SWITCH__
+		settings->backend = DISPLAY_BACKEND_APPLET;
+#else
+		settings->backend = DISPLAY_BACKEND_SIMULATED;
+#endif
+		settings->initialMode = DISPLAY_MODE_HANDHELD;
+		settings->fSimulatedSwitchInterval = 0.0f;
+	}
+
+	static void SetMode(DISPLAY_MODE mode)
+	{
+		if (mode != currentMode)
+		{
+			currentMode = mode;
+			bModeChanged = true;
+		}
+	}
+
+#ifdef __SWITCH__
+	static AppletHookCookie appletHookCookie;
+
+	static DISPLAY_MODE GetAppletMode()
+	{
+		return appletGetOperationMode() == AppletOperationMode_Docked ? DISPLAY_MODE_DOCKED : DISPLAY_MODE_HANDHELD;
+	}
+
+	// Called from appletMainLoop() when the applet message queue reports a change,
+	// so we never have to query the operation mode on frames where nothing happened.
+	static void OnAppletHook(AppletHookType hook, void * param)
+	{
+		if (hook == AppletHookType_OnOperationMode)
+			SetMode(GetAppletMode());
+	}
+#endif
+
+	bool Open(DISPLAY_SETTINGS * settings)
+	{
+		backend = settings->backend;
+		bModeChanged = true;
+
+		switch (backend)
+		{
+		case DISPLAY_BACKEND_APPLET:
+#ifdef __SWITCH__
+			currentMode = GetAppletMode();
+			appletHook(&appletHookCookie, OnAppletHook, NULL);
+			break;
+#else
+			printf("[Display] Applet backend is only available on Switch\n");
+			return false;
+#endif
+		case DISPLAY_BACKEND_SIMULATED:
+			currentMode = settings->initialMode;
+			fSimulatedSwitchInterval = settings->fSimulatedSwitchInterval;
+			fNextSimulatedSwitch = -1.0f;
+			break;
+		}
+
+		return true;
+	}
+
+	bool Update()
+	{
+		if (backend == DISPLAY_BACKEND_SIMULATED)
+		{
+			// The schedule starts on the first update, once the main loop has started the timer.
+			if (fSimulatedSwitchInterval > 0.0f && fNextSimulatedSwitch < 0.0f)
+				fNextSimulatedSwitch = Timer::GetTime() + fSimulatedSwitchInterval;
+
+			if (fSimulatedSwitchInterval > 0.0f && Timer::GetTime() >= fNextSimulatedSwitch)
+			{
+				fNextSimulatedSwitch = Timer::GetTime() + fSimulatedSwitchInterval;
+				SetMode(currentMode == DISPLAY_MODE_DOCKED ? DISPLAY_MODE_HANDHELD : DISPLAY_MODE_DOCKED);
+				printf("[Display] Simulated switch to %s mode\n", currentMode == DISPLAY_MODE_DOCKED ? "docked" : "handheld");
+			}
+			return true;
+		}
+
+#ifdef __SWITCH__
+		return appletMainLoop();
+#else
+		return true;
+#endif
+	}
+
+	bool PollModeChange(int * pWidth, int * pHeight)
+	{
+		if (!bModeChanged)
+			return false;
+
+		bModeChanged = false;
+		GetModeResolution(currentMode, pWidth, pHeight);
+		return true;
+	}
+
+	DISPLAY_MODE GetMode()
+	{
+		return currentMode;
+	}
+
+	void GetModeResolution(DISPLAY_MODE mode, int * pWidth, int * pHeight)
+	{
+		// - In handheld mode, we render at 720p (which is the native screen resolution).
+		// - In docked mode, we render at full 1080p (which is outputted to a compatible HDTV screen).
+		switch (mode)
+		{
+		default:
+		case DISPLAY_MODE_HANDHELD:
+			*pWidth = 1280;
+			*pHeight = 720;
+			break;
+		case DISPLAY_MODE_DOCKED:
+			*pWidth = 1920;
+			*pHeight = 1080;
+			break;
+		}
+	}
+
+	void SimulateModeChange(DISPLAY_MODE mode)
+	{
+		if (backend != DISPLAY_BACKEND_SIMULATED)
+			return;
+
+		SetMode(mode);
+	}
+}
\ No newline at end of file
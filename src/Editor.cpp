@@ -0,0 +1,641 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Shade.h"
+#include "Renderer.h"
+#include "TextRenderer.h"
+#include "PieceTable.h"
+#include "Timer.h"
+#include "Editor.h"
+
+namespace Editor
+{
+	enum TOKENTYPE
+	{
+		TOKEN_TEXT,
+		TOKEN_KEYWORD,
+		TOKEN_TYPE,
+		TOKEN_BUILTIN,
+		TOKEN_NUMBER,
+		TOKEN_COMMENT,
+		TOKEN_PREPROCESSOR,
+		TOKEN_COUNT
+	};
+
+	// Lexer state carried from one line to the next
+	enum LEXSTATE
+	{
+		LEXSTATE_NORMAL,
+		LEXSTATE_BLOCKCOMMENT,
+	};
+
+	static const unsigned int tokenColors[TOKEN_COUNT] =
+	{
+		0xFFD4D4D4, // text
+		0xFFD69C56, // keyword
+		0xFFB0C94E, // type
+		0xFFAADCDC, // builtin
+		0xFFA8CEB5, // number
+		0xFF55996A, // comment
+		0xFFC086C5, // preprocessor
+	};
+	static const unsigned int nLineNumberColor = 0xFF808080;
+	static const unsigned int nCurrentLineColor = 0x30FFFFFF;
+	static const unsigned int nCaretColor = 0xFFFFFFFF;
+
+	static const char * szKeywords =
+		"attribute const uniform varying buffer shared coherent volatile restrict readonly writeonly "
+		"layout centroid flat smooth noperspective patch sample break continue do for while switch "
+		"case default if else subroutine in out inout true false invariant precise discard return "
+		"lowp mediump highp precision struct";
+	static const char * szTypes =
+		"void bool int uint float double vec2 vec3 vec4 dvec2 dvec3 dvec4 bvec2 bvec3 bvec4 "
+		"ivec2 ivec3 ivec4 uvec2 uvec3 uvec4 mat2 mat3 mat4 mat2x2 mat2x3 mat2x4 mat3x2 mat3x3 "
+		"mat3x4 mat4x2 mat4x3 mat4x4 sampler1D sampler2D sampler3D samplerCube sampler2DArray "
+		"sampler2DShadow isampler2D usampler2D image2D";
+	static const char * szBuiltins =
+		"radians degrees sin cos tan asin acos atan sinh cosh tanh asinh acosh atanh pow exp log "
+		"exp2 log2 sqrt inversesqrt abs sign floor trunc round roundEven ceil fract mod modf min "
+		"max clamp mix step smoothstep isnan isinf length distance dot cross normalize "
+		"faceforward reflect refract matrixCompMult outerProduct transpose determinant inverse "
+		"lessThan lessThanEqual greaterThan greaterThanEqual equal notEqual any all not texture "
+		"textureSize textureLod textureOffset texelFetch textureGrad dFdx dFdy fwidth "
+		"floatBitsToInt floatBitsToUint intBitsToFloat uintBitsToFloat packUnorm2x16 "
+		"unpackUnorm2x16 packHalf2x16 unpackHalf2x16 bitfieldExtract bitCount findLSB findMSB "
+		"gl_FragCoord gl_FrontFacing gl_PointCoord fGlobalTime v2Resolution";
+
+	struct TOKEN
+	{
+		int nStart;
+		int nLength;
+		int nType;
+	};
+
+	struct LINE
+	{
+		std::vector<TOKEN> tokens;   // everything not covered is TOKEN_TEXT
+		int nStartState;             // lexer state the tokens were built from
+		int nEndState;
+		bool bDirty;                 // text changed since the line was tokenised
+		std::vector<TEXTRENDERER_GLYPHQUAD> run;
+		float fRunWidth;
+		bool bRunValid;
+	};
+
+	static bool bOpen = false;
+	static bool bVisible = true;
+	static EDITOR_SETTINGS settings;
+	static PieceTable text;
+	static std::vector<LINE> lines;
+	static std::map<std::string, int> words;
+	static int nValidLines = 0;          // leading lines whose tokens are up to date
+	static unsigned int nRunGeneration = 0;
+	static int nCaretLine = 0;
+	static int nCaretColumn = 0;         // byte offset into the line
+	static int nTopLine = 0;
+	static int nVisibleLines = 1;
+	static std::string sScratch;
+	static std::vector<std::string> lineNumbers;
+
+	static EDITOR_STATS stats;
+	static double fFrameTime = 0.0;      // editor CPU time accumulated since the last Draw
+	static double fTotalTime = 0.0;
+	static int nFrameLinesLexed = 0;
+
+	// Keeps time spent in a call on the current frame's account
+	class ScopedFrameTime
+	{
+	public:
+		ScopedFrameTime() : fStart(Timer::GetTimePrecise()) {}
+		~ScopedFrameTime() { fFrameTime += Timer::GetTimePrecise() - fStart; }
+	private:
+		double fStart;
+	};
+
+	static void AddWords(const char * szList, int nType)
+	{
+		const char * p = szList;
+		while (*p)
+		{
+			const char * pEnd = strchr(p, ' ');
+			if (!pEnd)
+				pEnd = p + strlen(p);
+			words[std::string(p, pEnd - p)] = nType;
+			p = *pEnd ? pEnd + 1 : pEnd;
+		}
+	}
+
+	static void ResetLine(LINE & line)
+	{
+		line.tokens.clear();
+		line.nStartState = LEXSTATE_NORMAL;
+		line.nEndState = LEXSTATE_NORMAL;
+		line.bDirty = true;
+		line.run.clear();
+		line.fRunWidth = 0.0f;
+		line.bRunValid = false;
+	}
+
+	// The panel follows the output resolution unless it has a fixed size
+	static void UpdatePanelSize(float * pLineHeight, float * pWidth, float * pHeight)
+	{
+		*pLineHeight = floorf(TextRenderer::GetLineHeight(settings.fFontSize) + 0.5f);
+		*pWidth = settings.fWidth > 0.0f ? settings.fWidth : Renderer::nWidth - settings.fX;
+		*pHeight = settings.fHeight > 0.0f ? settings.fHeight : Renderer::nHeight - settings.fY;
+		nVisibleLines = (int)(*pHeight / *pLineHeight);
+		if (nVisibleLines < 1)
+			nVisibleLines = 1;
+	}
+
+	bool Open(EDITOR_SETTINGS * pSettings)
+	{
+		if (!TextRenderer::IsOpen())
+		{
+			printf("[Editor] Needs the text renderer\n");
+			return false;
+		}
+		settings = *pSettings;
+		if (words.empty())
+		{
+			AddWords(szKeywords, TOKEN_KEYWORD);
+			AddWords(szTypes, TOKEN_TYPE);
+			AddWords(szBuiltins, TOKEN_BUILTIN);
+		}
+		memset(&stats, 0, sizeof(stats));
+		fFrameTime = 0.0;
+		fTotalTime = 0.0;
+		float fLineHeight = 0.0f, fWidth = 0.0f, fHeight = 0.0f;
+		UpdatePanelSize(&fLineHeight, &fWidth, &fHeight);
+		bOpen = true;
+		SetText("", 0);
+		return true;
+	}
+
+	void Close()
+	{
+		if (!bOpen)
+			return;
+		text.SetText("", 0);
+		lines.clear();
+		lineNumbers.clear();
+		bOpen = false;
+	}
+
+	bool IsOpen()
+	{
+		return bOpen;
+	}
+
+	void SetVisible(bool bShow)
+	{
+		bVisible = bShow;
+	}
+
+	bool IsVisible()
+	{
+		return bVisible;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Lexer
+
+	static bool IsIdentifierStart(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
+
+	static bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	static void AddToken(std::vector<TOKEN> & tokens, int nStart, int nLength, int nType)
+	{
+		TOKEN token = { nStart, nLength, nType };
+		tokens.push_back(token);
+	}
+
+	// Tokenises one line starting in nState and returns the state at its end. Plain text
+	// and punctuation get no token.
+	static int LexLine(const std::string & sLine, int nState, std::vector<TOKEN> & tokens)
+	{
+		tokens.clear();
+		int n = (int)sLine.size();
+		const char * s = sLine.c_str();
+		int i = 0;
+
+		if (nState == LEXSTATE_BLOCKCOMMENT)
+		{
+			const char * pEnd = strstr(s, "*/");
+			if (!pEnd)
+			{
+				AddToken(tokens, 0, n, TOKEN_COMMENT);
+				return LEXSTATE_BLOCKCOMMENT;
+			}
+			i = (int)(pEnd - s) + 2;
+			AddToken(tokens, 0, i, TOKEN_COMMENT);
+		}
+		else
+		{
+			int nFirst = 0;
+			while (nFirst < n && (s[nFirst] == ' ' || s[nFirst] == '\t'))
+				nFirst++;
+			if (nFirst < n && s[nFirst] == '#')
+			{
+				AddToken(tokens, nFirst, n - nFirst, TOKEN_PREPROCESSOR);
+				return LEXSTATE_NORMAL;
+			}
+		}
+
+		while (i < n)
+		{
+			char c = s[i];
+			if (c == '/' && s[i + 1] == '/')
+			{
+				AddToken(tokens, i, n - i, TOKEN_COMMENT);
+				break;
+			}
+			if (c == '/' && s[i + 1] == '*')
+			{
+				const char * pEnd = strstr(s + i + 2, "*/");
+				if (!pEnd)
+				{
+					AddToken(tokens, i, n - i, TOKEN_COMMENT);
+					return LEXSTATE_BLOCKCOMMENT;
+				}
+				int nEnd = (int)(pEnd - s) + 2;
+				AddToken(tokens, i, nEnd - i, TOKEN_COMMENT);
+				i = nEnd;
+				continue;
+			}
+			if (IsDigit(c) || (c == '.' && IsDigit(s[i + 1])))
+			{
+				int nStart = i;
+				while (i < n && (IsDigit(s[i]) || IsIdentifierStart(s[i]) || s[i] == '.'
+					|| ((s[i] == '+' || s[i] == '-') && (s[i - 1] == 'e' || s[i - 1] == 'E'))))
+					i++;
+				AddToken(tokens, nStart, i - nStart, TOKEN_NUMBER);
+				continue;
+			}
+			if (IsIdentifierStart(c))
+			{
+				int nStart = i;
+				while (i < n && (IsIdentifierStart(s[i]) || IsDigit(s[i])))
+					i++;
+				std::map<std::string, int>::const_iterator it = words.find(std::string(s + nStart, i - nStart));
+				if (it != words.end())
+					AddToken(tokens, nStart, i - nStart, it->second);
+				continue;
+			}
+			i++;
+		}
+		return LEXSTATE_NORMAL;
+	}
+
+	// Brings the tokens of every line up to nLastLine up to date. Clean lines that still
+	// start in the state they were tokenised in are skipped, so a changed state only
+	// ripples as far as it actually changes anything.
+	static void LexLines(int nLastLine)
+	{
+		if (nLastLine >= (int)lines.size())
+			nLastLine = (int)lines.size() - 1;
+		for (int i = nValidLines; i <= nLastLine; i++)
+		{
+			LINE & line = lines[i];
+			int nState = i > 0 ? lines[i - 1].nEndState : LEXSTATE_NORMAL;
+			if (!line.bDirty && line.nStartState == nState)
+				continue;
+
+			text.GetLine(i, sScratch);
+			line.nStartState = nState;
+			line.nEndState = LexLine(sScratch, nState, line.tokens);
+			line.bDirty = false;
+			line.bRunValid = false;
+			nFrameLinesLexed++;
+		}
+		if (nLastLine + 1 > nValidLines)
+			nValidLines = nLastLine + 1;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Editing
+
+	// Keeps the per-line caches in step with the piece table after an edit that started
+	// on nLine and changed the number of lines by nDelta
+	static void OnEdit(int nLine, int nDelta)
+	{
+		if (nDelta > 0)
+		{
+			LINE empty;
+			ResetLine(empty);
+			lines.insert(lines.begin() + nLine + 1, nDelta, empty);
+		}
+		else if (nDelta < 0)
+		{
+			lines.erase(lines.begin() + nLine + 1, lines.begin() + nLine + 1 - nDelta);
+		}
+		for (int i = nLine; i <= nLine + (nDelta > 0 ? nDelta : 0); i++)
+		{
+			lines[i].bDirty = true;
+			lines[i].bRunValid = false;
+		}
+		if (nLine < nValidLines)
+			nValidLines = nLine;
+	}
+
+	static int GetCaretOffset()
+	{
+		return text.GetLineStart(nCaretLine) + nCaretColumn;
+	}
+
+	static void SetCaretOffset(int nOffset)
+	{
+		nCaretLine = text.GetLineFromOffset(nOffset);
+		nCaretColumn = nOffset - text.GetLineStart(nCaretLine);
+	}
+
+	static void ScrollToCaret()
+	{
+		if (nCaretLine < nTopLine)
+			nTopLine = nCaretLine;
+		else if (nCaretLine >= nTopLine + nVisibleLines)
+			nTopLine = nCaretLine - nVisibleLines + 1;
+	}
+
+	static void Insert(const char * szText, int nLength)
+	{
+		int nOffset = GetCaretOffset();
+		int nLinesBefore = text.GetLineCount();
+		text.Insert(nOffset, szText, nLength);
+		OnEdit(nCaretLine, text.GetLineCount() - nLinesBefore);
+		SetCaretOffset(nOffset + nLength);
+		ScrollToCaret();
+	}
+
+	static void Erase(int nOffset, int nCount)
+	{
+		int nLinesBefore = text.GetLineCount();
+		int nLine = text.GetLineFromOffset(nOffset);
+		text.Erase(nOffset, nCount);
+		OnEdit(nLine, text.GetLineCount() - nLinesBefore);
+		SetCaretOffset(nOffset);
+		ScrollToCaret();
+	}
+
+	void SetText(const char * szText, int nLength)
+	{
+		if (!bOpen)
+			return;
+		ScopedFrameTime frameTime;
+
+		text.SetText(szText, nLength);
+		LINE empty;
+		ResetLine(empty);
+		lines.assign(text.GetLineCount(), empty);
+		nValidLines = 0;
+		if (nCaretLine >= text.GetLineCount())
+			nCaretLine = text.GetLineCount() - 1;
+		if (nCaretColumn > text.GetLineLength(nCaretLine))
+			nCaretColumn = text.GetLineLength(nCaretLine);
+		ScrollToCaret();
+	}
+
+	std::string GetText()
+	{
+		return text.GetText();
+	}
+
+	void InsertText(const char * szText)
+	{
+		if (!bOpen)
+			return;
+		ScopedFrameTime frameTime;
+		Insert(szText, (int)strlen(szText));
+	}
+
+	void SetCaret(int nLine, int nColumn)
+	{
+		if (!bOpen)
+			return;
+		nCaretLine = nLine < 0 ? 0 : nLine >= text.GetLineCount() ? text.GetLineCount() - 1 : nLine;
+		int nLength = text.GetLineLength(nCaretLine);
+		nCaretColumn = nColumn < 0 ? 0 : nColumn > nLength ? nLength : nColumn;
+		ScrollToCaret();
+	}
+
+	// Steps over a whole UTF-8 sequence
+	static int NextCharacter(int nOffset, int nDirection)
+	{
+		std::string sChar;
+		do
+		{
+			nOffset += nDirection;
+			if (nOffset <= 0 || nOffset >= text.GetLength())
+				break;
+			text.GetText(nOffset, 1, sChar);
+		} while ((sChar[0] & 0xC0) == 0x80);
+		return nOffset;
+	}
+
+	void HandleKey(EDITOR_KEY key)
+	{
+		if (!bOpen)
+			return;
+		ScopedFrameTime frameTime;
+
+		int nOffset = GetCaretOffset();
+		switch (key)
+		{
+		case EDITOR_KEY_LEFT:
+			if (nOffset > 0)
+				SetCaretOffset(NextCharacter(nOffset, -1));
+			break;
+		case EDITOR_KEY_RIGHT:
+			if (nOffset < text.GetLength())
+				SetCaretOffset(NextCharacter(nOffset, 1));
+			break;
+		case EDITOR_KEY_UP:
+			SetCaret(nCaretLine - 1, nCaretColumn);
+			break;
+		case EDITOR_KEY_DOWN:
+			SetCaret(nCaretLine + 1, nCaretColumn);
+			break;
+		case EDITOR_KEY_HOME:
+			nCaretColumn = 0;
+			break;
+		case EDITOR_KEY_END:
+			nCaretColumn = text.GetLineLength(nCaretLine);
+			break;
+		case EDITOR_KEY_PAGEUP:
+			SetCaret(nCaretLine - nVisibleLines, nCaretColumn);
+			break;
+		case EDITOR_KEY_PAGEDOWN:
+			SetCaret(nCaretLine + nVisibleLines, nCaretColumn);
+			break;
+		case EDITOR_KEY_BACKSPACE:
+			if (nOffset > 0)
+			{
+				int nPrevious = NextCharacter(nOffset, -1);
+				Erase(nPrevious, nOffset - nPrevious);
+			}
+			break;
+		case EDITOR_KEY_DELETE:
+			if (nOffset < text.GetLength())
+				Erase(nOffset, NextCharacter(nOffset, 1) - nOffset);
+			break;
+		case EDITOR_KEY_ENTER:
+			{
+				// Keep the indentation of the current line
+				text.GetLine(nCaretLine, sScratch);
+				size_t nIndent = sScratch.find_first_not_of(" \t");
+				if (nIndent == std::string::npos || (int)nIndent > nCaretColumn)
+					nIndent = nCaretColumn;
+				std::string sBreak = "\n" + sScratch.substr(0, nIndent);
+				Insert(sBreak.c_str(), (int)sBreak.size());
+			}
+			break;
+		case EDITOR_KEY_TAB:
+			Insert("\t", 1);
+			break;
+		}
+		ScrollToCaret();
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Drawing
+
+	// Glyphs moved around in the cache make every laid out run stale. Any text drawn or laid
+	// out can evict a glyph, so this is checked again before each cached run is drawn.
+	static void InvalidateStaleRuns()
+	{
+		if (nRunGeneration == TextRenderer::GetCacheGeneration())
+			return;
+		for (size_t i = 0; i < lines.size(); i++)
+			lines[i].bRunValid = false;
+		nRunGeneration = TextRenderer::GetCacheGeneration();
+	}
+
+	static void BuildRun(int nLine, float fSize)
+	{
+		LINE & line = lines[nLine];
+		text.GetLine(nLine, sScratch);
+		line.fRunWidth = TextRenderer::LayoutRun(sScratch.c_str(), (int)sScratch.size(), fSize, line.run);
+
+		size_t nToken = 0;
+		for (size_t i = 0; i < line.run.size(); i++)
+		{
+			TEXTRENDERER_GLYPHQUAD & quad = line.run[i];
+			while (nToken < line.tokens.size() && line.tokens[nToken].nStart + line.tokens[nToken].nLength <= quad.nOffset)
+				nToken++;
+			bool bInToken = nToken < line.tokens.size() && line.tokens[nToken].nStart <= quad.nOffset;
+			quad.nColor = tokenColors[bInToken ? line.tokens[nToken].nType : TOKEN_TEXT];
+		}
+		line.bRunValid = true;
+		stats.nRunsBuilt++;
+	}
+
+	static float GetCaretX(const LINE & line)
+	{
+		for (size_t i = 0; i < line.run.size(); i++)
+		{
+			if (line.run[i].nOffset >= nCaretColumn)
+				return line.run[i].fPen;
+		}
+		return line.fRunWidth;
+	}
+
+	static const std::string & GetLineNumber(int nLine)
+	{
+		while ((int)lineNumbers.size() <= nLine)
+		{
+			char szNumber[16];
+			snprintf(szNumber, sizeof(szNumber), "%d", (int)lineNumbers.size() + 1);
+			lineNumbers.push_back(szNumber);
+		}
+		return lineNumbers[nLine];
+	}
+
+	static void EndFrameStats()
+	{
+		stats.nLines = text.GetLineCount();
+		stats.nLinesLexed = nFrameLinesLexed;
+		stats.fLastTime = (float)(fFrameTime * 1000.0);
+		if (stats.fLastTime > stats.fWorstTime)
+			stats.fWorstTime = stats.fLastTime;
+		fTotalTime += fFrameTime;
+		stats.nFrames++;
+		stats.fAverageTime = (float)(fTotalTime * 1000.0 / stats.nFrames);
+		fFrameTime = 0.0;
+		nFrameLinesLexed = 0;
+	}
+
+	void Draw()
+	{
+		if (!bOpen || !bVisible)
+			return;
+		{
+			ScopedFrameTime frameTime;
+			stats.nRunsBuilt = 0;
+
+			float fSize = settings.fFontSize;
+			float fLineHeight = 0.0f, fWidth = 0.0f, fHeight = 0.0f;
+			UpdatePanelSize(&fLineHeight, &fWidth, &fHeight);
+			ScrollToCaret();
+			int nLastLine = nTopLine + nVisibleLines - 1;
+			if (nLastLine >= text.GetLineCount())
+				nLastLine = text.GetLineCount() - 1;
+
+			LexLines(nLastLine);
+
+			float fGutter = 0.0f, fDigitHeight = 0.0f;
+			TextRenderer::MeasureString(GetLineNumber(text.GetLineCount() - 1).c_str(), fSize, &fGutter, &fDigitHeight);
+			fGutter = floorf(fGutter + fLineHeight);
+			float x = floorf(settings.fX);
+			float y = floorf(settings.fY);
+
+			Renderer::BindTexture(NULL);
+			if (settings.nBackgroundColor & 0xFF000000)
+				Renderer::RenderRect(x, y, fWidth, fHeight, settings.nBackgroundColor);
+			Renderer::RenderRect(x, y + (nCaretLine - nTopLine) * fLineHeight, fWidth, fLineHeight, nCurrentLineColor);
+
+			for (int i = nTopLine; i <= nLastLine; i++)
+			{
+				LINE & line = lines[i];
+				float fLineY = y + (i - nTopLine) * fLineHeight;
+				TextRenderer::DrawString(x, fLineY, GetLineNumber(i).c_str(), nLineNumberColor, fSize);
+				InvalidateStaleRuns();
+				if (!line.bRunValid)
+				{
+					BuildRun(i, fSize);
+					// Whatever this layout evicted belonged to other lines; this one is current
+					InvalidateStaleRuns();
+					line.bRunValid = true;
+				}
+				if (!line.run.empty())
+					TextRenderer::DrawRun(x + fGutter, fLineY, &line.run[0], (int)line.run.size());
+			}
+
+			Renderer::BindTexture(NULL);
+			float fCaretX = x + fGutter + floorf(GetCaretX(lines[nCaretLine]));
+			Renderer::RenderRect(fCaretX, y + (nCaretLine - nTopLine) * fLineHeight, 2.0f, fLineHeight, nCaretColor);
+		}
+		EndFrameStats();
+	}
+
+	void GetStats(EDITOR_STATS * pStats)
+	{
+		*pStats = stats;
+	}
+
+	void ResetStats()
+	{
+		stats.fWorstTime = 0.0f;
+		stats.fAverageTime = 0.0f;
+		stats.nFrames = 0;
+		fTotalTime = 0.0;
+	}
+}
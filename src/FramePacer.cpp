@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <math.h>
+#include <deque>
+
+#include "Shade.h"
+#include "Timer.h"
+#include "FramePacer.h"
+
+namespace FramePacer
+{
+	// Frame times go into log-linear buckets (HDR histogram style): 8 linear sub-buckets
+	// per power of two of microseconds, so every bucket is within ~12% of its value from
+	// microseconds up to seconds, in a fixed 200-odd counters.
+	static const int nSubBuckets = 8;
+	static const int nSubBucketBits = 3;
+	static const int nBuckets = nSubBuckets + 25 * nSubBuckets;
+
+	// The OS sleep may overshoot by about this much; the rest of the wait is spun
+	static const double fSpinThreshold = 0.002;
+
+	static FRAMEPACER_SETTINGS settings = { 0.0f, 0 };
+	static std::deque<GLsync> framesInFlight;
+	static double fDeadline = 0.0;
+	static double fLastFrameEnd = 0.0;
+
+	static unsigned int histogram[nBuckets];
+	static int nFrames = 0;
+	static double fSum = 0.0;
+	static double fSumSquares = 0.0;
+	static unsigned int nMin = 0;
+	static unsigned int nMax = 0;
+	static int nLimiterWaits = 0;
+	static int nFenceWaits = 0;
+
+	static int BucketOf(unsigned int nMicroseconds)
+	{
+		if (nMicroseconds < (unsigned int)nSubBuckets)
+			return nMicroseconds;
+		int nExponent = 0;
+		while ((nMicroseconds >> (nExponent + 1)) != 0)
+			nExponent++;
+		int nSub = (nMicroseconds >> (nExponent - nSubBucketBits)) & (nSubBuckets - 1);
+		int nBucket = (nExponent - nSubBucketBits + 1) * nSubBuckets + nSub;
+		return nBucket < nBuckets ? nBucket : nBuckets - 1;
+	}
+
+	static unsigned int BucketLowerBound(int nBucket)
+	{
+		if (nBucket < nSubBuckets)
+			return nBucket;
+		int nShift = nBucket / nSubBuckets - 1;
+		return (unsigned int)(nSubBuckets + nBucket % nSubBuckets) << nShift;
+	}
+
+	static float Percentile(float fFraction)
+	{
+		unsigned int nTarget = (unsigned int)ceil(nFrames * fFraction);
+		unsigned int nCount = 0;
+		for (int i = 0; i < nBuckets; i++)
+		{
+			nCount += histogram[i];
+			if (nCount >= nTarget && histogram[i])
+			{
+				// Middle of the bucket, clamped to what was actually seen
+				float fValue = (BucketLowerBound(i) + BucketLowerBound(i + 1)) * 0.5f;
+				if (fValue < nMin) fValue = (float)nMin;
+				if (fValue > nMax) fValue = (float)nMax;
+				return fValue / 1000.0f;
+			}
+		}
+		return nMax / 1000.0f;
+	}
+
+	static void RecordFrame(double fFrameTime)
+	{
+		unsigned int nMicroseconds = (unsigned int)(fFrameTime * 1000000.0 + 0.5);
+		histogram[BucketOf(nMicroseconds)]++;
+		if (!nFrames || nMicroseconds < nMin) nMin = nMicroseconds;
+		if (!nFrames || nMicroseconds > nMax) nMax = nMicroseconds;
+		nFrames++;
+		fSum += fFrameTime;
+		fSumSquares += fFrameTime * fFrameTime;
+	}
+
+	void Open(FRAMEPACER_SETTINGS * pSettings)
+	{
+		settings = *pSettings;
+		fDeadline = 0.0;
+		fLastFrameEnd = 0.0;
+		ResetStats();
+	}
+
+	void Close()
+	{
+		while (!framesInFlight.empty())
+		{
+			glDeleteSync(framesInFlight.front());
+			framesInFlight.pop_front();
+		}
+	}
+
+	void EndFrame()
+	{
+		if (settings.nMaxFramesInFlight > 0)
+		{
+			framesInFlight.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+			while ((int)framesInFlight.size() > settings.nMaxFramesInFlight)
+			{
+				GLsync fence = framesInFlight.front();
+				framesInFlight.pop_front();
+				if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+				{
+					nFenceWaits++;
+					glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+				}
+				glDeleteSync(fence);
+			}
+		}
+
+		double fNow = Timer::GetTimePrecise();
+		if (settings.fFrameRateLimit > 0.0f)
+		{
+			double fPeriod = 1.0 / settings.fFrameRateLimit;
+			fDeadline += fPeriod;
+			if (fNow < fDeadline)
+			{
+				// Sleep most of the remaining time, then spin for an accurate wake-up
+				nLimiterWaits++;
+				Timer::Sleep(fDeadline - fNow - fSpinThreshold);
+				while ((fNow = Timer::GetTimePrecise()) < fDeadline)
+					;
+			}
+			else if (fNow - fDeadline > fPeriod)
+			{
+				// Fell more than a frame behind: don't try to catch up with a burst of frames
+				fDeadline = fNow;
+			}
+		}
+
+		// A jump backwards means the clock was restarted; skip that sample
+		if (fLastFrameEnd > 0.0 && fNow > fLastFrameEnd)
+			RecordFrame(fNow - fLastFrameEnd);
+		fLastFrameEnd = fNow;
+	}
+
+	void GetStats(FRAMEPACER_STATS * stats)
+	{
+		stats->nFrames = nFrames;
+		stats->nLimiterWaits = nLimiterWaits;
+		stats->nFenceWaits = nFenceWaits;
+		if (!nFrames)
+		{
+			stats->fAverage = stats->fJitter = stats->fMin = stats->fP50 = stats->fP90 = stats->fP99 = stats->fMax = 0.0f;
+			return;
+		}
+
+		double fMean = fSum / nFrames;
+		double fVariance = fSumSquares / nFrames - fMean * fMean;
+		stats->fAverage = (float)(fMean * 1000.0);
+		stats->fJitter = (float)(sqrt(fVariance > 0.0 ? fVariance : 0.0) * 1000.0);
+		stats->fMin = nMin / 1000.0f;
+		stats->fP50 = Percentile(0.50f);
+		stats->fP90 = Percentile(0.90f);
+		stats->fP99 = Percentile(0.99f);
+		stats->fMax = nMax / 1000.0f;
+	}
+
+	void ResetStats()
+	{
+		for (int i = 0; i < nBuckets; i++)
+			histogram[i] = 0;
+		nFrames = 0;
+		fSum = 0.0;
+		fSumSquares = 0.0;
+		nMin = 0;
+		nMax = 0;
+		nLimiterWaits = 0;
+		nFenceWaits = 0;
+	}
+
+	void DumpHistogram()
+	{
+		FRAMEPACER_STATS stats;
+		GetStats(&stats);
+		printf("[FramePacer] %d frames: avg %.2f ms, jitter %.2f ms, min %.2f / p50 %.2f / p90 %.2f / p99 %.2f / max %.2f ms\n",
+			stats.nFrames, stats.fAverage, stats.fJitter, stats.fMin, stats.fP50, stats.fP90, stats.fP99, stats.fMax);
+		printf("[FramePacer] limiter waited on %d frames, frames-in-flight limit blocked %d frames\n", stats.nLimiterWaits, stats.nFenceWaits);
+
+		unsigned int nLargest = 0;
+		for (int i = 0; i < nBuckets; i++)
+			if (histogram[i] > nLargest) nLargest = histogram[i];
+		for (int i = 0; i < nBuckets; i++)
+		{
+			if (!histogram[i])
+				continue;
+			char szBar[41];
+			int nBar = (int)((histogram[i] * 40ull + nLargest - 1) / nLargest);
+			for (int j = 0; j < 40; j++)
+				szBar[j] = j < nBar ? '#' : ' ';
+			szBar[40] = 0;
+			printf("  %8.2f - %8.2f ms %s %u\n", BucketLowerBound(i) / 1000.0f, BucketLowerBound(i + 1) / 1000.0f, szBar, histogram[i]);
+		}
+	}
+}
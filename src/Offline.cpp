@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string>
+
+#include "Shade.h"
+#include "Renderer.h"
+#include "Recorder.h"
+#include "Timer.h"
+#include "Offline.h"
+
+namespace Offline
+{
+	static bool bOpen = false;
+	static OFFLINE_SETTINGS offlineSettings;
+
+	static int nFrame = 0;       // frame being rendered
+	static int nRepeats = 0;     // frames rendered again for the recorder
+	static int nWidth = 0;       // output resolution the render started at
+	static int nHeight = 0;
+	static bool bSuccess = true;
+	static double fStartTime = 0.0;
+
+	static void SetFrameTime(int n)
+	{
+		Timer::Freeze((float)((double)n / offlineSettings.fFrameRate));
+	}
+
+	bool Open(OFFLINE_SETTINGS * settings)
+	{
+		if (settings->fFrameRate <= 0.0f || settings->nEndFrame <= settings->nStartFrame)
+		{
+			printf("[Offline] Invalid frame range [%d, %d) at %g fps\n", settings->nStartFrame, settings->nEndFrame, settings->fFrameRate);
+			return false;
+		}
+
+		offlineSettings = *settings;
+		nWidth = Renderer::nWidth;
+		nHeight = Renderer::nHeight;
+
+		nFrame = settings->nStartFrame;
+		nRepeats = 0;
+		SetFrameTime(nFrame);
+		bSuccess = true;
+		bOpen = true;
+
+		printf("[Offline] Rendering frames %d to %d at %g fps, %dx%d\n",
+			settings->nStartFrame, settings->nEndFrame - 1, settings->fFrameRate, nWidth, nHeight);
+		fStartTime = Timer::GetTimePrecise();
+		return true;
+	}
+
+	bool IsOpen()
+	{
+		return bOpen;
+	}
+
+	bool EndFrame(bool bAdvance)
+	{
+		if (Renderer::nWidth != nWidth || Renderer::nHeight != nHeight)
+		{
+			printf("[Offline] The output resolution changed during the render\n");
+			bSuccess = false;
+			return false;
+		}
+		Renderer::EndFrame(false);
+
+		if (Recorder::HasFailed())
+		{
+			bSuccess = false;
+			return false;
+		}
+		if (!bAdvance)
+		{
+			nRepeats++;
+			return true;
+		}
+
+		nFrame++;
+		int nRendered = nFrame - offlineSettings.nStartFrame;
+		int nProgressInterval = (int)offlineSettings.fFrameRate > 0 ? (int)offlineSettings.fFrameRate : 1;
+		if (nRendered % nProgressInterval == 0)
+			printf("[Offline] %d/%d frames\n", nRendered, offlineSettings.nEndFrame - offlineSettings.nStartFrame);
+
+		SetFrameTime(nFrame);
+		return nFrame < offlineSettings.nEndFrame;
+	}
+
+	bool Close()
+	{
+		if (!bOpen)
+			return false;
+
+		Timer::Unfreeze();
+		bOpen = false;
+
+		int nRendered = nFrame - offlineSettings.nStartFrame;
+		double fTime = Timer::GetTimePrecise() - fStartTime;
+		if (bSuccess)
+			printf("[Offline] Done, %d frames in %.2f s (%.1f fps), %d rendered again\n", nRendered, fTime, fTime > 0.0 ? nRendered / fTime : 0.0, nRepeats);
+		return bSuccess;
+	}
+}
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <string.h>
+#include "PieceTable.h"
+
+void PieceTable::SetText(const char * szText, int nTextLength)
+{
+	original.assign(szText, nTextLength);
+	added.clear();
+	pieces.clear();
+	if (nTextLength > 0)
+	{
+		Piece piece = { false, 0, nTextLength };
+		pieces.push_back(piece);
+	}
+	nLength = nTextLength;
+
+	lineStarts.clear();
+	lineStarts.push_back(0);
+	for (int i = 0; i < nTextLength; i++)
+	{
+		if (szText[i] == '\n')
+			lineStarts.push_back(i + 1);
+	}
+}
+
+std::string PieceTable::GetText() const
+{
+	std::string sText;
+	GetText(0, nLength, sText);
+	return sText;
+}
+
+void PieceTable::GetText(int nOffset, int nCount, std::string & sOut) const
+{
+	sOut.clear();
+	int nPieceOffset = 0;
+	int i = FindPiece(nOffset, &nPieceOffset);
+	for (; i < (int)pieces.size() && nCount > 0; i++)
+	{
+		int nSkip = nOffset - nPieceOffset;
+		int nTake = std::min(pieces[i].nLength - nSkip, nCount);
+		sOut.append(GetPieceText(pieces[i]) + nSkip, nTake);
+		nCount -= nTake;
+		nPieceOffset += pieces[i].nLength;
+		nOffset = nPieceOffset;
+	}
+}
+
+// Returns the piece holding nOffset and where that piece starts, or the piece count
+// (and the text length) if nOffset is at the end
+int PieceTable::FindPiece(int nOffset, int * pPieceOffset) const
+{
+	int nPos = 0;
+	for (int i = 0; i < (int)pieces.size(); i++)
+	{
+		if (nOffset < nPos + pieces[i].nLength)
+		{
+			*pPieceOffset = nPos;
+			return i;
+		}
+		nPos += pieces[i].nLength;
+	}
+	*pPieceOffset = nPos;
+	return (int)pieces.size();
+}
+
+// Makes sure a piece starts at nOffset
+void PieceTable::SplitPiece(int nOffset)
+{
+	int nPieceOffset = 0;
+	int i = FindPiece(nOffset, &nPieceOffset);
+	if (i == (int)pieces.size() || nPieceOffset == nOffset)
+		return;
+
+	int nSplit = nOffset - nPieceOffset;
+	Piece tail = { pieces[i].bAdded, pieces[i].nStart + nSplit, pieces[i].nLength - nSplit };
+	pieces[i].nLength = nSplit;
+	pieces.insert(pieces.begin() + i + 1, tail);
+}
+
+void PieceTable::Insert(int nOffset, const char * szText, int nTextLength)
+{
+	if (nTextLength <= 0)
+		return;
+
+	// Typing straight after the last insert extends its piece
+	int nPieceOffset = 0;
+	int i = nOffset > 0 ? FindPiece(nOffset - 1, &nPieceOffset) : (int)pieces.size();
+	if (i < (int)pieces.size()
+		&& pieces[i].bAdded
+		&& nPieceOffset + pieces[i].nLength == nOffset
+		&& pieces[i].nStart + pieces[i].nLength == (int)added.size())
+	{
+		pieces[i].nLength += nTextLength;
+	}
+	else
+	{
+		SplitPiece(nOffset);
+		Piece piece = { true, (int)added.size(), nTextLength };
+		pieces.insert(pieces.begin() + FindPiece(nOffset, &nPieceOffset), piece);
+	}
+	added.append(szText, nTextLength);
+	nLength += nTextLength;
+
+	int nLine = GetLineFromOffset(nOffset);
+	for (int j = nLine + 1; j < (int)lineStarts.size(); j++)
+		lineStarts[j] += nTextLength;
+
+	std::vector<int> newStarts;
+	for (int j = 0; j < nTextLength; j++)
+	{
+		if (szText[j] == '\n')
+			newStarts.push_back(nOffset + j + 1);
+	}
+	lineStarts.insert(lineStarts.begin() + nLine + 1, newStarts.begin(), newStarts.end());
+}
+
+void PieceTable::Erase(int nOffset, int nCount)
+{
+	nCount = std::min(nCount, nLength - nOffset);
+	if (nCount <= 0)
+		return;
+
+	SplitPiece(nOffset);
+	SplitPiece(nOffset + nCount);
+	int nPieceOffset = 0;
+	int nFirst = FindPiece(nOffset, &nPieceOffset);
+	int nLast = FindPiece(nOffset + nCount, &nPieceOffset);
+	pieces.erase(pieces.begin() + nFirst, pieces.begin() + nLast);
+	nLength -= nCount;
+
+	// Line starts inside the erased range go; the ones after it move back
+	std::vector<int>::iterator first = std::upper_bound(lineStarts.begin(), lineStarts.end(), nOffset);
+	std::vector<int>::iterator last = std::upper_bound(first, lineStarts.end(), nOffset + nCount);
+	for (std::vector<int>::iterator it = last; it != lineStarts.end(); ++it)
+		*it -= nCount;
+	lineStarts.erase(first, last);
+}
+
+int PieceTable::GetLineLength(int nLine) const
+{
+	if (nLine + 1 < (int)lineStarts.size())
+		return lineStarts[nLine + 1] - lineStarts[nLine] - 1;
+	return nLength - lineStarts[nLine];
+}
+
+int PieceTable::GetLineFromOffset(int nOffset) const
+{
+	return (int)(std::upper_bound(lineStarts.begin(), lineStarts.end(), nOffset) - lineStarts.begin()) - 1;
+}
+
+void PieceTable::GetLine(int nLine, std::string & sOut) const
+{
+	GetText(lineStarts[nLine], GetLineLength(nLine), sOut);
+}
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#ifndef __SWITCH__
+#include <unistd.h>
+#endif
+
+#include "Timer.h"
+#include "PngExporter.h"
+
+namespace PngExporter
+{
+	static const int nBlockSize = 128 * 1024;  // filtered bytes per deflate block, as pigz
+	static const int nDictionarySize = 32768;  // deflate's window
+
+	// A block is a run of rows that ends up as one IDAT chunk, complete with its CRC
+	struct Block
+	{
+		int nFirstRow;
+		int nRows;
+		std::vector<unsigned char> chunk;
+		unsigned int nAdler;       // of the block's filtered bytes
+		int nLength;               // filtered bytes
+	};
+
+	// Frames go round a ring: the caller submits at nSubmitted, the threads claim blocks
+	// of the oldest frame that has any left, and the caller writes frames out from nRetired
+	// once all their blocks are done. Guarded by jobMutex, like CaptureFile's writer.
+	struct Frame
+	{
+		std::vector<unsigned char> pixels;
+		std::vector<Block> blocks;
+		int nNumber;
+		int width, height;
+		int nBlocksLeft;
+	};
+	static std::vector<Frame> frames;
+	static int nSubmitted = 0;
+	static int nClaimedFrame = 0;
+	static int nClaimedBlock = 0;  // next block of frame nClaimedFrame
+	static int nRetired = 0;
+	static bool bStopping = false;
+	static pthread_mutex_t jobMutex;
+	static pthread_cond_t jobSubmitted;
+	static pthread_cond_t blockDone;
+	static std::vector<pthread_t> threads;
+
+	static bool bOpen = false;
+	static PNGEXPORTER_SETTINGS exporterSettings;
+	static std::string sOutputPattern;
+	static bool bWriteFailed = false;
+	static PNGEXPORTER_STATS exporterStats;
+
+	static int GetCoreCount()
+	{
+#ifdef __SWITCH__
+		return 3;
+#else
+		long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+		return nCores > 0 ? (int)nCores : 1;
+#endif
+	}
+
+	static void PutU32(unsigned char * p, unsigned int n)
+	{
+		p[0] = (unsigned char)(n >> 24);
+		p[1] = (unsigned char)(n >> 16);
+		p[2] = (unsigned char)(n >> 8);
+		p[3] = (unsigned char)n;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// compressor threads
+
+	static inline int Paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+		return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+	}
+
+	static void GetRGBRow(const Frame & frame, int y, unsigned char * pOut)
+	{
+		const unsigned char * p = &frame.pixels[y * frame.width * 4];
+		for (int x = 0; x < frame.width; x++, p += 4, pOut += 3)
+		{
+			pOut[0] = p[0];
+			pOut[1] = p[1];
+			pOut[2] = p[2];
+		}
+	}
+
+	// PNG's adaptive filtering: each row gets whichever of the five filters leaves the
+	// smallest sum of absolute values, the heuristic libpng uses. pScratch holds three
+	// rows: this one, the one above and the candidate being tried.
+	static void FilterRow(const Frame & frame, int y, unsigned char * pOut, unsigned char * pScratch)
+	{
+		int n = frame.width * 3;
+		unsigned char * pRow = pScratch;
+		unsigned char * pAbove = pScratch + n;
+		unsigned char * pCandidate = pScratch + n * 2;
+		GetRGBRow(frame, y, pRow);
+		if (y > 0)
+			GetRGBRow(frame, y - 1, pAbove);
+		else
+			memset(pAbove, 0, n);
+
+		int nBestSum = -1;
+		for (int nFilter = 0; nFilter < 5; nFilter++)
+		{
+			int nSum = 0;
+			for (int i = 0; i < n; i++)
+			{
+				int a = i >= 3 ? pRow[i - 3] : 0;
+				int b = pAbove[i];
+				int c = i >= 3 ? pAbove[i - 3] : 0;
+				int nPredicted = 0;
+				switch (nFilter)
+				{
+				case 1: nPredicted = a; break;
+				case 2: nPredicted = b; break;
+				case 3: nPredicted = (a + b) >> 1; break;
+				case 4: nPredicted = Paeth(a, b, c); break;
+				}
+				unsigned char v = (unsigned char)(pRow[i] - nPredicted);
+				pCandidate[i] = v;
+				nSum += abs((signed char)v);
+			}
+			if (nBestSum < 0 || nSum < nBestSum)
+			{
+				nBestSum = nSum;
+				pOut[0] = (unsigned char)nFilter;
+				memcpy(pOut + 1, pCandidate, n);
+			}
+		}
+	}
+
+	// Filters the block's rows, plus enough rows before it to fill the dictionary (the
+	// same bytes the previous block compresses, so no block waits on another), and
+	// deflates them into a raw deflate block that ends on a byte boundary. Only the last
+	// block of a frame finishes the stream.
+	static void CompressBlock(const Frame & frame, Block & block, bool bLast, z_stream & stream, std::vector<unsigned char> & filtered, std::vector<unsigned char> & scratch)
+	{
+		int nRowBytes = 1 + frame.width * 3;
+		int nDictionaryRows = (nDictionarySize + nRowBytes - 1) / nRowBytes;
+		int nFirstRow = block.nFirstRow > nDictionaryRows ? block.nFirstRow - nDictionaryRows : 0;
+		filtered.resize((block.nFirstRow + block.nRows - nFirstRow) * nRowBytes);
+		scratch.resize(frame.width * 3 * 3);
+		for (int y = nFirstRow; y < block.nFirstRow + block.nRows; y++)
+			FilterRow(frame, y, &filtered[(y - nFirstRow) * nRowBytes], &scratch[0]);
+
+		const unsigned char * pData = &filtered[(block.nFirstRow - nFirstRow) * nRowBytes];
+		int nDictionary = (block.nFirstRow - nFirstRow) * nRowBytes;
+		if (nDictionary > nDictionarySize)
+			nDictionary = nDictionarySize;
+		block.nLength = block.nRows * nRowBytes;
+		block.nAdler = adler32(adler32(0L, Z_NULL, 0), pData, block.nLength);
+
+		deflateReset(&stream);
+		if (nDictionary)
+			deflateSetDictionary(&stream, pData - nDictionary, nDictionary);
+
+		// The chunk is its length and type, the deflate data, then the CRC
+		block.chunk.resize(8 + deflateBound(&stream, block.nLength) + 16 + 4);
+		stream.next_in = (Bytef *)pData;
+		stream.avail_in = block.nLength;
+		size_t nEnd = 8;
+		for (;;)
+		{
+			stream.next_out = &block.chunk[nEnd];
+			stream.avail_out = (uInt)(block.chunk.size() - 4 - nEnd);
+			int nResult = deflate(&stream, bLast ? Z_FINISH : Z_SYNC_FLUSH);
+			nEnd = block.chunk.size() - 4 - stream.avail_out;
+			if (bLast ? nResult == Z_STREAM_END : stream.avail_out != 0)
+				break;
+			block.chunk.resize(block.chunk.size() * 2);
+		}
+
+		unsigned char * p = &block.chunk[0];
+		PutU32(p, (unsigned int)(nEnd - 8));
+		memcpy(p + 4, "IDAT", 4);
+		PutU32(p + nEnd, crc32(crc32(0L, Z_NULL, 0), p + 4, (uInt)(nEnd - 4)));
+		block.chunk.resize(nEnd + 4);
+	}
+
+	static void * CompressorThreadMain(void *)
+	{
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		bool bInitialized = deflateInit2(&stream, exporterSettings.nCompressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		std::vector<unsigned char> filtered;
+		std::vector<unsigned char> scratch;
+
+		pthread_mutex_lock(&jobMutex);
+		for (;;)
+		{
+			while (nClaimedFrame == nSubmitted && !bStopping)
+				pthread_cond_wait(&jobSubmitted, &jobMutex);
+			if (nClaimedFrame == nSubmitted)
+				break;
+
+			Frame & frame = frames[nClaimedFrame % frames.size()];
+			int nBlock = nClaimedBlock++;
+			if (nClaimedBlock == (int)frame.blocks.size())
+			{
+				nClaimedFrame++;
+				nClaimedBlock = 0;
+			}
+			pthread_mutex_unlock(&jobMutex);
+
+			double fStart = Timer::GetTimePrecise();
+			if (bInitialized)
+				CompressBlock(frame, frame.blocks[nBlock], nBlock + 1 == (int)frame.blocks.size(), stream, filtered, scratch);
+			else
+				frame.blocks[nBlock].chunk.clear();
+			float fTime = (float)(Timer::GetTimePrecise() - fStart);
+
+			pthread_mutex_lock(&jobMutex);
+			exporterStats.fCompressTime += fTime;
+			if (--frame.nBlocksLeft == 0)
+				pthread_cond_signal(&blockDone);
+		}
+		pthread_mutex_unlock(&jobMutex);
+
+		if (bInitialized)
+			deflateEnd(&stream);
+		return NULL;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// caller
+
+	static bool WriteChunk(FILE * f, const char * szType, const unsigned char * pData, unsigned int nSize)
+	{
+		unsigned char header[8];
+		PutU32(header, nSize);
+		memcpy(header + 4, szType, 4);
+		// (crc32 treats a NULL buffer as a request for its initial value)
+		unsigned long nCRC = crc32(crc32(0L, Z_NULL, 0), header + 4, 4);
+		if (nSize)
+			nCRC = crc32(nCRC, pData, nSize);
+		unsigned char crc[4];
+		PutU32(crc, (unsigned int)nCRC);
+		return fwrite(header, 8, 1, f) == 1 && (!nSize || fwrite(pData, nSize, 1, f) == 1) && fwrite(crc, 4, 1, f) == 1;
+	}
+
+	// Stitches the blocks into one zlib stream: its header in a chunk of its own, the
+	// blocks' IDAT chunks as they are, then the Adler-32 of the whole, combined from theirs
+	static bool WritePNG(const Frame & frame)
+	{
+		FILE * f = exporterSettings.stream;
+		if (!sOutputPattern.empty())
+		{
+			char szFilename[1024];
+			snprintf(szFilename, sizeof(szFilename), sOutputPattern.c_str(), frame.nNumber);
+			f = fopen(szFilename, "wb");
+			if (!f)
+			{
+				printf("[PngExporter] Unable to open %s for writing\n", szFilename);
+				return false;
+			}
+		}
+
+		static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		unsigned char header[13];
+		PutU32(header, frame.width);
+		PutU32(header + 4, frame.height);
+		header[8] = 8;  // bits per channel
+		header[9] = 2;  // RGB
+		header[10] = 0; // deflate
+		header[11] = 0; // adaptive filtering
+		header[12] = 0; // not interlaced
+
+		// The level only goes into FLEVEL, which is informational
+		int nLevel = exporterSettings.nCompressionLevel;
+		unsigned char zlibHeader[2] = { 0x78, (unsigned char)(nLevel < 2 ? 0x01 : nLevel < 6 ? 0x5E : nLevel == 6 ? 0x9C : 0xDA) };
+
+		bool bWritten = fwrite(signature, sizeof(signature), 1, f) == 1
+			&& WriteChunk(f, "IHDR", header, sizeof(header))
+			&& WriteChunk(f, "IDAT", zlibHeader, sizeof(zlibHeader));
+		unsigned long nAdler = adler32(0L, Z_NULL, 0);
+		for (size_t i = 0; bWritten && i < frame.blocks.size(); i++)
+		{
+			const Block & block = frame.blocks[i];
+			bWritten = !block.chunk.empty() && fwrite(&block.chunk[0], block.chunk.size(), 1, f) == 1;
+			nAdler = adler32_combine(nAdler, block.nAdler, block.nLength);
+			exporterStats.nRawBytes += block.nLength;
+			exporterStats.nCompressedBytes += block.chunk.size() - 12;
+		}
+		unsigned char adler[4];
+		PutU32(adler, (unsigned int)nAdler);
+		bWritten = bWritten
+			&& WriteChunk(f, "IDAT", adler, sizeof(adler))
+			&& WriteChunk(f, "IEND", NULL, 0);
+
+		if (f != exporterSettings.stream && fclose(f) != 0)
+			bWritten = false;
+		return bWritten;
+	}
+
+	// Writes out every finished frame at the head of the ring, first waiting for the
+	// oldest ones until no more than nMaxInFlight are left
+	static void RetireFrames(int nMaxInFlight)
+	{
+		for (;;)
+		{
+			pthread_mutex_lock(&jobMutex);
+			Frame & frame = frames[nRetired % frames.size()];
+			while (nSubmitted - nRetired > nMaxInFlight && frame.nBlocksLeft > 0)
+				pthread_cond_wait(&blockDone, &jobMutex);
+			bool bReady = nRetired < nSubmitted && frame.nBlocksLeft == 0;
+			pthread_mutex_unlock(&jobMutex);
+			if (!bReady)
+				return;
+
+			if (!bWriteFailed)
+			{
+				if (WritePNG(frame))
+				{
+					exporterStats.nFrames++;
+				}
+				else
+				{
+					printf("[PngExporter] Writing frame %d failed\n", frame.nNumber);
+					bWriteFailed = true;
+				}
+			}
+
+			pthread_mutex_lock(&jobMutex);
+			nRetired++;
+			pthread_mutex_unlock(&jobMutex);
+		}
+	}
+
+	bool Open(PNGEXPORTER_SETTINGS * settings)
+	{
+		exporterSettings = *settings;
+		sOutputPattern = settings->szOutputPattern ? settings->szOutputPattern : "";
+		exporterSettings.szOutputPattern = NULL;
+		if (sOutputPattern.empty() && !settings->stream)
+		{
+			printf("[PngExporter] No output\n");
+			return false;
+		}
+		if (exporterSettings.nCompressionLevel <= 0 || exporterSettings.nCompressionLevel > 9)
+			exporterSettings.nCompressionLevel = 6;
+		int nThreads = settings->nThreads > 0 ? settings->nThreads : GetCoreCount();
+		int nDepth = settings->nMaxFramesInFlight > 0 ? settings->nMaxFramesInFlight : 4;
+
+		bWriteFailed = false;
+		memset(&exporterStats, 0, sizeof(exporterStats));
+		frames.resize(nDepth);
+		for (int i = 0; i < nDepth; i++)
+			frames[i].nBlocksLeft = 0;
+		nSubmitted = 0;
+		nClaimedFrame = 0;
+		nClaimedBlock = 0;
+		nRetired = 0;
+		bStopping = false;
+		pthread_mutex_init(&jobMutex, NULL);
+		pthread_cond_init(&jobSubmitted, NULL);
+		pthread_cond_init(&blockDone, NULL);
+
+		threads.clear();
+		for (int i = 0; i < nThreads; i++)
+		{
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, CompressorThreadMain, NULL) != 0)
+				break;
+			threads.push_back(thread);
+		}
+		if (threads.empty())
+		{
+			printf("[PngExporter] Unable to start the compressor threads\n");
+			pthread_mutex_destroy(&jobMutex);
+			pthread_cond_destroy(&jobSubmitted);
+			pthread_cond_destroy(&blockDone);
+			return false;
+		}
+
+		printf("[PngExporter] Compressing on %d thread%s, %d frames in flight, level %d\n", (int)threads.size(), threads.size() == 1 ? "" : "s", nDepth, exporterSettings.nCompressionLevel);
+		bOpen = true;
+		return true;
+	}
+
+	bool WriteFrame(std::vector<unsigned char> & pixels, int width, int height, int nNumber)
+	{
+		if (!bOpen || width <= 0 || height <= 0 || (int)pixels.size() < width * height * 4)
+			return false;
+
+		// Make room, writing out whatever is finished along the way
+		RetireFrames((int)frames.size() - 1);
+
+		// The slot is idle: nothing but this thread touches it until it's submitted
+		Frame & frame = frames[nSubmitted % frames.size()];
+		frame.pixels.swap(pixels);
+		frame.nNumber = nNumber;
+		frame.width = width;
+		frame.height = height;
+
+		int nRowsPerBlock = nBlockSize / (1 + width * 3);
+		if (nRowsPerBlock < 1)
+			nRowsPerBlock = 1;
+		int nBlocks = (height + nRowsPerBlock - 1) / nRowsPerBlock;
+		frame.blocks.resize(nBlocks);
+		for (int i = 0; i < nBlocks; i++)
+		{
+			frame.blocks[i].nFirstRow = i * nRowsPerBlock;
+			frame.blocks[i].nRows = i + 1 < nBlocks ? nRowsPerBlock : height - i * nRowsPerBlock;
+		}
+		frame.nBlocksLeft = nBlocks;
+
+		pthread_mutex_lock(&jobMutex);
+		nSubmitted++;
+		pthread_cond_broadcast(&jobSubmitted);
+		pthread_mutex_unlock(&jobMutex);
+		return !bWriteFailed;
+	}
+
+	bool Close(PNGEXPORTER_STATS * stats)
+	{
+		if (!bOpen)
+			return false;
+
+		RetireFrames(0);
+		pthread_mutex_lock(&jobMutex);
+		bStopping = true;
+		pthread_cond_broadcast(&jobSubmitted);
+		pthread_mutex_unlock(&jobMutex);
+		for (size_t i = 0; i < threads.size(); i++)
+			pthread_join(threads[i], NULL);
+		threads.clear();
+		pthread_mutex_destroy(&jobMutex);
+		pthread_cond_destroy(&jobSubmitted);
+		pthread_cond_destroy(&blockDone);
+
+		if (stats)
+			*stats = exporterStats;
+		std::vector<Frame>().swap(frames);
+		bOpen = false;
+		return !bWriteFailed;
+	}
+}
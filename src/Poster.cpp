@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Shade.h"
+#include "Renderer.h"
+#include "Timer.h"
+#include "Poster.h"
+
+namespace Poster
+{
+	static const int nReadbackDepth = 3;
+
+	bool Render(POSTER_SETTINGS * settings)
+	{
+		int nTileSize = settings->nTileSize;
+		int nMaxTileSize = Renderer::GetMaxTileSize();
+		if (nTileSize > nMaxTileSize) nTileSize = nMaxTileSize;
+		if (nTileSize > settings->nWidth) nTileSize = settings->nWidth;
+		if (nTileSize > settings->nHeight) nTileSize = settings->nHeight;
+		if (nTileSize < 1)
+		{
+			printf("[Poster] Invalid poster size %dx%d\n", settings->nWidth, settings->nHeight);
+			return false;
+		}
+
+		// Before the file is opened, so a shader that can't be tiled leaves no empty poster
+		if (!Renderer::BeginTiles(nTileSize, nTileSize, nReadbackDepth))
+		{
+			printf("[Poster] Unable to render in tiles\n");
+			return false;
+		}
+
+		FILE * f = fopen(settings->szOutputFilename, "wb");
+		if (!f)
+		{
+			printf("[Poster] Unable to open %s for writing\n", settings->szOutputFilename);
+			Renderer::EndTiles();
+			return false;
+		}
+		fprintf(f, "P6\n%d %d\n255\n", settings->nWidth, settings->nHeight);
+
+		// Image rows are written top-down, while tiles (like gl_FragCoord) run bottom-up
+		const int nTilesX = (settings->nWidth + nTileSize - 1) / nTileSize;
+		const int nStrips = (settings->nHeight + nTileSize - 1) / nTileSize;
+		const int nTiles = nTilesX * nStrips;
+
+		// Two strips in flight: one being drained while the next one is rendering
+		std::vector<unsigned char> strips[2];
+		int nStripTilesDone[2] = { 0, 0 };
+		strips[0].resize(settings->nWidth * nTileSize * 3);
+		strips[1].resize(settings->nWidth * nTileSize * 3);
+
+		Timer::Freeze(settings->fTime);
+		Renderer::SetShaderConstant(Renderer::RegisterUniform("fGlobalTime"), settings->fTime);
+		Renderer::SetShaderConstant(Renderer::RegisterUniform("v2Resolution"), (float)settings->nWidth, (float)settings->nHeight);
+
+		printf("[Poster] Rendering %dx%d in %d tiles of %dx%d to %s\n",
+			settings->nWidth, settings->nHeight, nTiles, nTileSize, nTileSize, settings->szOutputFilename);
+		double fStart = Timer::GetTimePrecise();
+
+		bool bSuccess = true;
+		int nQueued = 0;
+		int nStripsWritten = 0;
+		while (nStripsWritten < nStrips && bSuccess)
+		{
+			int nStrip = nQueued / nTilesX;
+			if (nQueued < nTiles && nStrip < nStripsWritten + 2)
+			{
+				int nStripTop = nStrip * nTileSize;
+				int h = settings->nHeight - nStripTop < nTileSize ? settings->nHeight - nStripTop : nTileSize;
+				int x = (nQueued % nTilesX) * nTileSize;
+				int w = settings->nWidth - x < nTileSize ? settings->nWidth - x : nTileSize;
+				int y = settings->nHeight - nStripTop - h;
+				if (Renderer::RenderTile(x, y, w, h))
+				{
+					nQueued++;
+					continue;
+				}
+			}
+
+			// Waiting only gives up when the readback failed or there was nothing to wait for,
+			// neither of which trying again would fix
+			Renderer::TILE tile;
+			if (!Renderer::MapCompletedTile(true, &tile))
+			{
+				printf("[Poster] Reading back a tile failed\n");
+				bSuccess = false;
+				break;
+			}
+
+			// Copy into the strip, flipping rows and dropping alpha
+			int nTileTopRow = settings->nHeight - (tile.y + tile.height);
+			nStrip = nTileTopRow / nTileSize;
+			std::vector<unsigned char> & strip = strips[nStrip % 2];
+			for (int row = 0; row < tile.height; row++)
+			{
+				const unsigned char * src = tile.pData + row * tile.width * 4;
+				int nStripRow = (settings->nHeight - 1 - (tile.y + row)) - nStrip * nTileSize;
+				unsigned char * dst = &strip[(nStripRow * settings->nWidth + tile.x) * 3];
+				for (int i = 0; i < tile.width; i++)
+				{
+					dst[0] = src[0];
+					dst[1] = src[1];
+					dst[2] = src[2];
+					dst += 3;
+					src += 4;
+				}
+			}
+			Renderer::UnmapCompletedTile();
+
+			if (++nStripTilesDone[nStrip % 2] == nTilesX)
+			{
+				// Tiles complete in order, so this is always the next strip to write
+				int nStripTop = nStrip * nTileSize;
+				int nRows = settings->nHeight - nStripTop < nTileSize ? settings->nHeight - nStripTop : nTileSize;
+				if (fwrite(&strip[0], settings->nWidth * 3, nRows, f) != (size_t)nRows)
+				{
+					printf("[Poster] Write to %s failed\n", settings->szOutputFilename);
+					bSuccess = false;
+				}
+				nStripTilesDone[nStrip % 2] = 0;
+				nStripsWritten++;
+				printf("[Poster] %d/%d rows\n", nStripTop + nRows, settings->nHeight);
+			}
+		}
+
+		Renderer::EndTiles();
+		Timer::Unfreeze();
+		if (fclose(f) != 0)
+			bSuccess = false;
+
+		if (bSuccess)
+			printf("[Poster] Done in %.2f s\n", Timer::GetTimePrecise() - fStart);
+		return bSuccess;
+	}
+}
\ No newline at end of file
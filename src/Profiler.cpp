@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Shade.h"
+#include "Profiler.h"
+
+namespace Profiler
+{
+	static const int nWindowSize = 256;
+
+	struct MARKER
+	{
+		std::string sName;
+		std::vector<float> samples; // rolling window, milliseconds
+		int nNextSample;
+		float fLast;
+	};
+
+	struct RECORD
+	{
+		Marker marker;
+		int nBeginQuery;
+		int nEndQuery;
+	};
+
+	// One frame's worth of queries; reused every nLatency frames
+	struct FRAME
+	{
+		std::vector<GLuint> queries;
+		int nUsedQueries;
+		std::vector<RECORD> records;
+		std::vector<int> openRecords; // per marker, index of the record awaiting EndMarker
+	};
+
+	static bool bOpen = false;
+	static std::vector<MARKER> markers;
+	static std::vector<FRAME> frames;
+	static int nCurrentFrame = 0;
+	static int nFramesIssued = 0;
+	static int nDroppedFrames = 0;
+
+	static int IssueTimestamp(FRAME & frame)
+	{
+		if (frame.nUsedQueries == (int)frame.queries.size())
+		{
+			GLuint query = 0;
+			glGenQueries(1, &query);
+			frame.queries.push_back(query);
+		}
+		glQueryCounter(frame.queries[frame.nUsedQueries], GL_TIMESTAMP);
+		return frame.nUsedQueries++;
+	}
+
+	static void AddSample(MARKER & marker, float fSample)
+	{
+		marker.fLast = fSample;
+		if ((int)marker.samples.size() < nWindowSize)
+		{
+			marker.samples.push_back(fSample);
+		}
+		else
+		{
+			marker.samples[marker.nNextSample] = fSample;
+			marker.nNextSample = (marker.nNextSample + 1) % nWindowSize;
+		}
+	}
+
+	// Reads back a frame issued nLatency frames ago, if the GPU has finished it
+	static void CollectFrame(FRAME & frame)
+	{
+		if (frame.nUsedQueries == 0)
+			return;
+
+		GLint bAvailable = 0;
+		glGetQueryObjectiv(frame.queries[frame.nUsedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &bAvailable);
+		if (!bAvailable)
+		{
+			nDroppedFrames++;
+			return;
+		}
+
+		std::vector<GLuint64> timestamps(frame.nUsedQueries);
+		for (int i = 0; i < frame.nUsedQueries; i++)
+			glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+		std::vector<double> totals(markers.size(), -1.0);
+		for (size_t i = 0; i < frame.records.size(); i++)
+		{
+			const RECORD & record = frame.records[i];
+			if (record.nEndQuery < 0)
+				continue;
+			double fDuration = (timestamps[record.nEndQuery] - timestamps[record.nBeginQuery]) / 1000000.0;
+			totals[record.marker] = totals[record.marker] < 0.0 ? fDuration : totals[record.marker] + fDuration;
+		}
+		for (size_t i = 0; i < markers.size(); i++)
+		{
+			if (totals[i] >= 0.0)
+				AddSample(markers[i], (float)totals[i]);
+		}
+	}
+
+	static void ResetFrame(FRAME & frame)
+	{
+		frame.nUsedQueries = 0;
+		frame.records.clear();
+		frame.openRecords.assign(markers.size(), -1);
+	}
+
+	bool Open(int nLatency)
+	{
+		if (nLatency < 2)
+			nLatency = 2;
+
+		GLint nBits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &nBits);
+		if (nBits == 0)
+		{
+			printf("[Profiler] GL_TIMESTAMP queries are not supported\n");
+			return false;
+		}
+
+		frames.resize(nLatency);
+		for (size_t i = 0; i < frames.size(); i++)
+			ResetFrame(frames[i]);
+		nCurrentFrame = 0;
+		nFramesIssued = 0;
+		nDroppedFrames = 0;
+		bOpen = true;
+		return true;
+	}
+
+	void Close()
+	{
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			if (!frames[i].queries.empty())
+				glDeleteQueries(frames[i].queries.size(), &frames[i].queries[0]);
+		}
+		frames.clear();
+		bOpen = false;
+	}
+
+	bool IsOpen()
+	{
+		return bOpen;
+	}
+
+	Marker RegisterMarker(const char * szName)
+	{
+		for (size_t i = 0; i < markers.size(); i++)
+		{
+			if (markers[i].sName == szName)
+				return (Marker)i;
+		}
+
+		MARKER marker;
+		marker.sName = szName;
+		marker.nNextSample = 0;
+		marker.fLast = 0.0f;
+		markers.push_back(marker);
+		for (size_t i = 0; i < frames.size(); i++)
+			frames[i].openRecords.push_back(-1);
+		return (Marker)(markers.size() - 1);
+	}
+
+	void BeginMarker(Marker marker)
+	{
+		if (!bOpen)
+			return;
+
+		FRAME & frame = frames[nCurrentFrame];
+		RECORD record;
+		record.marker = marker;
+		record.nBeginQuery = IssueTimestamp(frame);
+		record.nEndQuery = -1;
+		frame.openRecords[marker] = frame.records.size();
+		frame.records.push_back(record);
+	}
+
+	void EndMarker(Marker marker)
+	{
+		if (!bOpen)
+			return;
+
+		FRAME & frame = frames[nCurrentFrame];
+		int nRecord = frame.openRecords[marker];
+		if (nRecord < 0)
+			return;
+		frame.records[nRecord].nEndQuery = IssueTimestamp(frame);
+		frame.openRecords[marker] = -1;
+	}
+
+	void NewFrame()
+	{
+		if (!bOpen)
+			return;
+
+		nFramesIssued++;
+		nCurrentFrame = (nCurrentFrame + 1) % frames.size();
+		if (nFramesIssued >= (int)frames.size())
+			CollectFrame(frames[nCurrentFrame]);
+		ResetFrame(frames[nCurrentFrame]);
+	}
+
+	int GetStats(PROFILER_STATS * pStats, int nMaxStats)
+	{
+		int nStats = 0;
+		std::vector<float> sorted;
+		for (size_t i = 0; i < markers.size() && nStats < nMaxStats; i++)
+		{
+			const MARKER & marker = markers[i];
+			if (marker.samples.empty())
+				continue;
+
+			sorted = marker.samples;
+			std::sort(sorted.begin(), sorted.end());
+			double fSum = 0.0;
+			for (size_t j = 0; j < sorted.size(); j++)
+				fSum += sorted[j];
+
+			PROFILER_STATS & stats = pStats[nStats++];
+			stats.szName = marker.sName.c_str();
+			stats.fLast = marker.fLast;
+			stats.fMin = sorted.front();
+			stats.fAverage = (float)(fSum / sorted.size());
+			stats.fP99 = sorted[(sorted.size() * 99) / 100];
+			stats.nSamples = sorted.size();
+		}
+		return nStats;
+	}
+
+	float GetLastTime(Marker marker)
+	{
+		if (marker < 0 || marker >= (Marker)markers.size() || markers[marker].samples.empty())
+			return 0.0f;
+		return markers[marker].fLast;
+	}
+
+	void DumpStats()
+	{
+		std::vector<PROFILER_STATS> stats(markers.size());
+		int nStats = stats.empty() ? 0 : GetStats(&stats[0], stats.size());
+		printf("[Profiler] GPU time (ms) over the last %d frames, %d frames dropped:\n", nWindowSize, nDroppedFrames);
+		printf("  %-16s %8s %8s %8s %8s\n", "marker", "last", "min", "avg", "p99");
+		for (int i = 0; i < nStats; i++)
+			printf("  %-16s %8.3f %8.3f %8.3f %8.3f\n", stats[i].szName, stats[i].fLast, stats[i].fMin, stats[i].fAverage, stats[i].fP99);
+	}
+}
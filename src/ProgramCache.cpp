@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "Shade.h"
+#include "ProgramCache.h"
+
+namespace ProgramCache
+{
+	// Each binary lives in its own file; a small text index keeps sizes and a use counter
+	// for LRU eviction, so no filesystem timestamps are needed.
+	struct ENTRY
+	{
+		unsigned long long key;
+		unsigned int nSize;
+		unsigned int nLastUse;
+	};
+
+	struct FILEHEADER
+	{
+		char magic[4];
+		unsigned int nVersion;
+		unsigned long long key;
+		unsigned int format;
+		unsigned int nLength;
+	};
+
+	static const char fileMagic[4] = { 'S', 'P', 'B', 'C' };
+	static const unsigned int nFileVersion = 1;
+
+	static bool bOpen = false;
+	static std::string sDirectory;
+	static unsigned int nMaxSize = 0;
+	static unsigned long long driverHash = 0;
+	static std::vector<ENTRY> entries;
+	static unsigned int nUseCounter = 0;
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	static unsigned long long HashBytes(unsigned long long hash, const void * pData, size_t nSize)
+	{
+		// 64-bit FNV-1a
+		const unsigned char * p = (const unsigned char *)pData;
+		for (size_t i = 0; i < nSize; i++)
+		{
+			hash ^= p[i];
+			hash *= 0x100000001b3ULL;
+		}
+		return hash;
+	}
+
+	static std::string GetEntryFilename(unsigned long long key)
+	{
+		char szName[32];
+		snprintf(szName, sizeof(szName), "/%016llx.bin", key);
+		return sDirectory + szName;
+	}
+
+	static void SaveIndex()
+	{
+		FILE * f = fopen((sDirectory + "/index").c_str(), "wb");
+		if (!f)
+			return;
+		fprintf(f, "%u\n", nUseCounter);
+		for (size_t i = 0; i < entries.size(); i++)
+			fprintf(f, "%016llx %u %u\n", entries[i].key, entries[i].nSize, entries[i].nLastUse);
+		fclose(f);
+	}
+
+	static void LoadIndex()
+	{
+		entries.clear();
+		nUseCounter = 0;
+		FILE * f = fopen((sDirectory + "/index").c_str(), "rb");
+		if (!f)
+			return;
+		if (fscanf(f, "%u", &nUseCounter) == 1)
+		{
+			ENTRY entry;
+			while (fscanf(f, "%llx %u %u", &entry.key, &entry.nSize, &entry.nLastUse) == 3)
+				entries.push_back(entry);
+		}
+		fclose(f);
+	}
+
+	static int FindEntry(unsigned long long key)
+	{
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			if (entries[i].key == key)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	static void RemoveEntry(int i)
+	{
+		remove(GetEntryFilename(entries[i].key).c_str());
+		entries.erase(entries.begin() + i);
+	}
+
+	static void Evict()
+	{
+		unsigned long long nTotal = 0;
+		for (size_t i = 0; i < entries.size(); i++)
+			nTotal += entries[i].nSize;
+
+		while (nTotal > nMaxSize && entries.size() > 1)
+		{
+			int nOldest = 0;
+			for (size_t i = 1; i < entries.size(); i++)
+			{
+				if (entries[i].nLastUse < entries[nOldest].nLastUse)
+					nOldest = i;
+			}
+			nTotal -= entries[nOldest].nSize;
+			RemoveEntry(nOldest);
+		}
+	}
+
+	bool Open(PROGRAMCACHE_SETTINGS * settings)
+	{
+		GLint nFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+		if (nFormats <= 0)
+		{
+			printf("[ProgramCache] Driver supports no program binary formats; cache disabled\n");
+			return false;
+		}
+
+		sDirectory = settings->szDirectory;
+		mkdir(sDirectory.c_str(), 0777);
+		nMaxSize = settings->nMaxSize;
+
+		driverHash = 0xcbf29ce484222325ULL;
+		static const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (int i = 0; i < 3; i++)
+		{
+			const char * sz = (const char *)glGetString(driverStrings[i]);
+			if (sz)
+				driverHash = HashBytes(driverHash, sz, strlen(sz) + 1);
+		}
+
+		pthread_mutex_lock(&mutex);
+		LoadIndex();
+		Evict();
+		bOpen = true;
+		pthread_mutex_unlock(&mutex);
+
+		printf("[ProgramCache] %d cached programs in %s\n", (int)entries.size(), sDirectory.c_str());
+		return true;
+	}
+
+	void Close()
+	{
+		pthread_mutex_lock(&mutex);
+		if (bOpen)
+			SaveIndex();
+		bOpen = false;
+		entries.clear();
+		pthread_mutex_unlock(&mutex);
+	}
+
+	unsigned long long MakeKey(const char ** szSources, const int * nSourceSizes, int nSources)
+	{
+		unsigned long long hash = driverHash;
+		for (int i = 0; i < nSources; i++)
+		{
+			hash = HashBytes(hash, szSources[i], nSourceSizes[i]);
+			hash = HashBytes(hash, "\0", 1);
+		}
+		return hash;
+	}
+
+	GLuint Load(unsigned long long key)
+	{
+		pthread_mutex_lock(&mutex);
+		int i = bOpen ? FindEntry(key) : -1;
+		if (i < 0)
+		{
+			pthread_mutex_unlock(&mutex);
+			return 0;
+		}
+
+		std::vector<char> binary;
+		FILEHEADER header;
+		FILE * f = fopen(GetEntryFilename(key).c_str(), "rb");
+		bool bValid = false;
+		if (f)
+		{
+			if (fread(&header, sizeof(header), 1, f) == 1
+				&& memcmp(header.magic, fileMagic, sizeof(fileMagic)) == 0
+				&& header.nVersion == nFileVersion
+				&& header.key == key)
+			{
+				binary.resize(header.nLength);
+				bValid = header.nLength > 0 && fread(&binary[0], 1, header.nLength, f) == header.nLength;
+			}
+			fclose(f);
+		}
+
+		GLuint prg = 0;
+		if (bValid)
+		{
+			prg = glCreateProgram();
+			glProgramBinary(prg, header.format, &binary[0], header.nLength);
+			GLint result = 0;
+			glGetProgramiv(prg, GL_LINK_STATUS, &result);
+			if (!result)
+			{
+				printf("[ProgramCache] Driver rejected cached program %016llx; recompiling\n", key);
+				glDeleteProgram(prg);
+				prg = 0;
+			}
+		}
+
+		if (prg)
+		{
+			entries[i].nLastUse = ++nUseCounter;
+		}
+		else
+		{
+			RemoveEntry(i);
+		}
+		SaveIndex();
+		pthread_mutex_unlock(&mutex);
+		return prg;
+	}
+
+	void PrepareProgram(GLuint program)
+	{
+		if (bOpen)
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	void Store(unsigned long long key, GLuint program)
+	{
+		if (!bOpen)
+			return;
+
+		GLint nLength = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &nLength);
+		if (nLength <= 0 || (unsigned int)nLength > nMaxSize)
+			return;
+
+		std::vector<char> binary(nLength);
+		FILEHEADER header;
+		memcpy(header.magic, fileMagic, sizeof(fileMagic));
+		header.nVersion = nFileVersion;
+		header.key = key;
+		GLenum format = 0;
+		glGetProgramBinary(program, nLength, &nLength, &format, &binary[0]);
+		header.format = format;
+		header.nLength = nLength;
+		if (nLength <= 0)
+			return;
+
+		pthread_mutex_lock(&mutex);
+		bool bWritten = false;
+		FILE * f = fopen(GetEntryFilename(key).c_str(), "wb");
+		if (f)
+		{
+			bWritten = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(&binary[0], 1, nLength, f) == (size_t)nLength;
+			fclose(f);
+		}
+
+		int i = FindEntry(key);
+		if (i >= 0)
+			entries.erase(entries.begin() + i);
+		if (bWritten)
+		{
+			ENTRY entry;
+			entry.key = key;
+			entry.nSize = sizeof(header) + nLength;
+			entry.nLastUse = ++nUseCounter;
+			entries.push_back(entry);
+			Evict();
+		}
+		else
+		{
+			remove(GetEntryFilename(key).c_str());
+		}
+		SaveIndex();
+		pthread_mutex_unlock(&mutex);
+	}
+}
@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Shade.h"
+#include "Renderer.h"
+#include "Timer.h"
+#include "CaptureFile.h"
+#include "PngExporter.h"
+#include "Recorder.h"
+
+namespace Recorder
+{
+	static bool bOpen = false;
+	static RECORDER_SETTINGS recorderSettings;
+	static std::string sOutput;
+	static bool bPipe = false;
+	static bool bPerFrameFiles = false;
+	static FILE * fStream = NULL;
+	static int nStreamWidth = 0;   // Y4M and raw streams are fixed to the size at Open
+	static int nStreamHeight = 0;
+	static int nQueueDepth = 0;
+	static RENDERER_CAPTUREFORMAT captureFormat = RENDERER_CAPTUREFORMAT_RGBA;
+	static RECORDER_STATS stats;
+
+	// Captures in flight in the renderer, oldest first, by the number they'll be written as
+	static std::deque<int> pendingNumbers;
+	static int nNextNumber = 0;
+	static bool bSizeWarned = false;
+
+	// Single producer (main thread), single consumer (writer thread) ring: the main thread
+	// fills queue[tail] and then publishes it by bumping nQueueTail, the writer empties
+	// queue[head] and then hands it back by bumping nQueueHead. Neither side ever waits
+	// on the other to touch its own end. The counters only grow; slots are counter % depth.
+	struct QueuedFrame
+	{
+		std::vector<unsigned char> pixels; // as captured, see Renderer::GRABBEDFRAME
+		int nNumber;
+		int width, height;
+		RENDERER_CAPTUREFORMAT format;
+	};
+	static std::vector<QueuedFrame> queue;
+	static std::atomic<int> nQueueHead(0);
+	static std::atomic<int> nQueueTail(0);
+	static std::atomic<bool> bStopping(false);
+	static std::atomic<bool> bFailed(false);
+	static std::atomic<int> nWritten(0);
+	static std::atomic<long long> nWriteMicroseconds(0);
+	static pthread_t writerThread;
+
+	static int GetQueuedCount()
+	{
+		return nQueueTail.load() - nQueueHead.load();
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// writer thread
+
+	static void GetFrameRateRational(float fFrameRate, int * pNumerator, int * pDenominator)
+	{
+		int n = (int)(fFrameRate * 1000.0f + 0.5f);
+		int d = 1000;
+		int a = n, b = d;
+		while (b)
+		{
+			int t = a % b;
+			a = b;
+			b = t;
+		}
+		*pNumerator = a ? n / a : 0;
+		*pDenominator = a ? d / a : 1;
+	}
+
+	static bool IsYUVFormat(RECORDER_FORMAT format)
+	{
+		return format == RECORDER_FORMAT_Y4M || format == RECORDER_FORMAT_NV12;
+	}
+
+	// Sums the RGB of the luma samples a chroma sample covers along one axis: 1-1 from
+	// the sample on, or 1-2-1 around it when co-sited; returns the total weight
+	static int GetChromaTaps(int nPosition, int nSize, bool bCosited, int * pTaps, int * pWeights)
+	{
+		int nLast = nSize - 1;
+		if (bCosited)
+		{
+			pTaps[0] = nPosition > 0 ? nPosition - 1 : 0;
+			pTaps[1] = nPosition;
+			pTaps[2] = nPosition < nLast ? nPosition + 1 : nLast;
+			pWeights[0] = 1;
+			pWeights[1] = 2;
+			pWeights[2] = 1;
+			return 3;
+		}
+		pTaps[0] = nPosition;
+		pTaps[1] = nPosition < nLast ? nPosition + 1 : nLast;
+		pWeights[0] = 1;
+		pWeights[1] = 1;
+		return 2;
+	}
+
+	// The CPU reference for the GPU conversion: BT.709 limited range in the renderer's
+	// 16.16 fixed point, the Y plane followed by U and V planes, or by interleaved UV for
+	// NV12. Odd sizes repeat the last column and row.
+	void ConvertToYUV420(const unsigned char * pRGBA, int w, int h, RENDERER_CHROMASITING siting, bool bInterleaved, unsigned char * pOut)
+	{
+		int matrix[3][3];
+		Renderer::GetYUVMatrix(matrix);
+
+		unsigned char * pY = pOut;
+		for (int i = 0; i < w * h; i++)
+		{
+			const unsigned char * p = pRGBA + i * 4;
+			pY[i] = (unsigned char)(((16 << 16) + (1 << 15) + matrix[0][0] * p[0] + matrix[0][1] * p[1] + matrix[0][2] * p[2]) >> 16);
+		}
+
+		bool bCositedX = siting != RENDERER_CHROMASITING_CENTER;
+		bool bCositedY = siting == RENDERER_CHROMASITING_TOPLEFT;
+		int nShift = 18 + bCositedX + bCositedY;
+		int nBias = (128 << nShift) + (1 << (nShift - 1));
+		int cw = (w + 1) / 2, ch = (h + 1) / 2;
+		unsigned char * pU = pOut + w * h;
+		unsigned char * pV = bInterleaved ? pU + 1 : pU + cw * ch;
+		int nStep = bInterleaved ? 2 : 1;
+		for (int y = 0; y < ch; y++)
+		{
+			int rows[3], rowWeights[3];
+			int nRows = GetChromaTaps(y * 2, h, bCositedY, rows, rowWeights);
+			for (int x = 0; x < cw; x++)
+			{
+				int columns[3], columnWeights[3];
+				int nColumns = GetChromaTaps(x * 2, w, bCositedX, columns, columnWeights);
+				int r = 0, g = 0, b = 0;
+				for (int j = 0; j < nRows; j++)
+				{
+					for (int i = 0; i < nColumns; i++)
+					{
+						const unsigned char * p = pRGBA + (rows[j] * w + columns[i]) * 4;
+						int nWeight = rowWeights[j] * columnWeights[i];
+						r += p[0] * nWeight;
+						g += p[1] * nWeight;
+						b += p[2] * nWeight;
+					}
+				}
+				int n = (y * cw + x) * nStep;
+				pU[n] = (unsigned char)((nBias + matrix[1][0] * r + matrix[1][1] * g + matrix[1][2] * b) >> nShift);
+				pV[n] = (unsigned char)((nBias + matrix[2][0] * r + matrix[2][1] * g + matrix[2][2] * b) >> nShift);
+			}
+		}
+	}
+
+	static bool WriteSidecar(int nFrames)
+	{
+		std::string sSidecar = sOutput + ".json";
+		FILE * f = fopen(sSidecar.c_str(), "w");
+		if (!f)
+		{
+			printf("[Recorder] Unable to open %s for writing\n", sSidecar.c_str());
+			return false;
+		}
+		static const char * szSitings[] = { "center", "left", "topleft" };
+		if (recorderSettings.format == RECORDER_FORMAT_NV12)
+			fprintf(f, "{\n  \"format\": \"nv12\",\n  \"matrix\": \"bt709\",\n  \"range\": \"limited\",\n  \"chromaSiting\": \"%s\",\n",
+				szSitings[recorderSettings.chromaSiting]);
+		else
+			fprintf(f, "{\n  \"format\": \"rgba\",\n");
+		fprintf(f, "  \"width\": %d,\n  \"height\": %d,\n  \"frameRate\": %g,\n  \"frames\": %d\n}\n",
+			nStreamWidth, nStreamHeight, recorderSettings.fFrameRate, nFrames);
+		return fclose(f) == 0;
+	}
+
+	static bool WriteHeader()
+	{
+		switch (recorderSettings.format)
+		{
+		case RECORDER_FORMAT_Y4M:
+		{
+			static const char * szSitings[] = { "C420jpeg", "C420mpeg2", "C420paldv" };
+			int nNumerator = 0, nDenominator = 1;
+			GetFrameRateRational(recorderSettings.fFrameRate, &nNumerator, &nDenominator);
+			return fprintf(fStream, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 %s XCOLORRANGE=LIMITED\n",
+				nStreamWidth, nStreamHeight, nNumerator, nDenominator, szSitings[recorderSettings.chromaSiting]) > 0;
+		}
+		case RECORDER_FORMAT_RAW:
+		case RECORDER_FORMAT_NV12:
+			return bPipe || WriteSidecar(0);
+		case RECORDER_FORMAT_SFC:
+		{
+			CAPTUREFILE_SETTINGS captureSettings;
+			captureSettings.fFrameRate = recorderSettings.fFrameRate;
+			captureSettings.nThreads = recorderSettings.nEncoderThreads;
+			captureSettings.nMaxFramesInFlight = 0;
+			return CaptureFile::OpenWriter(fStream, &captureSettings);
+		}
+		case RECORDER_FORMAT_PNG:
+		{
+			PNGEXPORTER_SETTINGS exporterSettings;
+			exporterSettings.szOutputPattern = bPerFrameFiles ? sOutput.c_str() : NULL;
+			exporterSettings.stream = fStream;
+			exporterSettings.nThreads = recorderSettings.nEncoderThreads;
+			exporterSettings.nMaxFramesInFlight = 0;
+			exporterSettings.nCompressionLevel = recorderSettings.nCompressionLevel;
+			return PngExporter::Open(&exporterSettings);
+		}
+		default:
+			return true;
+		}
+	}
+
+	static bool WriteFrame(QueuedFrame & frame, std::vector<unsigned char> & converted)
+	{
+		const int w = frame.width, h = frame.height;
+		switch (recorderSettings.format)
+		{
+		case RECORDER_FORMAT_PPM:
+		{
+			FILE * f = fStream;
+			if (bPerFrameFiles)
+			{
+				char szFilename[1024];
+				snprintf(szFilename, sizeof(szFilename), sOutput.c_str(), frame.nNumber);
+				f = fopen(szFilename, "wb");
+				if (!f)
+				{
+					printf("[Recorder] Unable to open %s for writing\n", szFilename);
+					return false;
+				}
+			}
+
+			converted.resize(w * h * 3);
+			const unsigned char * src = &frame.pixels[0];
+			unsigned char * dst = &converted[0];
+			for (int i = 0; i < w * h; i++)
+			{
+				dst[0] = src[0];
+				dst[1] = src[1];
+				dst[2] = src[2];
+				dst += 3;
+				src += 4;
+			}
+			bool bWritten = fprintf(f, "P6\n%d %d\n255\n", w, h) > 0 && fwrite(&converted[0], w * 3, h, f) == (size_t)h;
+			if (bPerFrameFiles && fclose(f) != 0)
+				bWritten = false;
+			return bWritten;
+		}
+		case RECORDER_FORMAT_Y4M:
+		case RECORDER_FORMAT_NV12:
+		{
+			const unsigned char * pData = &frame.pixels[0];
+			size_t nSize = frame.pixels.size();
+			if (frame.format == RENDERER_CAPTUREFORMAT_RGBA)
+			{
+				nSize = Renderer::GetFrameGrabSize(RENDERER_CAPTUREFORMAT_YUV420, w, h);
+				converted.resize(nSize);
+				ConvertToYUV420(pData, w, h, recorderSettings.chromaSiting, recorderSettings.format == RECORDER_FORMAT_NV12, &converted[0]);
+				pData = &converted[0];
+			}
+			if (recorderSettings.format == RECORDER_FORMAT_Y4M && fputs("FRAME\n", fStream) < 0)
+				return false;
+			return fwrite(pData, nSize, 1, fStream) == 1;
+		}
+		case RECORDER_FORMAT_RAW:
+			return fwrite(&frame.pixels[0], w * h * 4, 1, fStream) == 1;
+		case RECORDER_FORMAT_SFC:
+			// Trades the pixels for an idle buffer, which DrainReadbacks resizes as needed
+			return CaptureFile::WriteFrame(frame.pixels, w, h, frame.nNumber);
+		case RECORDER_FORMAT_PNG:
+			return PngExporter::WriteFrame(frame.pixels, w, h, frame.nNumber);
+		}
+		return false;
+	}
+
+	static void * WriterThreadMain(void *)
+	{
+		std::vector<unsigned char> converted;
+		bool bHeaderWritten = WriteHeader();
+		if (!bHeaderWritten)
+		{
+			printf("[Recorder] Writing the stream header failed\n");
+			bFailed = true;
+		}
+
+		for (;;)
+		{
+			// Read the flag first: once it's set, everything queued before it is visible
+			bool bStop = bStopping.load();
+			int nHead = nQueueHead.load();
+			if (nHead == nQueueTail.load())
+			{
+				if (bStop)
+					break;
+				Timer::Sleep(0.001);
+				continue;
+			}
+
+			QueuedFrame & frame = queue[nHead % queue.size()];
+			if (!bFailed.load())
+			{
+				double fStart = Timer::GetTimePrecise();
+				if (WriteFrame(frame, converted))
+					nWritten++;
+				else
+				{
+					printf("[Recorder] Writing frame %d failed\n", frame.nNumber);
+					bFailed = true;
+				}
+				nWriteMicroseconds += (long long)((Timer::GetTimePrecise() - fStart) * 1000000.0);
+			}
+			nQueueHead.store(nHead + 1);
+		}
+
+		if (recorderSettings.format == RECORDER_FORMAT_SFC && bHeaderWritten)
+		{
+			double fStart = Timer::GetTimePrecise();
+			CAPTUREFILE_STATS captureStats;
+			if (!CaptureFile::CloseWriter(&captureStats))
+				bFailed = true;
+			nWriteMicroseconds += (long long)((Timer::GetTimePrecise() - fStart) * 1000000.0);
+			if (captureStats.nEncodedBytes > 0 && captureStats.fEncodeTime > 0.0f)
+				printf("[Recorder] Encoded %.1f MB into %.1f MB (%.2f:1) at %.1f MB/s per encoder thread\n",
+					captureStats.nRawBytes / (1024.0 * 1024.0), captureStats.nEncodedBytes / (1024.0 * 1024.0),
+					(double)captureStats.nRawBytes / captureStats.nEncodedBytes, captureStats.nRawBytes / (1024.0 * 1024.0) / captureStats.fEncodeTime);
+		}
+		else if (recorderSettings.format == RECORDER_FORMAT_PNG && bHeaderWritten)
+		{
+			double fStart = Timer::GetTimePrecise();
+			PNGEXPORTER_STATS exporterStats;
+			if (!PngExporter::Close(&exporterStats))
+				bFailed = true;
+			nWriteMicroseconds += (long long)((Timer::GetTimePrecise() - fStart) * 1000000.0);
+			if (exporterStats.nCompressedBytes > 0 && exporterStats.fCompressTime > 0.0f)
+				printf("[Recorder] Compressed %.1f MB into %.1f MB (%.2f:1) at %.1f MB/s per compressor thread\n",
+					exporterStats.nRawBytes / (1024.0 * 1024.0), exporterStats.nCompressedBytes / (1024.0 * 1024.0),
+					(double)exporterStats.nRawBytes / exporterStats.nCompressedBytes, exporterStats.nRawBytes / (1024.0 * 1024.0) / exporterStats.fCompressTime);
+		}
+		return NULL;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// main thread
+
+	// Moves completed readbacks into the queue; every capture in flight has a queue slot
+	// reserved, so there is always room
+	static void DrainReadbacks(bool bWait)
+	{
+		Renderer::GRABBEDFRAME grabbed;
+		while (Renderer::TryGrabFrame(&grabbed, bWait))
+		{
+			int nNumber = pendingNumbers.front();
+			pendingNumbers.pop_front();
+
+			bool bFixedSize = recorderSettings.format != RECORDER_FORMAT_PPM && recorderSettings.format != RECORDER_FORMAT_PNG;
+			if (bFixedSize && (grabbed.width != nStreamWidth || grabbed.height != nStreamHeight))
+			{
+				if (!bSizeWarned)
+					printf("[Recorder] Frames at %dx%d don't fit the %dx%d stream, leaving them out\n", grabbed.width, grabbed.height, nStreamWidth, nStreamHeight);
+				bSizeWarned = true;
+				stats.nDropped++;
+			}
+			else if (!bFailed.load())
+			{
+				int nTail = nQueueTail.load();
+				QueuedFrame & frame = queue[nTail % queue.size()];
+				frame.pixels.resize(grabbed.nSize);
+				memcpy(&frame.pixels[0], grabbed.pData, grabbed.nSize);
+				frame.nNumber = nNumber;
+				frame.width = grabbed.width;
+				frame.height = grabbed.height;
+				frame.format = grabbed.format;
+				nQueueTail.store(nTail + 1);
+				stats.nCaptured++;
+			}
+			Renderer::ReleaseGrabbedFrame();
+		}
+	}
+
+	bool Open(RECORDER_SETTINGS * settings)
+	{
+		recorderSettings = *settings;
+		sOutput = settings->szOutputFilename ? settings->szOutputFilename : "";
+		recorderSettings.szOutputFilename = sOutput.c_str();
+		if (sOutput.empty() || recorderSettings.fFrameRate <= 0.0f)
+		{
+			printf("[Recorder] No output, or an invalid frame rate\n");
+			return false;
+		}
+		nQueueDepth = settings->nQueueDepth > 0 ? settings->nQueueDepth : 8;
+
+		bPipe = sOutput[0] == '|';
+		bPerFrameFiles = !bPipe && (recorderSettings.format == RECORDER_FORMAT_PPM || recorderSettings.format == RECORDER_FORMAT_PNG) && sOutput.find('%') != std::string::npos;
+		if (bPipe)
+		{
+#ifdef __SWITCH__
+			printf("[Recorder] Piping output is not supported on this platform\n");
+			return false;
+#else
+			fStream = popen(sOutput.c_str() + 1, "w");
+#endif
+		}
+		else if (!bPerFrameFiles)
+		{
+			// Opening a named pipe waits here until the reader has opened it
+			fStream = fopen(sOutput.c_str(), "wb");
+		}
+		if (!bPerFrameFiles && !fStream)
+		{
+			printf("[Recorder] Unable to open %s for writing\n", sOutput.c_str());
+			return false;
+		}
+
+		nStreamWidth = Renderer::nWidth;
+		nStreamHeight = Renderer::nHeight;
+		if (IsYUVFormat(recorderSettings.format) && !recorderSettings.bConvertOnCPU)
+			captureFormat = recorderSettings.format == RECORDER_FORMAT_NV12 ? RENDERER_CAPTUREFORMAT_NV12 : RENDERER_CAPTUREFORMAT_YUV420;
+		else
+			captureFormat = RENDERER_CAPTUREFORMAT_RGBA;
+
+		queue.resize(nQueueDepth);
+		for (int i = 0; i < nQueueDepth; i++)
+			queue[i].pixels.resize(Renderer::GetFrameGrabSize(captureFormat, nStreamWidth, nStreamHeight));
+		nQueueHead = 0;
+		nQueueTail = 0;
+		bStopping = false;
+		bFailed = false;
+		nWritten = 0;
+		nWriteMicroseconds = 0;
+		pendingNumbers.clear();
+		nNextNumber = settings->nFirstFrame;
+		bSizeWarned = false;
+		memset(&stats, 0, sizeof(stats));
+
+		if (pthread_create(&writerThread, NULL, WriterThreadMain, NULL) != 0)
+		{
+			printf("[Recorder] Unable to start the writer thread\n");
+			if (fStream)
+			{
+#ifndef __SWITCH__
+				bPipe ? pclose(fStream) : fclose(fStream);
+#else
+				fclose(fStream);
+#endif
+				fStream = NULL;
+			}
+			return false;
+		}
+
+		static const char * szFormats[] = { "PPM", "Y4M", "raw RGBA", "raw NV12", "SFC", "PNG" };
+		printf("[Recorder] Recording %dx%d %s at %g fps to %s%s\n", nStreamWidth, nStreamHeight, szFormats[recorderSettings.format], recorderSettings.fFrameRate, sOutput.c_str(),
+			IsYUVFormat(recorderSettings.format) ? (recorderSettings.bConvertOnCPU ? ", converting on the CPU" : ", converting on the GPU") : "");
+		bOpen = true;
+		return true;
+	}
+
+	bool IsOpen()
+	{
+		return bOpen;
+	}
+
+	bool CaptureFrame()
+	{
+		if (!bOpen || bFailed.load())
+			return true;
+
+		double fBlockStart = -1.0;
+		for (;;)
+		{
+			DrainReadbacks(false);
+			if (GetQueuedCount() + Renderer::GetFrameGrabsInFlight() < nQueueDepth && Renderer::GrabFrame(captureFormat, recorderSettings.chromaSiting))
+			{
+				pendingNumbers.push_back(nNextNumber++);
+				break;
+			}
+
+			if (recorderSettings.backpressure == RECORDER_BACKPRESSURE_DROP)
+			{
+				nNextNumber++;
+				stats.nDropped++;
+				break;
+			}
+			if (recorderSettings.backpressure == RECORDER_BACKPRESSURE_SLOW)
+			{
+				stats.nHeld++;
+				return false;
+			}
+
+			if (fBlockStart < 0.0)
+			{
+				fBlockStart = Timer::GetTimePrecise();
+				stats.nBlocked++;
+			}
+			Timer::Sleep(0.0005);
+		}
+
+		if (fBlockStart >= 0.0)
+			stats.fBlockedTime += (float)(Timer::GetTimePrecise() - fBlockStart);
+		return true;
+	}
+
+	bool HasFailed()
+	{
+		return bFailed.load();
+	}
+
+	void GetStats(RECORDER_STATS * pStats)
+	{
+		*pStats = stats;
+		pStats->nWritten = nWritten.load();
+		pStats->fWriteTime = (float)(nWriteMicroseconds.load() / 1000000.0);
+	}
+
+	bool Close()
+	{
+		if (!bOpen)
+			return false;
+
+		DrainReadbacks(true);
+		bStopping = true;
+		pthread_join(writerThread, NULL);
+
+		bool bSuccess = !bFailed.load();
+		if (fStream)
+		{
+#ifndef __SWITCH__
+			if (bPipe ? pclose(fStream) != 0 : fclose(fStream) != 0)
+#else
+			if (fclose(fStream) != 0)
+#endif
+				bSuccess = false;
+			fStream = NULL;
+		}
+		if (bSuccess && (recorderSettings.format == RECORDER_FORMAT_RAW || recorderSettings.format == RECORDER_FORMAT_NV12) && !bPipe)
+			bSuccess = WriteSidecar(nWritten.load());
+
+		RECORDER_STATS finalStats;
+		GetStats(&finalStats);
+		printf("[Recorder] %d frames written in %.2f s of writer time; %d dropped, %d held back, %d waited on for %.2f s\n",
+			finalStats.nWritten, finalStats.fWriteTime, finalStats.nDropped, finalStats.nHeld, finalStats.nBlocked, finalStats.fBlockedTime);
+
+		std::vector<QueuedFrame>().swap(queue);
+		bOpen = false;
+		return bSuccess;
+	}
+}
@@ -7,7 +7,19 @@
 #define GLFW_INCLUDE_NONE
 
 #include "Renderer.h"
+#include "Display.h"
+#include "Timer.h"
+#include "ProgramCache.h"
+#include "Profiler.h"
+#include "FramePacer.h"
+#include "AtlasPacker.h"
+#include <math.h>
+#include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -19,14 +31,66 @@ namespace Renderer
 	//-----------------------------------------------------------------------------
 
 	static EGLDisplay s_display;
+	static EGLConfig s_config;
 	static EGLContext s_context;
 	static EGLSurface s_surface;
+#ifdef __SWITCH__
 	static NWindow *win;
-	
+#endif
+
+	// The window surface is always allocated at 1080p; smaller modes render into its top left corner.
+	static const int nSurfaceWidth = 1920;
+	static const int nSurfaceHeight = 1080;
+
+	static RENDERER_PROFILE profile = RENDERER_PROFILE_RELEASE;
+
+	// Filled in by SetContextAttributes() for the selected profile; also used for the shader
+	// compile thread's shared context, which must match.
+	static EGLint contextAttributeList[16];
+
+	static void SetContextAttributes(bool bNoError)
+	{
+		int n = 0;
+		contextAttributeList[n++] = EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR;
+		contextAttributeList[n++] = EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR;
+		contextAttributeList[n++] = EGL_CONTEXT_MAJOR_VERSION_KHR;
+		contextAttributeList[n++] = 4;
+		contextAttributeList[n++] = EGL_CONTEXT_MINOR_VERSION_KHR;
+		contextAttributeList[n++] = 1;
+		if (profile == RENDERER_PROFILE_DEBUG)
+		{
+			contextAttributeList[n++] = EGL_CONTEXT_FLAGS_KHR;
+			contextAttributeList[n++] = EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR;
+		}
+		else if (bNoError)
+		{
+			contextAttributeList[n++] = EGL_CONTEXT_OPENGL_NO_ERROR_KHR;
+			contextAttributeList[n++] = EGL_TRUE;
+		}
+		contextAttributeList[n++] = EGL_NONE;
+	}
+
+	static EGLDisplay getEglDisplay()
+	{
+#ifdef __SWITCH__
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+#else
+		// Prefer Mesa's surfaceless platform so we can run headless (no X11/Wayland needed)
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+		{
+			EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+			if (display)
+				return display;
+		}
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+#endif
+	}
+
 	static bool initEgl()
 	{
 		// Connect to the EGL default display
-		s_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		s_display = getEglDisplay();
 		if (!s_display)
 		{
 			//TRACE("Could not connect to display! error: %d", eglGetError());
@@ -36,8 +100,6 @@ namespace Renderer
 		// Initialize the EGL display connection
 		eglInitialize(s_display, nullptr, nullptr);
 
-		eglSetSwapInterval(s_display, 0);
-
 		// Select OpenGL (Core) as the desired graphics API
 		if (eglBindAPI(EGL_OPENGL_API) == EGL_FALSE)
 		{
@@ -50,6 +112,9 @@ namespace Renderer
 		EGLint numConfigs;
 		static const EGLint framebufferAttributeList[] =
 		{
+#ifndef __SWITCH__
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+#endif
 			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
 			EGL_RED_SIZE, 8,
 			EGL_GREEN_SIZE, 8,
@@ -65,25 +130,37 @@ namespace Renderer
 			TRACE("No config found! error: %d", eglGetError());
 			goto _fail1;
 		}
+		s_config = config;
 
+#ifdef __SWITCH__
 		// Create an EGL window surface
 		s_surface = eglCreateWindowSurface(s_display, config, win, nullptr);
+#else
+		// No window system: render into an offscreen pbuffer of the same size
+		static const EGLint pbufferAttributeList[] =
+		{
+			EGL_WIDTH, nSurfaceWidth,
+			EGL_HEIGHT, nSurfaceHeight,
+			EGL_NONE
+		};
+		s_surface = eglCreatePbufferSurface(s_display, config, pbufferAttributeList);
+#endif
 		if (!s_surface)
 		{
 			TRACE("Surface creation failed! error: %d", eglGetError());
 			goto _fail1;
 		}
 
-		// Create an EGL rendering context
-		static const EGLint contextAttributeList[] =
-		{
-			EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
-			EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
-			EGL_CONTEXT_MINOR_VERSION_KHR, 1,
-			EGL_NONE
-		};
+		// Create an EGL rendering context; release builds ask for a no-error context
+		// where the driver offers one
+		SetContextAttributes(profile != RENDERER_PROFILE_DEBUG && strstr(eglQueryString(s_display, EGL_EXTENSIONS), "EGL_KHR_create_context_no_error") != NULL);
 		s_context = eglCreateContext(s_display, config, EGL_NO_CONTEXT, contextAttributeList);
 		if (!s_context)
+		{
+			SetContextAttributes(false);
+			s_context = eglCreateContext(s_display, config, EGL_NO_CONTEXT, contextAttributeList);
+		}
+		if (!s_context)
 		{
 			TRACE("Context creation failed! error: %d", eglGetError());
 			goto _fail2;
@@ -122,63 +199,94 @@ namespace Renderer
 		}
 	}
 	
+	// Driver environment for the selected profile; must be set before EGL is initialized.
 	static void setMesaConfig()
 	{
-		// Uncomment below to disable error checking and save CPU time (useful for production):
-		// setenv("MESA_NO_ERROR", "1", 1);
+		switch (profile)
+		{
+		case RENDERER_PROFILE_RELEASE:
+		case RENDERER_PROFILE_PROFILE:
+			// Skip GL error checking to save CPU time; logging stays off and the
+			// Nouveau shader optimizer keeps its default level
+			setenv("MESA_NO_ERROR", "1", 1);
+			break;
+
+		case RENDERER_PROFILE_DEBUG:
+			// Mesa logging
+			setenv("EGL_LOG_LEVEL", "debug", 1);
+			setenv("MESA_VERBOSE", "all", 1);
+			setenv("NOUVEAU_MESA_DEBUG", "1", 1);
+
+			// Shader debugging in Nouveau
+			setenv("NV50_PROG_OPTIMIZE", "0", 1);
+			setenv("NV50_PROG_DEBUG", "1", 1);
+			setenv("NV50_PROG_CHIPSET", "0x120", 1);
+			break;
+		}
+	}
+
+	static bool HasExtension(const char * szExtension)
+	{
+		GLint nExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &nExtensions);
+		for (GLint i = 0; i < nExtensions; i++)
+		{
+			if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), szExtension) == 0)
+				return true;
+		}
+		return false;
+	}
 
-		// Uncomment below to enable Mesa logging:
-		setenv("EGL_LOG_LEVEL", "debug", 1);
-		setenv("MESA_VERBOSE", "all", 1);
-		setenv("NOUVEAU_MESA_DEBUG", "1", 1);
+	static void APIENTRY debugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar * message, const void * userParam)
+	{
+		if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+			return;
+		printf("[GL] %s\n", message);
+	}
 
-		// Uncomment below to enable shader debugging in Nouveau:
-		setenv("NV50_PROG_OPTIMIZE", "0", 1);
-		setenv("NV50_PROG_DEBUG", "1", 1);
-		setenv("NV50_PROG_CHIPSET", "0x120", 1);
+	//////////////////////////////////////////////////////////////////////////
+	// profiling markers
+
+	// The GPU profiler runs with RENDERER_PROFILE_PROFILE, and for dynamic resolution, which
+	// is driven by the frame's GPU time; elsewhere the markers are no-ops.
+	static const int nProfilerLatency = 4;
+	Profiler::Marker hFrameMarker = -1;
+	Profiler::Marker hShaderMarker = -1;
+	Profiler::Marker hRenderGraphMarker = -1;
+	Profiler::Marker hGUIMarker = -1;
+	Profiler::Marker hReadbackMarker = -1;
+	double fLastFrameEnd = 0.0;
+	RENDERER_FRAME_TIMINGS frameTimings;
+
+	static void OpenProfiler(bool bDynamicResolution)
+	{
+		hFrameMarker = Profiler::RegisterMarker("Frame");
+		hShaderMarker = Profiler::RegisterMarker("Shader");
+		hRenderGraphMarker = Profiler::RegisterMarker("Render graph");
+		hGUIMarker = Profiler::RegisterMarker("GUI");
+		hReadbackMarker = Profiler::RegisterMarker("Readback");
+		if (profile == RENDERER_PROFILE_PROFILE || bDynamicResolution)
+			Profiler::Open(nProfilerLatency);
 	}
 
-	static void configureResolution(bool halved)
+	RENDERER_PROFILE GetProfile()
 	{
-		int width, height;
+		return profile;
+	}
 
-		// Calculate the target resolution depending on the operation mode:
-		// - In handheld mode, we render at 720p (which is the native screen resolution).
-		// - In docked mode, we render at full 1080p (which is outputted to a compatible HDTV screen).
-		switch (appletGetOperationMode())
-		{
-			default:
-			case AppletOperationMode_Handheld:
-				width = 1280;
-				height = 720;
-				break;
-			case AppletOperationMode_Docked:
-				width = 1920;
-				height = 1080;
-				break;
-		}
+	void GetFrameTimings(RENDERER_FRAME_TIMINGS * timings)
+	{
+		*timings = frameTimings;
 
-		// As an additional demonstration, we also demonstrate what happens
-		// when the rendering resolution doesn't match the native display resolution
-		// by allowing the user to hold A to halve the rendering resolution.
-		if (halved)
+		PROFILER_STATS stats[8];
+		int nStats = Profiler::GetStats(stats, 8);
+		for (int i = 0; i < nStats; i++)
 		{
-			width /= 2;
-			height /= 2;
+			if (strcmp(stats[i].szName, "Frame") == 0)
+				timings->fGpuFrameTime = stats[i].fLast / 1000.0f;
 		}
-		
-		nWidth = width;
-		nHeight = height;
-
-		// Apply the resolution, and configure the correct GL viewport.
-		// We want to render to the top left corner of the framebuffer (other areas will
-		// remain unused when rendering at a smaller resolution than the framebuffer).
-		// Note that glViewport expects the coordinates of the bottom-left corner of
-		// the viewport, so we have to calculate that too.
-		nwindowSetCrop(win, 0, 0, width, height);
-    	glViewport(0, 1080-height, width, height);
 	}
-	
+
 	std::string defaultShaderFilename = "shader.glsl";
 	char defaultShader[65536] =
 		"#version 410 core\n"
@@ -217,317 +325,1955 @@ namespace Renderer
 		"}";
 		
 	bool run = true;
+	int nFrameIndex = 0;
 
 	GLuint theShader = 0;
 	GLuint glhVertexShader = 0;
-	GLuint glhFullscreenQuadVB = 0;
 	GLuint glhFullscreenQuadVA = 0;
 	GLuint glhGUIVB = 0;
 	GLuint glhGUIVA = 0;
 	GLuint glhGUIProgram = 0;
+	GLuint glhGUIQuadVB = 0;
+	GLuint glhGUIQuadVA = 0;
+	GLuint glhGUIQuadProgram = 0;
 
 	int nWidth = 0;
 	int nHeight = 0;
+	int nRenderWidth = 0;
+	int nRenderHeight = 0;
 
-	void MatrixOrthoOffCenterLH(float * pout, float l, float r, float b, float t, float zn, float zf)
-	{
-		memset(pout, 0, sizeof(float) * 4 * 4);
-		pout[0 + 0 * 4] = 2.0f / (r - l);
-		pout[1 + 1 * 4] = 2.0f / (t - b);
-		pout[2 + 2 * 4] = 1.0f / (zf - zn);
-		pout[3 + 0 * 4] = -1.0f - 2.0f *l / (r - l);
-		pout[3 + 1 * 4] = 1.0f + 2.0f * t / (b - t);
-		pout[3 + 2 * 4] = zn / (zn - zf);
-		pout[3 + 3 * 4] = 1.0;
-	}
-
-	int readIndex = 0;
-	int writeIndex = 1;
-	GLuint pbo[2];
+	//////////////////////////////////////////////////////////////////////////
+	// offscreen render targets
 
-	bool Open(RENDERER_SETTINGS * settings)
+	struct RenderTarget
 	{
-		// Set mesa configuration (useful for debugging)
-		setMesaConfig();
-
-		// Retrieve the default window and configure its dimensions (1080p)
-    	win = nwindowGetDefault();
-    	nwindowSetDimensions(win, 1920, 1080);
-
-		// Initialize EGL
-		if (!initEgl())
-			return EXIT_FAILURE;
-
-		// Load OpenGL routines using glad
-		gladLoadGL();
+		GLuint fbo;
+		GLuint texture;
+		int width;
+		int height;
+		GLenum format;
+	};
 
-		// Initialize our scene
-		//sceneInit();
+	// The user shader's textures and the GUI atlas stay bound on their units from one frame
+	// to the next (and unbound samplers read unit 0), so the renderer's own passes put back
+	// whatever they bind over, and the active unit, when they're done
+	struct ScopedTextureBindings
+	{
+		GLint nActiveUnit;
+		int nCount;
+		GLint units[2];
+		GLint textures[2];
 
-		static float pFullscreenQuadVertices[] =
+		ScopedTextureBindings() : nCount(0) { glGetIntegerv(GL_ACTIVE_TEXTURE, &nActiveUnit); }
+		~ScopedTextureBindings()
 		{
-			-1.0, -1.0,  0.5, 0.0, 0.0,
-			-1.0,  1.0,  0.5, 0.0, 1.0,
-			1.0, -1.0,  0.5, 1.0, 0.0,
-			1.0,  1.0,  0.5, 1.0, 1.0,
-		};
-
-		glGenBuffers(1, &glhFullscreenQuadVB);
-		glBindBuffer(GL_ARRAY_BUFFER, glhFullscreenQuadVB);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 5 * 4, pFullscreenQuadVertices, GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, NULL);
-
-		glGenVertexArrays(1, &glhFullscreenQuadVA);
-
-		glhVertexShader = glCreateShader(GL_VERTEX_SHADER);
-
-		std::string szVertexShader =
-			"#version 410 core\n"
-			"in vec3 in_pos;\n"
-			"in vec2 in_texcoord;\n"
-			"out vec2 out_texcoord;\n"
-			"void main()\n"
-			"{\n"
-			"  gl_Position = vec4( in_pos.x, in_pos.y, in_pos.z, 1.0 );\n"
-			"  out_texcoord = in_texcoord;\n"
-			"}";
-		GLint nShaderSize = szVertexShader.size();
-
-		glShaderSource(glhVertexShader, 1, (const GLchar**)&szVertexShader, &nShaderSize);
-		glCompileShader(glhVertexShader);
+			while (nCount > 0)
+			{
+				nCount--;
+				glActiveTexture(units[nCount]);
+				glBindTexture(GL_TEXTURE_2D, textures[nCount]);
+			}
+			glActiveTexture(nActiveUnit);
+		}
 
-		GLint size = 0;
-		GLint result = 0;
-		char szErrorBuffer[5000];
-		glGetShaderInfoLog(glhVertexShader, 4000, &size, szErrorBuffer);
-		glGetShaderiv(glhVertexShader, GL_COMPILE_STATUS, &result);
-		if (!result)
+		void Bind(int nUnit, GLuint texture)
 		{
-			printf("[Renderer] Vertex shader compilation failed\n");
-			return false;
+			glActiveTexture(GL_TEXTURE0 + nUnit);
+			units[nCount] = GL_TEXTURE0 + nUnit;
+			glGetIntegerv(GL_TEXTURE_BINDING_2D, &textures[nCount]);
+			nCount++;
+			glBindTexture(GL_TEXTURE_2D, texture);
 		}
+	};
 
-#define GUIQUADVB_SIZE (1024 * 6)
-
-		std::string defaultGUIVertexShader =
-			"#version 410 core\n"
-			"in vec3 in_pos;\n"
-			"in vec4 in_color;\n"
-			"in vec2 in_texcoord;\n"
-			"in float in_factor;\n"
-			"out vec4 out_color;\n"
-			"out vec2 out_texcoord;\n"
-			"out float out_factor;\n"
-			"uniform vec2 v2Offset;\n"
-			"uniform mat4 matProj;\n"
-			"void main()\n"
-			"{\n"
-			"  vec4 pos = vec4( in_pos + vec3(v2Offset,0), 1.0 );\n"
-			"  gl_Position = pos * matProj;\n"
-			"  out_color = in_color;\n"
-			"  out_texcoord = in_texcoord;\n"
-			"  out_factor = in_factor;\n"
-			"}\n";
-
-		std::string defaultGUIPixelShader =
-			"#version 410 core\n"
-			"uniform sampler2D tex;\n"
-			"in vec4 out_color;\n"
-			"in vec2 out_texcoord;\n"
-			"in float out_factor;\n"
-			"out vec4 frag_color;\n"
-			"void main()\n"
-			"{\n"
-			"  vec4 v4Texture = out_color * texture( tex, out_texcoord );\n"
-			"  vec4 v4Color = out_color;\n"
-			"  frag_color = mix( v4Texture, v4Color, out_factor );\n"
-			"}\n";
-
-		glhGUIProgram = glCreateProgram();
-
-		GLuint vshd = glCreateShader(GL_VERTEX_SHADER);
-		nShaderSize = defaultGUIVertexShader.size();
-
-		const char *vertexShader = defaultGUIVertexShader.c_str();
-		glShaderSource(vshd, 1, (const GLchar**)&vertexShader, &nShaderSize);
-		glCompileShader(vshd);
-		glGetShaderInfoLog(vshd, 4000, &size, szErrorBuffer);
-		glGetShaderiv(vshd, GL_COMPILE_STATUS, &result);
-		if (!result)
+	static bool CreateRenderTarget(RenderTarget & rt, int width, int height, GLenum format = GL_RGBA8)
+	{
+		ScopedTextureBindings bindings;
+		glGenTextures(1, &rt.texture);
+		bindings.Bind(0, rt.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, format == GL_RGBA8 ? GL_UNSIGNED_BYTE : GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &rt.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt.texture, 0);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status == GL_FRAMEBUFFER_COMPLETE)
 		{
-			printf("[Renderer] Default GUI vertex shader compilation failed\n");
-			return false;
+			static const GLfloat black[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			glClearBufferfv(GL_COLOR, 0, black);
 		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-		GLuint fshd = glCreateShader(GL_FRAGMENT_SHADER);
-		nShaderSize = defaultGUIPixelShader.size();
+		rt.width = width;
+		rt.height = height;
+		rt.format = format;
 
-		const char *pixelShader = defaultGUIPixelShader.c_str();
-		glShaderSource(fshd, 1, (const GLchar**)&pixelShader, &nShaderSize);
-		glCompileShader(fshd);
-		glGetShaderInfoLog(fshd, 4000, &size, szErrorBuffer);
-		glGetShaderiv(fshd, GL_COMPILE_STATUS, &result);
-		if (!result)
+		if (status != GL_FRAMEBUFFER_COMPLETE)
 		{
-			printf("[Renderer] Default GUI pixel shader compilation failed\n");
+			printf("[Renderer] Render target %dx%d is incomplete (0x%04X)\n", width, height, status);
 			return false;
 		}
+		return true;
+	}
 
-		glAttachShader(glhGUIProgram, vshd);
-		glAttachShader(glhGUIProgram, fshd);
-		glLinkProgram(glhGUIProgram);
-		glGetProgramiv(glhGUIProgram, GL_LINK_STATUS, &result);
-		if (!result)
-		{
-			return false;
-		}
+	static void ReleaseRenderTarget(RenderTarget & rt)
+	{
+		if (rt.fbo)
+			glDeleteFramebuffers(1, &rt.fbo);
+		if (rt.texture)
+			glDeleteTextures(1, &rt.texture);
+		rt.fbo = 0;
+		rt.texture = 0;
+		rt.width = 0;
+		rt.height = 0;
+		rt.format = 0;
+	}
 
-		glGenBuffers(1, &glhGUIVB);
-		glBindBuffer(GL_ARRAY_BUFFER, glhGUIVB);
+	//////////////////////////////////////////////////////////////////////////
+	// scene target and dynamic resolution
+
+	// The scene target is allocated at the configured render size (nSceneWidth x
+	// nSceneHeight) and dynamic resolution renders into its bottom left corner, so
+	// changing the scale never reallocates anything. The result is resampled into the
+	// window's output region.
+	RenderTarget sceneTarget = { 0, 0, 0, 0, 0 };
+	RENDERER_RENDERTARGET renderTargetSettings = { 0, 0, 1.0f, RENDERER_TARGETFORMAT_RGBA8, RENDERER_RESAMPLE_LINEAR };
+	bool bSceneOffscreen = false;
+	int nSceneWidth = 0;
+	int nSceneHeight = 0;
+	GLuint glhResampleProgram = 0;
+
+	struct DynamicResolution
+	{
+		bool bEnabled;
+		float fMinScale;
+		float fMaxScale;
+		float fTargetFrameTime;
+		float fScale;
+		float fFrameTime;
+		float fSmoothedFrameTime;
+		float fError;
+		int nAdjustments;
+		double fFrameStart;
+		float fCpuFrameTime;       // StartFrame to the swap, for when there are no GPU timings
+		float fLastLoggedScale;
+	};
+	DynamicResolution dynamicResolution = { false, 0.25f, 1.0f, 1.0f / 60.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0, -1.0, 0.0f, 1.0f };
 
-		glGenVertexArrays(1, &glhGUIVA);
+	static void UpdateRenderResolution()
+	{
+		if (!dynamicResolution.bEnabled)
+		{
+			nRenderWidth = nSceneWidth;
+			nRenderHeight = nSceneHeight;
+			return;
+		}
 
-		//create PBOs to hold the data. this allocates memory for them too
-		glGenBuffers(2, pbo);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[0]);
-		glBufferData(GL_PIXEL_PACK_BUFFER, nWidth * nHeight * sizeof(unsigned int), NULL, GL_STREAM_READ);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[1]);
-		glBufferData(GL_PIXEL_PACK_BUFFER, nWidth * nHeight * sizeof(unsigned int), NULL, GL_STREAM_READ);
-		//unbind buffers for now
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, NULL);
+		nRenderWidth = (int)(nSceneWidth * dynamicResolution.fScale + 0.5f);
+		nRenderHeight = (int)(nSceneHeight * dynamicResolution.fScale + 0.5f);
+		if (nRenderWidth < 1) nRenderWidth = 1;
+		if (nRenderHeight < 1) nRenderHeight = 1;
+	}
 
-		glViewport(0, 0, nWidth, nHeight);
+	// Feedback controller: shading cost is roughly proportional to the pixel count, i.e.
+	// to scale^2, so the scale that would hit the target is scale * sqrt(target / measured).
+	// We step a fraction of the way there each frame (dropping faster than we recover, to
+	// get out of a stutter quickly) and ignore errors inside a small deadband so the
+	// resolution doesn't hunt while the frame rate is on target.
+	// The frame time is the GPU's, a few frames late, or without timestamp queries the CPU
+	// time up to the swap; never the time between frames, which vsync pins to the refresh
+	// period whenever the GPU finishes early, so a lowered scale would never recover.
+	static void UpdateDynamicResolution()
+	{
+		DynamicResolution & dr = dynamicResolution;
 
-		run = true;
+		float fFrameTime = Profiler::IsOpen() ? Profiler::GetLastTime(hFrameMarker) / 1000.0f : dr.fCpuFrameTime;
+		bool bValidSample = fFrameTime > 0.0f && fFrameTime < 0.5f; // skip hitches like shader reloads
+		if (!bValidSample)
+			return;
 
-		return true;
-	}
+		dr.fFrameTime = fFrameTime;
+		dr.fSmoothedFrameTime = dr.fSmoothedFrameTime > 0.0f ? dr.fSmoothedFrameTime + (dr.fFrameTime - dr.fSmoothedFrameTime) * 0.1f : dr.fFrameTime;
+		dr.fError = (dr.fSmoothedFrameTime - dr.fTargetFrameTime) / dr.fTargetFrameTime;
 
-	void StartFrame()
-	{
-		glClearColor(0.08f, 0.18f, 0.18f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		if (fabsf(dr.fError) < 0.05f)
+			return;
 
-		 // Get and process input
-        // hidScanInput();
-        // u32 kDown = hidKeysDown(CONTROLLER_P1_AUTO);
-        // u32 kHeld = hidKeysHeld(CONTROLLER_P1_AUTO);
-        // if (kDown & KEY_PLUS)
-        //     run = false;
-		TRACE("A");
-        bool shouldHalveResolution = false;//!!(kHeld & KEY_A);
-		// appletMainLoop();
+		float fIdealScale = dr.fScale * sqrtf(dr.fTargetFrameTime / dr.fSmoothedFrameTime);
+		float fGain = fIdealScale < dr.fScale ? 0.25f : 0.05f;
+		float fScale = dr.fScale + (fIdealScale - dr.fScale) * fGain;
+		if (fScale < dr.fMinScale) fScale = dr.fMinScale;
+		if (fScale > dr.fMaxScale) fScale = dr.fMaxScale;
+		if (fScale == dr.fScale)
+			return;
 
-        // Configure the resolution used to render the scene, which
-        // will be different in handheld mode/docked mode.
-        // As an additional demonstration, when holding A we render the scene
-        // at half the original resolution.
-        configureResolution(shouldHalveResolution);
-		TRACE("B");
-        // Update our scene
-        //sceneUpdate(kHeld);
+		dr.fScale = fScale;
+		dr.nAdjustments++;
+		UpdateRenderResolution();
 
-        // Render stuff!
-        //sceneRender();
+		if (fabsf(dr.fScale - dr.fLastLoggedScale) >= 0.05f)
+		{
+			dr.fLastLoggedScale = dr.fScale;
+			printf("[Renderer] Dynamic resolution: scale %.2f (%dx%d), frame %.2f ms, target %.2f ms\n",
+				dr.fScale, nRenderWidth, nRenderHeight, dr.fSmoothedFrameTime * 1000.0f, dr.fTargetFrameTime * 1000.0f);
+		}
 	}
 
-	void EndFrame()
+	void GetDynamicResolutionStats(RENDERER_DYNAMIC_RESOLUTION_STATS * stats)
 	{
-        eglSwapBuffers(s_display, s_surface);
-		TRACE("C");
+		stats->bEnabled = dynamicResolution.bEnabled;
+		stats->fScale = dynamicResolution.fScale;
+		stats->nRenderWidth = nRenderWidth;
+		stats->nRenderHeight = nRenderHeight;
+		stats->fTargetFrameTime = dynamicResolution.fTargetFrameTime;
+		stats->fFrameTime = dynamicResolution.fFrameTime;
+		stats->fSmoothedFrameTime = dynamicResolution.fSmoothedFrameTime;
+		stats->fError = dynamicResolution.fError;
+		stats->nAdjustments = dynamicResolution.nAdjustments;
 	}
 
-	void RenderFullscreenQuad()
-	{
-		TRACE("Starting render");
-		glBindVertexArray(glhFullscreenQuadVA);
-
-		glUseProgram(theShader);
-
-		glBindBuffer(GL_ARRAY_BUFFER, glhFullscreenQuadVB);
+	//////////////////////////////////////////////////////////////////////////
+	// uniform handles
 
-		GLuint position = glGetAttribLocation(theShader, "in_pos");
-		glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (GLvoid*)(0 * sizeof(GLfloat)));
+	// Registered names are shared by every program; each program keeps its own
+	// table of locations, rebuilt whenever the program is (re)linked.
+	std::vector<std::string> uniformNames;
 
-		GLuint texcoord = glGetAttribLocation(theShader, "in_texcoord");
-		glVertexAttribPointer(texcoord, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (GLvoid*)(3 * sizeof(GLfloat)));
+	struct UniformTable
+	{
+		GLuint program;
+		std::vector<GLint> locations;
+		std::vector<GLint> samplerUnits; // last unit written to a sampler, to skip redundant updates
+	};
+	UniformTable theShaderUniforms;
 
-		glEnableVertexAttribArray(position);
-		glEnableVertexAttribArray(texcoord);
-		glBindBuffer(GL_ARRAY_BUFFER, glhFullscreenQuadVB);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-		glDisableVertexAttribArray(texcoord);
-		glDisableVertexAttribArray(position);
+	// Extra passes of the render graph; their programs take uniform writes like theShader
+	struct Pass;
+	std::vector<Pass*> passes;
+	static UniformTable & GetPassUniforms(size_t i);
+	bool bRenderGraphDirty = false; // rebuilt before the next frame's passes run
 
-		glUseProgram(NULL);
-		TRACE("Render done");
+	// Table 0 is the main shader, the rest belong to the render graph's passes
+	static size_t GetUniformTableCount()
+	{
+		return passes.size() + 1;
 	}
 
-	bool ReloadShader(char * szShaderCode, int nShaderCodeSize, char * szErrorBuffer, int nErrorBufferSize)
+	static UniformTable & GetUniformTable(size_t i)
 	{
-		GLuint prg = glCreateProgram();
-		GLuint shd = glCreateShader(GL_FRAGMENT_SHADER);
-		GLint size = 0;
-		GLint result = 0;
+		return i == 0 ? theShaderUniforms : GetPassUniforms(i - 1);
+	}
 
-		glShaderSource(shd, 1, (const GLchar**)&szShaderCode, &nShaderCodeSize);
-		glCompileShader(shd);
-		glGetShaderInfoLog(shd, nErrorBufferSize, &size, szErrorBuffer);
-		glGetShaderiv(shd, GL_COMPILE_STATUS, &result);
-		if (!result)
+	static void ResolveUniforms(UniformTable & table, GLuint prg)
+	{
+		table.program = prg;
+		table.locations.resize(uniformNames.size());
+		table.samplerUnits.assign(uniformNames.size(), -1);
+		for (size_t i = 0; i < uniformNames.size(); i++)
 		{
-			glDeleteProgram(prg);
-			glDeleteShader(shd);
-			return false;
+			table.locations[i] = prg ? glGetUniformLocation(prg, uniformNames[i].c_str()) : -1;
 		}
+	}
 
-		glAttachShader(prg, glhVertexShader);
-		glAttachShader(prg, shd);
-		glLinkProgram(prg);
-		glGetProgramInfoLog(prg, nErrorBufferSize - size, &size, szErrorBuffer + size);
-		glGetProgramiv(prg, GL_LINK_STATUS, &result);
-		if (!result)
+	UniformHandle RegisterUniform(const char * szName)
+	{
+		for (size_t i = 0; i < uniformNames.size(); i++)
 		{
-			glDeleteProgram(prg);
-			glDeleteShader(shd);
-			return false;
+			if (uniformNames[i] == szName)
+				return (UniformHandle)i;
 		}
 
-		if (theShader)
-			glDeleteProgram(theShader);
+		uniformNames.push_back(szName);
+		for (size_t i = 0; i < GetUniformTableCount(); i++)
+		{
+			UniformTable & table = GetUniformTable(i);
+			table.locations.push_back(table.program ? glGetUniformLocation(table.program, szName) : -1);
+			table.samplerUnits.push_back(-1);
+		}
+		return (UniformHandle)(uniformNames.size() - 1);
+	}
 
-		theShader = prg;
+	void MatrixOrthoOffCenterLH(float * pout, float l, float r, float b, float t, float zn, float zf)
+	{
+		memset(pout, 0, sizeof(float) * 4 * 4);
+		pout[0 + 0 * 4] = 2.0f / (r - l);
+		pout[1 + 1 * 4] = 2.0f / (t - b);
+		pout[2 + 2 * 4] = 1.0f / (zf - zn);
+		pout[3 + 0 * 4] = -1.0f - 2.0f *l / (r - l);
+		pout[3 + 1 * 4] = 1.0f + 2.0f * t / (b - t);
+		pout[3 + 2 * 4] = zn / (zn - zf);
+		pout[3 + 3 * 4] = 1.0;
+	}
 
-		return true;
+	//////////////////////////////////////////////////////////////////////////
+	// half-rate (checkerboard / interlaced) rendering
+
+	// Each frame the user shader shades one of two fields into its own half-size target;
+	// the resolve pass interleaves the fresh field with the one from the previous frame.
+	// The fields take the render target's format, so the resolve loses no precision.
+	RENDERER_RENDERMODE renderMode = RENDERER_RENDERMODE_FULL;
+	RenderTarget fieldTargets[2] = { { 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0 } };
+	int nCurrentField = 0;
+	GLuint glhResolveProgram = 0;
+
+	// Every user shader gets gl_FragCoord routed through these (see InjectShaderPrologue)
+	UniformHandle hFragCoordTransform = -1;
+	UniformHandle hFragCoordPattern = -1;
+	UniformHandle hResolution = -1;
+
+	static void GetFieldSize(int width, int height, int * pFieldWidth, int * pFieldHeight)
+	{
+		*pFieldWidth = renderMode == RENDERER_RENDERMODE_CHECKERBOARD ? (width + 1) / 2 : width;
+		*pFieldHeight = renderMode == RENDERER_RENDERMODE_INTERLACED ? (height + 1) / 2 : height;
 	}
 
-	void SetShaderConstant(std::string szConstName, float x)
+	static bool InitFrameReadbacks(int nDepth);
+	static void ReleaseFrameReadbackTarget();
+
+	static GLenum GetTargetFormat(RENDERER_TARGETFORMAT format)
 	{
-		GLint location = glGetUniformLocation(theShader, szConstName.c_str());
-		if (location != -1)
+		switch (format)
 		{
-			glProgramUniform1f(theShader, location, x);
+		case RENDERER_TARGETFORMAT_RGBA16F: return GL_RGBA16F;
+		case RENDERER_TARGETFORMAT_RGBA32F: return GL_RGBA32F;
+		default: return GL_RGBA8;
 		}
 	}
 
-	void SetShaderConstant(std::string szConstName, float x, float y)
+	// Sizes the scene target from the settings and the output resolution; it is only
+	// needed when the shader can't render straight into the window
+	static void ConfigureSceneTarget()
 	{
-		GLint location = glGetUniformLocation(theShader, szConstName.c_str());
-		if (location != -1)
+		const RENDERER_RENDERTARGET & rt = renderTargetSettings;
+		float fScale = rt.fScale > 0.0f ? rt.fScale : 1.0f;
+		nSceneWidth = rt.nWidth > 0 ? rt.nWidth : (int)(nWidth * fScale + 0.5f);
+		nSceneHeight = rt.nHeight > 0 ? rt.nHeight : (int)(nHeight * fScale + 0.5f);
+		int nMaxSize = GetMaxTileSize();
+		if (nSceneWidth > nMaxSize || nSceneHeight > nMaxSize)
 		{
-			glProgramUniform2f(theShader, location, x, y);
+			printf("[Renderer] Render target %dx%d is over the GPU's limit of %d\n", nSceneWidth, nSceneHeight, nMaxSize);
+			if (nSceneWidth > nMaxSize) nSceneWidth = nMaxSize;
+			if (nSceneHeight > nMaxSize) nSceneHeight = nMaxSize;
 		}
+		if (nSceneWidth < 1) nSceneWidth = 1;
+		if (nSceneHeight < 1) nSceneHeight = 1;
+
+		bSceneOffscreen = dynamicResolution.bEnabled || nSceneWidth != nWidth || nSceneHeight != nHeight
+			|| rt.format != RENDERER_TARGETFORMAT_RGBA8;
+		ReleaseRenderTarget(sceneTarget);
+		if (bSceneOffscreen)
+		{
+			CreateRenderTarget(sceneTarget, nSceneWidth, nSceneHeight, GetTargetFormat(rt.format));
+			GLint filter = rt.resample == RENDERER_RESAMPLE_NEAREST ? GL_NEAREST : GL_LINEAR;
+			ScopedTextureBindings bindings;
+			bindings.Bind(0, sceneTarget.texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		}
+		UpdateRenderResolution();
 	}
 
-	struct GLTexture : public Texture
+	// Everything that depends on the output resolution is (re)configured here, and only
+	// here, when the display reports a mode change; steady-state frames don't touch it.
+	static void OnResolutionChanged(int width, int height)
 	{
-		GLuint ID;
-		int unit;
-	};
+		nWidth = width;
+		nHeight = height;
+
+		// Apply the resolution, and configure the correct GL viewport.
+		// We want to render to the top left corner of the framebuffer (other areas will
+		// remain unused when rendering at a smaller resolution than the framebuffer).
+		// Note that glViewport expects the coordinates of the bottom-left corner of
+		// the viewport, so we have to calculate that too.
+#ifdef __SWITCH__
+		nwindowSetCrop(win, 0, 0, width, height);
+#endif
+		glViewport(0, nSurfaceHeight - height, width, height);
+
+		// Offscreen scene target
+		ConfigureSceneTarget();
+
+		// Field targets for half-rate rendering
+		for (int i = 0; i < 2; i++)
+		{
+			ReleaseRenderTarget(fieldTargets[i]);
+			if (renderMode != RENDERER_RENDERMODE_FULL)
+			{
+				int fieldWidth = 0, fieldHeight = 0;
+				GetFieldSize(nSceneWidth, nSceneHeight, &fieldWidth, &fieldHeight);
+				CreateRenderTarget(fieldTargets[i], fieldWidth, fieldHeight, GetTargetFormat(renderTargetSettings.format));
+			}
+		}
+
+		// Render graph targets
+		bRenderGraphDirty = true;
+
+		// Frame capture target, recreated at the new size by the next capture; captures
+		// still in flight keep their old size
+		ReleaseFrameReadbackTarget();
+
+		if (bSceneOffscreen)
+			printf("[Renderer] Output resolution is now %dx%d, rendering at %dx%d\n", nWidth, nHeight, nSceneWidth, nSceneHeight);
+		else
+			printf("[Renderer] Output resolution is now %dx%d\n", nWidth, nHeight);
+	}
+
+	static const char * szFullscreenVertexShader =
+		"#version 410 core\n"
+		"out vec2 out_texcoord;\n"
+		"void main()\n"
+		"{\n"
+		"  vec2 uv = vec2( (gl_VertexID << 1) & 2, gl_VertexID & 2 );\n"
+		"  gl_Position = vec4( uv * 2.0 - 1.0, 0.5, 1.0 );\n"
+		"  out_texcoord = uv;\n"
+		"}";
+
+	// Builds a program from vertex and pixel shader source, or loads it from the program
+	// binary cache. Passing a compiled vertex shader object skips compiling szVertexShader,
+	// which is then only part of the cache key. Compile and link logs go to the error buffer.
+	static GLuint LinkProgram(const char * szVertexShader, GLuint vertexShader, const char * szPixelShader, int nPixelShaderSize, char * szErrorBuffer, int nErrorBufferSize)
+	{
+		const char * sources[2] = { szVertexShader, szPixelShader };
+		int sourceSizes[2] = { (int)strlen(szVertexShader), nPixelShaderSize };
+		unsigned long long key = ProgramCache::MakeKey(sources, sourceSizes, 2);
+		szErrorBuffer[0] = 0;
+
+		GLuint prg = ProgramCache::Load(key);
+		if (prg)
+			return prg;
+
+		GLint size = 0;
+		GLint result = 0;
+		GLuint vshd = vertexShader;
+		if (!vshd)
+		{
+			vshd = glCreateShader(GL_VERTEX_SHADER);
+			glShaderSource(vshd, 1, (const GLchar**)&sources[0], &sourceSizes[0]);
+			glCompileShader(vshd);
+			glGetShaderInfoLog(vshd, nErrorBufferSize, &size, szErrorBuffer);
+			glGetShaderiv(vshd, GL_COMPILE_STATUS, &result);
+			if (!result)
+			{
+				glDeleteShader(vshd);
+				return 0;
+			}
+		}
+
+		GLuint shd = glCreateShader(GL_FRAGMENT_SHADER);
+		GLint nFragmentSize = 0;
+		glShaderSource(shd, 1, (const GLchar**)&sources[1], &sourceSizes[1]);
+		glCompileShader(shd);
+		glGetShaderInfoLog(shd, nErrorBufferSize - size, &nFragmentSize, szErrorBuffer + size);
+		size += nFragmentSize;
+		glGetShaderiv(shd, GL_COMPILE_STATUS, &result);
+		if (result)
+		{
+			prg = glCreateProgram();
+			ProgramCache::PrepareProgram(prg);
+			glAttachShader(prg, vshd);
+			glAttachShader(prg, shd);
+			glLinkProgram(prg);
+			glGetProgramInfoLog(prg, nErrorBufferSize - size, &size, szErrorBuffer + size);
+			glGetProgramiv(prg, GL_LINK_STATUS, &result);
+			glDetachShader(prg, vshd);
+			glDetachShader(prg, shd);
+			if (result)
+			{
+				ProgramCache::Store(key, prg);
+			}
+			else
+			{
+				glDeleteProgram(prg);
+				prg = 0;
+			}
+		}
+
+		glDeleteShader(shd);
+		if (vshd != vertexShader)
+			glDeleteShader(vshd);
+		return prg;
+	}
+
+	static GLuint LinkFullscreenProgram(const char * szPixelShader, const char * szName)
+	{
+		char szErrorBuffer[4096];
+		GLuint prg = LinkProgram(szFullscreenVertexShader, glhVertexShader, szPixelShader, strlen(szPixelShader), szErrorBuffer, sizeof(szErrorBuffer));
+		if (!prg)
+			printf("[Renderer] %s program build failed:\n%s\n", szName, szErrorBuffer);
+		return prg;
+	}
+
+#define GUIQUADVB_SIZE (8192 * 6)
+	static bool InitGUIRing();
+	static void RetireGUIRegion();
+	extern int nDrawCallCount;
+
+	bool Open(RENDERER_SETTINGS * settings)
+	{
+		profile = settings->profile;
+		setMesaConfig();
+
+#ifdef __SWITCH__
+		// Retrieve the default window and configure its dimensions (1080p)
+    	win = nwindowGetDefault();
+    	nwindowSetDimensions(win, nSurfaceWidth, nSurfaceHeight);
+#endif
+
+		// Initialize EGL
+		if (!initEgl())
+			return false;
+
+#ifdef __SWITCH__
+		// Load OpenGL routines using glad
+		gladLoadGL();
+#endif
+
+		if (profile == RENDERER_PROFILE_DEBUG)
+		{
+			PFNGLDEBUGMESSAGECALLBACKPROC debugMessageCallbackProc = (PFNGLDEBUGMESSAGECALLBACKPROC)eglGetProcAddress("glDebugMessageCallback");
+			if (debugMessageCallbackProc)
+			{
+				glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+				debugMessageCallbackProc(debugMessageCallback, NULL);
+			}
+		}
+		OpenProfiler(settings->bDynamicResolution);
+
+		// Swap interval only applies once a context is current; 0 presents immediately
+		int nSwapInterval = settings->bVsync ? (settings->nSwapInterval > 1 ? settings->nSwapInterval : 1) : 0;
+		if (!eglSwapInterval(s_display, nSwapInterval))
+			printf("[Renderer] eglSwapInterval(%d) failed\n", nSwapInterval);
+
+		FRAMEPACER_SETTINGS framePacerSettings;
+		framePacerSettings.fFrameRateLimit = settings->fFrameRateLimit;
+		framePacerSettings.nMaxFramesInFlight = settings->nMaxFramesInFlight;
+		FramePacer::Open(&framePacerSettings);
+
+		// Initialize our scene
+		//sceneInit();
+
+		// The fullscreen pass draws a single oversized triangle generated from gl_VertexID,
+		// so the VAO needs no attributes at all; core profile still requires one to be bound.
+		glGenVertexArrays(1, &glhFullscreenQuadVA);
+
+		if (settings->szProgramCacheDirectory)
+		{
+			PROGRAMCACHE_SETTINGS programCacheSettings;
+			programCacheSettings.szDirectory = settings->szProgramCacheDirectory;
+			programCacheSettings.nMaxSize = settings->nProgramCacheSize;
+			ProgramCache::Open(&programCacheSettings);
+		}
+
+		glhVertexShader = glCreateShader(GL_VERTEX_SHADER);
+
+		GLint nShaderSize = strlen(szFullscreenVertexShader);
+		glShaderSource(glhVertexShader, 1, (const GLchar**)&szFullscreenVertexShader, &nShaderSize);
+		glCompileShader(glhVertexShader);
+
+		GLint size = 0;
+		GLint result = 0;
+		char szErrorBuffer[5000];
+		glGetShaderInfoLog(glhVertexShader, 4000, &size, szErrorBuffer);
+		glGetShaderiv(glhVertexShader, GL_COMPILE_STATUS, &result);
+		if (!result)
+		{
+			printf("[Renderer] Vertex shader compilation failed\n");
+			return false;
+		}
+
+		// Reconstructs a full frame from the two half-rate fields. Pixels of the field
+		// rendered this frame are copied; pixels of the previous frame's field are clamped
+		// to the range of their fresh neighbours, which hides most combing on motion.
+		static const char * szResolvePixelShader =
+			"#version 410 core\n"
+			"uniform sampler2D fieldEven;\n"
+			"uniform sampler2D fieldOdd;\n"
+			"uniform int nPattern; // 1 = checkerboard, 2 = interlaced\n"
+			"uniform int nCurrentField;\n"
+			"uniform ivec2 v2Size;\n"
+			"uniform vec2 v2Origin;\n"
+			"out vec4 out_color;\n"
+			"int fieldOf( ivec2 p )\n"
+			"{\n"
+			"  return nPattern == 1 ? ( ( p.x + p.y ) & 1 ) : ( p.y & 1 );\n"
+			"}\n"
+			"vec4 fetch( ivec2 p )\n"
+			"{\n"
+			"  p = clamp( p, ivec2( 0 ), v2Size - 1 );\n"
+			"  ivec2 t = nPattern == 1 ? ivec2( p.x >> 1, p.y ) : ivec2( p.x, p.y >> 1 );\n"
+			"  return fieldOf( p ) == 0 ? texelFetch( fieldEven, t, 0 ) : texelFetch( fieldOdd, t, 0 );\n"
+			"}\n"
+			"void main()\n"
+			"{\n"
+			"  ivec2 p = ivec2( gl_FragCoord.xy - v2Origin );\n"
+			"  vec4 c = fetch( p );\n"
+			"  if ( fieldOf( p ) != nCurrentField )\n"
+			"  {\n"
+			"    vec4 a = fetch( p + ivec2( 0, 1 ) );\n"
+			"    vec4 b = fetch( p - ivec2( 0, 1 ) );\n"
+			"    vec4 lo = min( a, b );\n"
+			"    vec4 hi = max( a, b );\n"
+			"    if ( nPattern == 1 )\n"
+			"    {\n"
+			"      a = fetch( p + ivec2( 1, 0 ) );\n"
+			"      b = fetch( p - ivec2( 1, 0 ) );\n"
+			"      lo = min( lo, min( a, b ) );\n"
+			"      hi = max( hi, max( a, b ) );\n"
+			"    }\n"
+			"    c = clamp( c, lo, hi );\n"
+			"  }\n"
+			"  out_color = c;\n"
+			"}\n";
+
+		// Downscales the scene target's used region to the output: each output pixel
+		// averages an even grid of bilinear taps over the texels it covers, which is an
+		// exact box filter for whole ratios like 2x2 supersampling.
+		static const char * szResamplePixelShader =
+			"#version 410 core\n"
+			"uniform sampler2D tex;\n"
+			"uniform vec2 v2SourceSize;\n"
+			"uniform vec2 v2TextureSize;\n"
+			"uniform vec2 v2Origin;\n"
+			"uniform vec2 v2OutputSize;\n"
+			"uniform ivec2 v2Taps;\n"
+			"out vec4 out_color;\n"
+			"void main()\n"
+			"{\n"
+			"  vec2 v2Scale = v2SourceSize / v2OutputSize;\n"
+			"  vec2 v2Pixel = floor( gl_FragCoord.xy - v2Origin );\n"
+			"  vec4 v4Sum = vec4( 0.0 );\n"
+			"  for ( int y = 0; y < v2Taps.y; y++ )\n"
+			"  {\n"
+			"    for ( int x = 0; x < v2Taps.x; x++ )\n"
+			"    {\n"
+			"      vec2 v2Source = ( v2Pixel + ( vec2( x, y ) + 0.5 ) / vec2( v2Taps ) ) * v2Scale;\n"
+			"      v2Source = clamp( v2Source, vec2( 0.5 ), v2SourceSize - 0.5 );\n"
+			"      v4Sum += texture( tex, v2Source / v2TextureSize );\n"
+			"    }\n"
+			"  }\n"
+			"  out_color = v4Sum / float( v2Taps.x * v2Taps.y );\n"
+			"}\n";
+
+		glhResampleProgram = LinkFullscreenProgram(szResamplePixelShader, "Resample");
+		if (!glhResampleProgram)
+			return false;
+
+		glhResolveProgram = LinkFullscreenProgram(szResolvePixelShader, "Field resolve");
+		if (!glhResolveProgram)
+			return false;
+		glProgramUniform1i(glhResolveProgram, glGetUniformLocation(glhResolveProgram, "fieldEven"), 0);
+		glProgramUniform1i(glhResolveProgram, glGetUniformLocation(glhResolveProgram, "fieldOdd"), 1);
+
+		hFragCoordTransform = RegisterUniform("shade_FragCoordTransform");
+		hFragCoordPattern = RegisterUniform("shade_FragCoordPattern");
+		hResolution = RegisterUniform("v2Resolution");
+		renderMode = settings->renderMode;
+
+
+		std::string defaultGUIVertexShader =
+			"#version 410 core\n"
+			"in vec2 in_pos;\n"
+			"in float in_sdf;\n"
+			"in vec4 in_color;\n"
+			"in vec2 in_texcoord;\n"
+			"in float in_factor;\n"
+			"out vec4 out_color;\n"
+			"out vec2 out_texcoord;\n"
+			"out float out_factor;\n"
+			"flat out float out_sdf;\n"
+			"out vec4 out_edge;\n"
+			"uniform vec2 v2Offset;\n"
+			"uniform mat4 matProj;\n"
+			"void main()\n"
+			"{\n"
+			"  vec4 pos = vec4( in_pos + v2Offset, 0.0, 1.0 );\n"
+			"  gl_Position = pos * matProj;\n"
+			"  out_color = in_color;\n"
+			"  out_texcoord = in_texcoord;\n"
+			"  out_factor = in_factor;\n"
+			"  out_sdf = in_sdf;\n"
+			"  out_edge = vec4( 0.0, 0.0, 1.0, 1.0 );\n"
+			"}\n";
+
+		// Distance field images store the distance to the edge in alpha, 0.5 on the edge;
+		// the edge is antialiased over about a pixel whatever the scale. out_edge is the
+		// pixel's position from the centre of a line segment (along, across) and the
+		// segment's half extents; anything else passes extents that cover it fully.
+		std::string defaultGUIPixelShader =
+			"#version 410 core\n"
+			"uniform sampler2D tex;\n"
+			"in vec4 out_color;\n"
+			"in vec2 out_texcoord;\n"
+			"in float out_factor;\n"
+			"flat in float out_sdf;\n"
+			"in vec4 out_edge;\n"
+			"out vec4 frag_color;\n"
+			"void main()\n"
+			"{\n"
+			"  vec4 v4Sample = texture( tex, out_texcoord );\n"
+			"  float fEdge = max( fwidth( v4Sample.a ) * 0.7, 0.001 );\n"
+			"  float fCoverage = smoothstep( 0.5 - fEdge, 0.5 + fEdge, v4Sample.a );\n"
+			"  v4Sample = mix( v4Sample, vec4( 1.0, 1.0, 1.0, fCoverage ), out_sdf );\n"
+			"  vec4 v4Texture = out_color * v4Sample;\n"
+			"  vec4 v4Color = out_color;\n"
+			"  frag_color = mix( v4Texture, v4Color, out_factor );\n"
+			"  vec2 v2Coverage = clamp( out_edge.zw + 0.5 - abs( out_edge.xy ), 0.0, 1.0 );\n"
+			"  frag_color.a *= v2Coverage.x * v2Coverage.y;\n"
+			"}\n";
+
+		glhGUIProgram = LinkProgram(defaultGUIVertexShader.c_str(), 0, defaultGUIPixelShader.c_str(), defaultGUIPixelShader.size(), szErrorBuffer, sizeof(szErrorBuffer));
+		if (!glhGUIProgram)
+		{
+			printf("[Renderer] Default GUI program build failed:\n%s\n", szErrorBuffer);
+			return false;
+		}
+
+		// Rectangles are drawn as one instance each, a 4 vertex strip expanded from
+		// gl_VertexID; the rectangle is in quarter pixels, the uv rect in unorm16. Line
+		// segments (a non-zero width) share the stream: in_rect holds both end points and
+		// the uv rect the colour of the second one. The strip becomes a box around the
+		// segment with a pixel to spare on every side for the antialiased edge; lines
+		// thinner than a pixel are drawn a pixel wide and faded instead.
+		std::string defaultGUIQuadVertexShader =
+			"#version 410 core\n"
+			"in vec4 in_rect;\n"
+			"in vec4 in_uvrect;\n"
+			"in vec4 in_color;\n"
+			"in float in_factor;\n"
+			"in float in_sdf;\n"
+			"in float in_width;\n"
+			"out vec4 out_color;\n"
+			"out vec2 out_texcoord;\n"
+			"out float out_factor;\n"
+			"flat out float out_sdf;\n"
+			"out vec4 out_edge;\n"
+			"uniform vec2 v2Offset;\n"
+			"uniform mat4 matProj;\n"
+			"void main()\n"
+			"{\n"
+			"  vec2 corner = vec2( gl_VertexID & 1, gl_VertexID >> 1 );\n"
+			"  vec2 pos;\n"
+			"  out_color = in_color;\n"
+			"  if ( in_width > 0.0 )\n"
+			"  {\n"
+			"    vec2 p0 = in_rect.xy * 0.25;\n"
+			"    vec2 p1 = in_rect.zw * 0.25;\n"
+			"    float fWidth = in_width * 0.25;\n"
+			"    float fLength = length( p1 - p0 );\n"
+			"    vec2 dir = fLength > 0.0 ? ( p1 - p0 ) / fLength : vec2( 1.0, 0.0 );\n"
+			"    vec2 extents = vec2( fLength, max( fWidth, 1.0 ) ) * 0.5;\n"
+			"    vec2 local = ( corner * 2.0 - 1.0 ) * ( extents + 1.0 );\n"
+			"    pos = ( p0 + p1 ) * 0.5 + dir * local.x + vec2( -dir.y, dir.x ) * local.y;\n"
+			"    uvec2 end = uvec2( round( in_uvrect.xy * 65535.0 ) );\n"
+			"    vec4 v4EndColor = vec4( end.x & 255u, end.x >> 8u, end.y & 255u, end.y >> 8u ) / 255.0;\n"
+			"    out_color = mix( in_color, v4EndColor, corner.x );\n"
+			"    out_color.a *= min( fWidth, 1.0 );\n"
+			"    out_edge = vec4( local, extents );\n"
+			"  }\n"
+			"  else\n"
+			"  {\n"
+			"    pos = ( in_rect.xy + in_rect.zw * corner ) * 0.25;\n"
+			"    out_edge = vec4( 0.0, 0.0, 1.0, 1.0 );\n"
+			"  }\n"
+			"  gl_Position = vec4( pos + v2Offset, 0.0, 1.0 ) * matProj;\n"
+			"  out_texcoord = mix( in_uvrect.xy, in_uvrect.zw, corner );\n"
+			"  out_factor = in_factor;\n"
+			"  out_sdf = in_sdf;\n"
+			"}\n";
+
+		glhGUIQuadProgram = LinkProgram(defaultGUIQuadVertexShader.c_str(), 0, defaultGUIPixelShader.c_str(), defaultGUIPixelShader.size(), szErrorBuffer, sizeof(szErrorBuffer));
+		if (!glhGUIQuadProgram)
+		{
+			printf("[Renderer] Default GUI quad program build failed:\n%s\n", szErrorBuffer);
+			return false;
+		}
+
+		if (!InitGUIRing())
+			return false;
+
+		if (!InitFrameReadbacks(settings->nFrameGrabDepth > 0 ? settings->nFrameGrabDepth : 3))
+			return false;
+
+		renderTargetSettings = settings->renderTarget;
+
+		if (settings->bDynamicResolution)
+		{
+			dynamicResolution.bEnabled = true;
+			dynamicResolution.fMinScale = settings->fMinRenderScale;
+			dynamicResolution.fMaxScale = settings->fMaxRenderScale;
+			dynamicResolution.fTargetFrameTime = 1.0f / settings->fTargetFrameRate;
+			dynamicResolution.fScale = dynamicResolution.fMaxScale;
+		}
+
+		int width = 0, height = 0;
+		Display::PollModeChange(&width, &height);
+		OnResolutionChanged(width, height);
+
+		run = true;
+
+		return true;
+	}
+
+	static void PollShaderReload();
+
+	void StartFrame()
+	{
+		Profiler::BeginMarker(hFrameMarker);
+
+		PollShaderReload();
+
+		int width = 0, height = 0;
+		if (Display::PollModeChange(&width, &height))
+		{
+			OnResolutionChanged(width, height);
+		}
+
+		if (dynamicResolution.bEnabled)
+		{
+			dynamicResolution.fFrameStart = Timer::GetTimePrecise();
+			UpdateDynamicResolution();
+		}
+
+		glClearColor(0.08f, 0.18f, 0.18f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	}
+
+	void EndFrame(bool bPresent)
+	{
+		RetireGUIRegion();
+		nFrameIndex++;
+		frameTimings.nDrawCalls = nDrawCallCount;
+		nDrawCallCount = 0;
+		Profiler::EndMarker(hFrameMarker);
+		Profiler::NewFrame();
+
+		if (dynamicResolution.bEnabled && dynamicResolution.fFrameStart >= 0.0)
+			dynamicResolution.fCpuFrameTime = (float)(Timer::GetTimePrecise() - dynamicResolution.fFrameStart);
+
+		if (profile == RENDERER_PROFILE_PROFILE)
+		{
+			double fNow = Timer::GetTimePrecise();
+			if (fLastFrameEnd > 0.0)
+				frameTimings.fCpuFrameTime = (float)(fNow - fLastFrameEnd);
+			fLastFrameEnd = fNow;
+		}
+
+		if (bPresent)
+		{
+			eglSwapBuffers(s_display, s_surface);
+			FramePacer::EndFrame();
+		}
+		else
+		{
+			// Nothing to pace against; just submit the frame
+			glFlush();
+		}
+		TRACE("C");
+	}
+
+	// Draws the user shader over the current viewport; fPattern/fField select which
+	// field's pixels gl_FragCoord maps to (0 = every pixel), and the offset is added to
+	// gl_FragCoord so the shader sees the coordinates of the logical image it renders.
+	static void DrawUserShader(const UniformTable & table, float fPattern, float fField, float fOffsetX, float fOffsetY)
+	{
+		glUseProgram(table.program);
+
+		GLint location = table.locations[hFragCoordTransform];
+		if (location != -1)
+			glProgramUniform4f(table.program, location, 1.0f, 1.0f, fOffsetX, fOffsetY);
+		location = table.locations[hFragCoordPattern];
+		if (location != -1)
+			glProgramUniform2f(table.program, location, fPattern, fField);
+
+		glBindVertexArray(glhFullscreenQuadVA);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		glUseProgram(NULL);
+	}
+
+	static void RunRenderGraph();
+
+	// Scales the used part of the scene target into the window's (top left) output region.
+	// Upscaling (and a plain copy) is a framebuffer blit; downscaling with the linear
+	// filter goes through the resample program.
+	static void ResampleScene()
+	{
+		bool bNearest = renderTargetSettings.resample == RENDERER_RESAMPLE_NEAREST;
+		int nTapsX = bNearest || nRenderWidth <= nWidth ? 1 : (nRenderWidth + nWidth - 1) / nWidth;
+		int nTapsY = bNearest || nRenderHeight <= nHeight ? 1 : (nRenderHeight + nHeight - 1) / nHeight;
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		if (nTapsX == 1 && nTapsY == 1)
+		{
+			bool bCopy = nRenderWidth == nWidth && nRenderHeight == nHeight;
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneTarget.fbo);
+			glBlitFramebuffer(0, 0, nRenderWidth, nRenderHeight,
+				0, nSurfaceHeight - nHeight, nWidth, nSurfaceHeight, GL_COLOR_BUFFER_BIT, bNearest || bCopy ? GL_NEAREST : GL_LINEAR);
+			return;
+		}
+
+		glViewport(0, nSurfaceHeight - nHeight, nWidth, nHeight);
+		glUseProgram(glhResampleProgram);
+		glProgramUniform2f(glhResampleProgram, glGetUniformLocation(glhResampleProgram, "v2SourceSize"), (float)nRenderWidth, (float)nRenderHeight);
+		glProgramUniform2f(glhResampleProgram, glGetUniformLocation(glhResampleProgram, "v2TextureSize"), (float)sceneTarget.width, (float)sceneTarget.height);
+		glProgramUniform2f(glhResampleProgram, glGetUniformLocation(glhResampleProgram, "v2Origin"), 0.0f, (float)(nSurfaceHeight - nHeight));
+		glProgramUniform2f(glhResampleProgram, glGetUniformLocation(glhResampleProgram, "v2OutputSize"), (float)nWidth, (float)nHeight);
+		glProgramUniform2i(glhResampleProgram, glGetUniformLocation(glhResampleProgram, "v2Taps"), nTapsX, nTapsY);
+		ScopedTextureBindings bindings;
+		bindings.Bind(0, sceneTarget.texture);
+		glBindVertexArray(glhFullscreenQuadVA);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glUseProgram(0);
+	}
+
+	void RenderFullscreenQuad()
+	{
+		TRACE("Starting render");
+		Profiler::ScopedMarker shaderMarker(hShaderMarker);
+
+		RunRenderGraph();
+
+		// Where the full-resolution shader output goes, and where its bottom left pixel is
+		GLuint sceneFramebuffer = bSceneOffscreen ? sceneTarget.fbo : 0;
+		int sceneOriginY = bSceneOffscreen ? 0 : nSurfaceHeight - nHeight;
+
+		if (renderMode == RENDERER_RENDERMODE_FULL)
+		{
+			if (bSceneOffscreen)
+			{
+				glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+				glViewport(0, 0, nRenderWidth, nRenderHeight);
+			}
+
+			DrawUserShader(theShaderUniforms, 0.0f, 0.0f, 0.0f, (float)-sceneOriginY);
+		}
+		else
+		{
+			int nPattern = renderMode == RENDERER_RENDERMODE_CHECKERBOARD ? 1 : 2;
+			nCurrentField ^= 1;
+
+			int fieldWidth = 0, fieldHeight = 0;
+			GetFieldSize(nRenderWidth, nRenderHeight, &fieldWidth, &fieldHeight);
+			glBindFramebuffer(GL_FRAMEBUFFER, fieldTargets[nCurrentField].fbo);
+			glViewport(0, 0, fieldWidth, fieldHeight);
+			DrawUserShader(theShaderUniforms, (float)nPattern, (float)nCurrentField, 0.0f, 0.0f);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+			glViewport(0, sceneOriginY, nRenderWidth, nRenderHeight);
+
+			glUseProgram(glhResolveProgram);
+			glProgramUniform1i(glhResolveProgram, glGetUniformLocation(glhResolveProgram, "nPattern"), nPattern);
+			glProgramUniform1i(glhResolveProgram, glGetUniformLocation(glhResolveProgram, "nCurrentField"), nCurrentField);
+			glProgramUniform2i(glhResolveProgram, glGetUniformLocation(glhResolveProgram, "v2Size"), nRenderWidth, nRenderHeight);
+			glProgramUniform2f(glhResolveProgram, glGetUniformLocation(glhResolveProgram, "v2Origin"), 0.0f, (float)sceneOriginY);
+			ScopedTextureBindings bindings;
+			bindings.Bind(0, fieldTargets[0].texture);
+			bindings.Bind(1, fieldTargets[1].texture);
+
+			glBindVertexArray(glhFullscreenQuadVA);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			glUseProgram(0);
+		}
+
+		if (bSceneOffscreen)
+			ResampleScene();
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, nSurfaceHeight - nHeight, nWidth, nHeight);
+		TRACE("Render done");
+	}
+
+	void SetRenderTarget(const RENDERER_RENDERTARGET * target)
+	{
+		renderTargetSettings = *target;
+		if (nWidth && nHeight)
+			OnResolutionChanged(nWidth, nHeight);
+	}
+
+	void GetRenderTarget(RENDERER_RENDERTARGET * target)
+	{
+		*target = renderTargetSettings;
+	}
+
+	void SetRenderMode(RENDERER_RENDERMODE mode)
+	{
+		if (mode == renderMode)
+			return;
+
+		renderMode = mode;
+		OnResolutionChanged(nWidth, nHeight);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// render graph
+
+	// Passes are extra fullscreen shaders rendered into their own targets before the main
+	// shader each frame. A pass reads other passes through sampler inputs, either this
+	// frame's output (an ordering dependency) or the previous frame's ("name:previous",
+	// a feedback edge, served from a ping-pong pair of targets without copies). The main
+	// shader reads a pass by declaring a sampler with the pass's name. Passes that nothing
+	// reads are culled, and targets of passes whose lifetimes don't overlap are shared.
+	struct PassInput
+	{
+		std::string sUniform;
+		std::string sSource;
+		bool bPrevious;
+		int nSource;
+		GLint location;
+	};
+
+	struct Pass
+	{
+		std::string sName;
+		UniformTable uniforms;
+		float fScale;
+		GLenum format;
+		std::vector<PassInput> inputs;
+
+		// resolved by BuildRenderGraph()
+		bool bLive;
+		bool bFeedback;
+		int width;
+		int height;
+		int nOrder;
+		int nLastUse;
+		int nTargets[2];
+		GLint mainLocation;
+	};
+
+	static GLuint CompileUserProgram(char * szShaderCode, int nShaderCodeSize, char * szErrorBuffer, int nErrorBufferSize);
+
+	std::vector<int> passOrder;
+	std::vector<RenderTarget> graphTargets;
+	int nGraphFrame = 0;
+	static const int nGraphTextureUnitBase = 16;
+
+	static UniformTable & GetPassUniforms(size_t i)
+	{
+		return passes[i]->uniforms;
+	}
+
+	static int FindPass(const std::string & sName)
+	{
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			if (passes[i]->sName == sName)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	static bool VisitPass(int i, std::vector<int> & state)
+	{
+		if (state[i] == 2)
+			return true;
+		if (state[i] == 1)
+		{
+			printf("[Renderer] Render graph has a cycle through pass '%s'; use ':previous' to read last frame's output\n", passes[i]->sName.c_str());
+			return false;
+		}
+
+		state[i] = 1;
+		for (size_t j = 0; j < passes[i]->inputs.size(); j++)
+		{
+			const PassInput & input = passes[i]->inputs[j];
+			if (!input.bPrevious && input.nSource >= 0 && !VisitPass(input.nSource, state))
+				return false;
+		}
+		state[i] = 2;
+		passOrder.push_back(i);
+		return true;
+	}
+
+	// Re-resolves names, uniform locations, liveness, order and lifetimes, without touching
+	// any target
+	static bool ResolveRenderGraph()
+	{
+		passOrder.clear();
+		if (passes.empty() || !theShader || !nWidth || !nHeight)
+			return false;
+
+		// Resolve names, then mark everything the main shader depends on (directly or
+		// through feedback) as live
+		std::vector<int> stack;
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			Pass & pass = *passes[i];
+			for (size_t j = 0; j < pass.inputs.size(); j++)
+			{
+				PassInput & input = pass.inputs[j];
+				input.nSource = FindPass(input.sSource);
+				input.location = glGetUniformLocation(pass.uniforms.program, input.sUniform.c_str());
+				if (input.nSource < 0)
+					printf("[Renderer] Pass '%s' reads unknown pass '%s'\n", pass.sName.c_str(), input.sSource.c_str());
+			}
+			pass.mainLocation = theShader ? glGetUniformLocation(theShader, pass.sName.c_str()) : -1;
+			pass.bLive = false;
+			pass.bFeedback = false;
+			pass.nOrder = -1;
+			if (pass.mainLocation != -1)
+				stack.push_back(i);
+		}
+		while (!stack.empty())
+		{
+			Pass & pass = *passes[stack.back()];
+			stack.pop_back();
+			if (pass.bLive)
+				continue;
+			pass.bLive = true;
+			for (size_t j = 0; j < pass.inputs.size(); j++)
+			{
+				if (pass.inputs[j].nSource >= 0)
+					stack.push_back(pass.inputs[j].nSource);
+			}
+		}
+
+		// Topological order over this-frame dependencies
+		std::vector<int> state(passes.size(), 0);
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			if (passes[i]->bLive && !VisitPass(i, state))
+			{
+				passOrder.clear();
+				return false;
+			}
+		}
+
+		// Lifetimes, in execution order; the main shader runs after the last pass
+		for (size_t k = 0; k < passOrder.size(); k++)
+		{
+			Pass & pass = *passes[passOrder[k]];
+			pass.nOrder = k;
+			pass.nLastUse = pass.mainLocation != -1 ? (int)passOrder.size() : (int)k;
+			pass.width = (int)(nSceneWidth * pass.fScale + 0.5f);
+			pass.height = (int)(nSceneHeight * pass.fScale + 0.5f);
+			if (pass.width < 1) pass.width = 1;
+			if (pass.height < 1) pass.height = 1;
+		}
+		for (size_t k = 0; k < passOrder.size(); k++)
+		{
+			Pass & pass = *passes[passOrder[k]];
+			for (size_t j = 0; j < pass.inputs.size(); j++)
+			{
+				const PassInput & input = pass.inputs[j];
+				if (input.nSource < 0)
+					continue;
+				Pass & source = *passes[input.nSource];
+				if (input.bPrevious)
+					source.bFeedback = true;
+				else if (source.nLastUse < (int)k)
+					source.nLastUse = k;
+			}
+		}
+		return true;
+	}
+
+	// Assigns targets: feedback passes own a ping-pong pair for the whole frame, the rest
+	// take any free target of matching size and format. The assignment only depends on the
+	// resolved graph, so a target whose slot comes out with the same size and format is
+	// kept as it is, with its contents; feedback history survives a shader reload.
+	static void AssignGraphTargets()
+	{
+		std::vector<RenderTarget> previousTargets;
+		previousTargets.swap(graphTargets);
+		std::vector<int> targetBusyUntil;
+		int nUnaliasedTargets = 0;
+		int nKeptTargets = 0;
+		for (size_t k = 0; k < passOrder.size(); k++)
+		{
+			Pass & pass = *passes[passOrder[k]];
+			int nCount = pass.bFeedback ? 2 : 1;
+			nUnaliasedTargets += nCount;
+			for (int n = 0; n < nCount; n++)
+			{
+				int nTarget = -1;
+				for (size_t t = 0; t < graphTargets.size() && !pass.bFeedback; t++)
+				{
+					if (targetBusyUntil[t] < (int)k && graphTargets[t].width == pass.width && graphTargets[t].height == pass.height && graphTargets[t].format == pass.format)
+					{
+						nTarget = t;
+						break;
+					}
+				}
+				if (nTarget < 0)
+				{
+					RenderTarget rt = { 0, 0, 0, 0, 0 };
+					size_t t = graphTargets.size();
+					if (t < previousTargets.size() && previousTargets[t].width == pass.width && previousTargets[t].height == pass.height && previousTargets[t].format == pass.format)
+					{
+						std::swap(rt, previousTargets[t]);
+						nKeptTargets++;
+					}
+					else
+					{
+						CreateRenderTarget(rt, pass.width, pass.height, pass.format);
+					}
+					graphTargets.push_back(rt);
+					targetBusyUntil.push_back(0);
+					nTarget = graphTargets.size() - 1;
+				}
+				targetBusyUntil[nTarget] = pass.bFeedback ? INT_MAX : pass.nLastUse;
+				pass.nTargets[n] = nTarget;
+			}
+			if (!pass.bFeedback)
+				pass.nTargets[1] = pass.nTargets[0];
+		}
+
+		for (size_t t = 0; t < previousTargets.size(); t++)
+			ReleaseRenderTarget(previousTargets[t]);
+
+		if (!passOrder.empty())
+		{
+			printf("[Renderer] Render graph: %d of %d passes live, %d targets (%d without aliasing, %d kept)\n",
+				(int)passOrder.size(), (int)passes.size(), (int)graphTargets.size(), nUnaliasedTargets, nKeptTargets);
+		}
+	}
+
+	// Passes, inputs, the main shader and the resolution only mark the graph dirty, so
+	// loading a config with many passes builds it once
+	static void BuildRenderGraph()
+	{
+		bRenderGraphDirty = false;
+		ResolveRenderGraph();
+		AssignGraphTargets();
+	}
+
+	static GLuint GetPassTexture(const Pass & pass, bool bPrevious)
+	{
+		int nSlot = pass.bFeedback && bPrevious ? nGraphFrame ^ 1 : nGraphFrame;
+		return graphTargets[pass.nTargets[nSlot]].texture;
+	}
+
+	static void RunRenderGraph()
+	{
+		if (bRenderGraphDirty)
+			BuildRenderGraph();
+		if (passOrder.empty())
+			return;
+
+		Profiler::ScopedMarker renderGraphMarker(hRenderGraphMarker);
+
+		// The graph's units are its own and stay bound for the main shader; only the active
+		// unit is put back
+		GLint nActiveUnit = 0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &nActiveUnit);
+
+		nGraphFrame ^= 1;
+		for (size_t k = 0; k < passOrder.size(); k++)
+		{
+			Pass & pass = *passes[passOrder[k]];
+			glBindFramebuffer(GL_FRAMEBUFFER, graphTargets[pass.nTargets[nGraphFrame]].fbo);
+			glViewport(0, 0, pass.width, pass.height);
+
+			for (size_t j = 0; j < pass.inputs.size(); j++)
+			{
+				const PassInput & input = pass.inputs[j];
+				if (input.nSource < 0 || input.location == -1)
+					continue;
+				glActiveTexture(GL_TEXTURE0 + nGraphTextureUnitBase + j);
+				glBindTexture(GL_TEXTURE_2D, GetPassTexture(*passes[input.nSource], input.bPrevious));
+				glProgramUniform1i(pass.uniforms.program, input.location, nGraphTextureUnitBase + j);
+			}
+
+			GLint location = pass.uniforms.locations[hResolution];
+			if (location != -1)
+				glProgramUniform2f(pass.uniforms.program, location, (float)pass.width, (float)pass.height);
+
+			DrawUserShader(pass.uniforms, 0.0f, 0.0f, 0.0f, 0.0f);
+		}
+
+		// Outputs the main shader samples directly
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			if (!passes[i]->bLive || passes[i]->mainLocation == -1)
+				continue;
+			glActiveTexture(GL_TEXTURE0 + nGraphTextureUnitBase + i);
+			glBindTexture(GL_TEXTURE_2D, GetPassTexture(*passes[i], false));
+			glProgramUniform1i(theShader, passes[i]->mainLocation, nGraphTextureUnitBase + i);
+		}
+
+		glActiveTexture(nActiveUnit);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, nSurfaceHeight - nHeight, nWidth, nHeight);
+	}
+
+	bool AddRenderPass(const char * szName, char * szShaderCode, int nShaderCodeSize, float fScale, PASSFORMAT format, char * szErrorBuffer, int nErrorBufferSize)
+	{
+		GLuint prg = CompileUserProgram(szShaderCode, nShaderCodeSize, szErrorBuffer, nErrorBufferSize);
+		if (!prg)
+			return false;
+
+		int i = FindPass(szName);
+		if (i < 0)
+		{
+			passes.push_back(new Pass());
+			i = passes.size() - 1;
+			passes[i]->sName = szName;
+		}
+		else
+		{
+			glDeleteProgram(passes[i]->uniforms.program);
+		}
+
+		Pass & pass = *passes[i];
+		pass.fScale = fScale > 0.0f ? fScale : 1.0f;
+		switch (format)
+		{
+		default:
+		case PASSFORMAT_RGBA8: pass.format = GL_RGBA8; break;
+		case PASSFORMAT_RGBA16F: pass.format = GL_RGBA16F; break;
+		case PASSFORMAT_RGBA32F: pass.format = GL_RGBA32F; break;
+		}
+		ResolveUniforms(pass.uniforms, prg);
+
+		bRenderGraphDirty = true;
+		return true;
+	}
+
+	bool AddRenderPassInput(const char * szPass, const char * szUniform, const char * szSource)
+	{
+		int i = FindPass(szPass);
+		if (i < 0)
+			return false;
+
+		PassInput input;
+		input.sUniform = szUniform;
+		input.sSource = szSource;
+		input.bPrevious = false;
+		input.nSource = -1;
+		input.location = -1;
+
+		static const char * szPreviousSuffix = ":previous";
+		size_t nSuffix = strlen(szPreviousSuffix);
+		if (input.sSource.size() > nSuffix && input.sSource.compare(input.sSource.size() - nSuffix, nSuffix, szPreviousSuffix) == 0)
+		{
+			input.sSource.erase(input.sSource.size() - nSuffix);
+			input.bPrevious = true;
+		}
+
+		passes[i]->inputs.push_back(input);
+		bRenderGraphDirty = true;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// tiled offscreen rendering
+
+	// Tiles are rendered into one target and read back through a small FIFO of PBOs,
+	// each guarded by a fence, so rendering the next tile overlaps the transfer of the
+	// previous ones and the CPU only ever waits for the oldest.
+	struct TileReadback
+	{
+		GLuint pbo;
+		GLsync fence;
+		int x, y, w, h;
+	};
+	RenderTarget tileTarget = { 0, 0, 0, 0, 0 };
+	std::vector<TileReadback> tileReadbacks;
+	int nTileReadbackHead = 0;  // oldest in-flight readback
+	int nTileReadbackCount = 0; // number in flight
+	bool bTileMapped = false;
+
+	int GetMaxTileSize()
+	{
+		GLint maxViewport[2] = { 0, 0 };
+		GLint maxTexture = 0;
+		glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewport);
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+		int size = maxTexture;
+		if (maxViewport[0] < size) size = maxViewport[0];
+		if (maxViewport[1] < size) size = maxViewport[1];
+		return size;
+	}
+
+	bool BeginTiles(int nTileWidth, int nTileHeight, int nReadbackDepth)
+	{
+		// Tiles only draw the main shader: passes it samples would be read at the viewer's
+		// resolution, left over from the last frame
+		if (bRenderGraphDirty)
+			BuildRenderGraph();
+		if (!passOrder.empty())
+		{
+			printf("[Renderer] The shader samples render graph passes, which tiled rendering doesn't run\n");
+			return false;
+		}
+
+		if (!CreateRenderTarget(tileTarget, nTileWidth, nTileHeight))
+		{
+			ReleaseRenderTarget(tileTarget);
+			return false;
+		}
+
+		tileReadbacks.resize(nReadbackDepth);
+		for (int i = 0; i < nReadbackDepth; i++)
+		{
+			glGenBuffers(1, &tileReadbacks[i].pbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, tileReadbacks[i].pbo);
+			glBufferData(GL_PIXEL_PACK_BUFFER, nTileWidth * nTileHeight * sizeof(unsigned int), NULL, GL_STREAM_READ);
+			tileReadbacks[i].fence = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		nTileReadbackHead = 0;
+		nTileReadbackCount = 0;
+		bTileMapped = false;
+		return true;
+	}
+
+	bool RenderTile(int x, int y, int w, int h)
+	{
+		if (nTileReadbackCount == (int)tileReadbacks.size() || w > tileTarget.width || h > tileTarget.height)
+			return false;
+
+		TileReadback & slot = tileReadbacks[(nTileReadbackHead + nTileReadbackCount) % tileReadbacks.size()];
+		slot.x = x;
+		slot.y = y;
+		slot.w = w;
+		slot.h = h;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, tileTarget.fbo);
+		glViewport(0, 0, w, h);
+		DrawUserShader(theShaderUniforms, 0.0f, 0.0f, (float)x, (float)y);
+
+		Profiler::BeginMarker(hReadbackMarker);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		Profiler::EndMarker(hReadbackMarker);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, nSurfaceHeight - nHeight, nWidth, nHeight);
+
+		// Submit each tile on its own, so no single batch of GPU work grows large
+		// enough to trip a watchdog
+		glFlush();
+
+		nTileReadbackCount++;
+		return true;
+	}
+
+	bool MapCompletedTile(bool bWait, TILE * pTile)
+	{
+		if (!nTileReadbackCount || bTileMapped)
+			return false;
+
+		TileReadback & slot = tileReadbacks[nTileReadbackHead];
+		GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, bWait ? 1000000000ull : 0);
+		while (bWait && status == GL_TIMEOUT_EXPIRED)
+			status = glClientWaitSync(slot.fence, 0, 1000000000ull);
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+			return false;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		pTile->pData = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.w * slot.h * sizeof(unsigned int), GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!pTile->pData)
+			return false;
+
+		pTile->x = slot.x;
+		pTile->y = slot.y;
+		pTile->width = slot.w;
+		pTile->height = slot.h;
+		bTileMapped = true;
+		return true;
+	}
+
+	void UnmapCompletedTile()
+	{
+		if (!bTileMapped)
+			return;
+
+		TileReadback & slot = tileReadbacks[nTileReadbackHead];
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+
+		nTileReadbackHead = (nTileReadbackHead + 1) % tileReadbacks.size();
+		nTileReadbackCount--;
+		bTileMapped = false;
+	}
+
+	void EndTiles()
+	{
+		UnmapCompletedTile();
+		for (size_t i = 0; i < tileReadbacks.size(); i++)
+		{
+			if (tileReadbacks[i].fence)
+				glDeleteSync(tileReadbacks[i].fence);
+			glDeleteBuffers(1, &tileReadbacks[i].pbo);
+		}
+		tileReadbacks.clear();
+		nTileReadbackCount = 0;
+		ReleaseRenderTarget(tileTarget);
+	}
+
+	// Routes gl_FragCoord through shade_FragCoord(), so the renderer can shade a subset
+	// of the logical pixels (half-rate fields, tiles) without the shader noticing:
+	// shade_FragCoordPattern = (pattern, field) picks the field pixel layout, and
+	// shade_FragCoordTransform = (scale.xy, offset.xy) maps into the full image.
+	static std::string InjectShaderPrologue(const char * szShaderCode, int nShaderCodeSize)
+	{
+		std::string sCode(szShaderCode, nShaderCodeSize);
+
+		static const char * szFragCoord = "gl_FragCoord";
+		const size_t nFragCoordLength = strlen(szFragCoord);
+		for (size_t pos = sCode.find(szFragCoord); pos != std::string::npos; pos = sCode.find(szFragCoord, pos))
+		{
+			char next = pos + nFragCoordLength < sCode.size() ? sCode[pos + nFragCoordLength] : 0;
+			char prev = pos > 0 ? sCode[pos - 1] : 0;
+			if (isalnum(next) || next == '_' || isalnum(prev) || prev == '_')
+			{
+				pos += nFragCoordLength;
+				continue;
+			}
+			sCode.replace(pos, nFragCoordLength, "shade_FragCoord()");
+			pos += strlen("shade_FragCoord()");
+		}
+
+		// The prologue has to follow #version and any #extension directives
+		size_t insertAt = 0;
+		int nLinesBefore = 0;
+		size_t lineStart = 0;
+		int nLine = 0;
+		while (lineStart < sCode.size())
+		{
+			size_t lineEnd = sCode.find('\n', lineStart);
+			if (lineEnd == std::string::npos)
+				lineEnd = sCode.size();
+			nLine++;
+
+			size_t first = sCode.find_first_not_of(" \t\r", lineStart);
+			if (first != std::string::npos && first < lineEnd)
+			{
+				if (sCode.compare(first, 8, "#version") == 0 || sCode.compare(first, 10, "#extension") == 0)
+				{
+					insertAt = lineEnd < sCode.size() ? lineEnd + 1 : lineEnd;
+					nLinesBefore = nLine;
+				}
+				else if (sCode.compare(first, 2, "//") != 0)
+				{
+					break;
+				}
+			}
+			lineStart = lineEnd + 1;
+		}
+
+		char szLine[32];
+		snprintf(szLine, sizeof(szLine), "#line %d\n", nLinesBefore + 1);
+
+		std::string sPrologue =
+			"\n"
+			"uniform vec4 shade_FragCoordTransform;\n"
+			"uniform vec2 shade_FragCoordPattern;\n"
+			"vec4 shade_FragCoord()\n"
+			"{\n"
+			"  vec2 p = gl_FragCoord.xy;\n"
+			"  if ( shade_FragCoordPattern.x == 1.0 )\n"
+			"    p.x = floor( p.x ) * 2.0 + mod( floor( p.y ) + shade_FragCoordPattern.y, 2.0 ) + 0.5;\n"
+			"  else if ( shade_FragCoordPattern.x == 2.0 )\n"
+			"    p.y = floor( p.y ) * 2.0 + shade_FragCoordPattern.y + 0.5;\n"
+			"  return vec4( p * shade_FragCoordTransform.xy + shade_FragCoordTransform.zw, gl_FragCoord.zw );\n"
+			"}\n";
+		sPrologue += szLine;
+
+		sCode.insert(insertAt, sPrologue);
+		return sCode;
+	}
+
+	// Compiles a user fragment shader (main shader or render pass) against the fullscreen
+	// vertex shader; returns 0 and fills the error buffer on failure.
+	static GLuint CompileUserProgram(char * szShaderCode, int nShaderCodeSize, char * szErrorBuffer, int nErrorBufferSize)
+	{
+		std::string sShaderCode = InjectShaderPrologue(szShaderCode, nShaderCodeSize);
+		return LinkProgram(szFullscreenVertexShader, glhVertexShader, sShaderCode.c_str(), sShaderCode.size(), szErrorBuffer, nErrorBufferSize);
+	}
+
+	static void SwapMainShader(GLuint prg)
+	{
+		if (theShader)
+			glDeleteProgram(theShader);
+
+		theShader = prg;
+		ResolveUniforms(theShaderUniforms, theShader);
+
+		// The passes the main shader samples may have changed
+		bRenderGraphDirty = true;
+	}
+
+	bool ReloadShader(char * szShaderCode, int nShaderCodeSize, char * szErrorBuffer, int nErrorBufferSize)
+	{
+		GLuint prg = CompileUserProgram(szShaderCode, nShaderCodeSize, szErrorBuffer, nErrorBufferSize);
+		if (!prg)
+			return false;
+
+		SwapMainShader(prg);
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// asynchronous shader reload
+
+	// The preferred path compiles on a worker thread owning a context shared with the render
+	// context. Where a shared context can't be made current without a surface, the driver's
+	// GL_KHR_parallel_shader_compile is polled instead; failing both, the reload is compiled
+	// synchronously at the next frame boundary.
+	enum ASYNCRELOADMODE
+	{
+		ASYNCRELOAD_SYNC = 0,
+		ASYNCRELOAD_THREAD,
+		ASYNCRELOAD_PARALLEL,
+	};
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+	typedef void (*PFNMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+	struct ShaderReload
+	{
+		ShaderReloadCallback callback;
+		void * pUserData;
+		std::string sCode;
+		int nRequest;
+		GLuint program;
+		GLuint shader;             // parallel compile: kept for its log until the link completes
+		unsigned long long key;    // parallel compile: the program cache key
+		bool bFinished;
+		bool bSuccess;
+		char szError[4096];
+	};
+
+	ASYNCRELOADMODE asyncReloadMode = ASYNCRELOAD_SYNC;
+	bool bAsyncReloadInitialized = false;
+	bool bAsyncReloadPending = false;
+	ShaderReload asyncReload;
+	pthread_t compileThread;
+	pthread_mutex_t compileMutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t compileCondition = PTHREAD_COND_INITIALIZER;
+	EGLContext s_compileContext = EGL_NO_CONTEXT;
+	bool bCompileThreadQuit = false;
+	int nCompileThreadState = 0; // 0 = starting, 1 = running, -1 = no usable context
+
+	static void * CompileThreadMain(void *)
+	{
+		pthread_mutex_lock(&compileMutex);
+		// Surfaceless: relies on EGL_KHR_surfaceless_context, which Mesa exposes everywhere
+		nCompileThreadState = eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, s_compileContext) == EGL_TRUE ? 1 : -1;
+		pthread_cond_broadcast(&compileCondition);
+		if (nCompileThreadState < 0)
+		{
+			pthread_mutex_unlock(&compileMutex);
+			return NULL;
+		}
+
+		int nServed = 0;
+		for (;;)
+		{
+			while (!bCompileThreadQuit && asyncReload.nRequest == nServed)
+				pthread_cond_wait(&compileCondition, &compileMutex);
+			if (bCompileThreadQuit)
+				break;
+
+			nServed = asyncReload.nRequest;
+			std::string sCode = asyncReload.sCode;
+			pthread_mutex_unlock(&compileMutex);
+
+			char szError[4096] = { 0 };
+			GLuint prg = CompileUserProgram(&sCode[0], sCode.size(), szError, sizeof(szError));
+			// The render context only sees a finished program once our commands have completed
+			glFinish();
+
+			pthread_mutex_lock(&compileMutex);
+			if (nServed == asyncReload.nRequest)
+			{
+				asyncReload.program = prg;
+				asyncReload.bSuccess = prg != 0;
+				memcpy(asyncReload.szError, szError, sizeof(szError));
+				asyncReload.bFinished = true;
+			}
+			else if (prg)
+			{
+				// Superseded while compiling
+				glDeleteProgram(prg);
+			}
+		}
+
+		eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		pthread_mutex_unlock(&compileMutex);
+		return NULL;
+	}
+
+	static void InitAsyncReload()
+	{
+		bAsyncReloadInitialized = true;
+		asyncReload.nRequest = 0;
+		asyncReload.program = 0;
+		asyncReload.shader = 0;
+		asyncReload.bFinished = false;
+
+		s_compileContext = eglCreateContext(s_display, s_config, s_context, contextAttributeList);
+		if (s_compileContext != EGL_NO_CONTEXT)
+		{
+			bCompileThreadQuit = false;
+			nCompileThreadState = 0;
+			if (pthread_create(&compileThread, NULL, CompileThreadMain, NULL) == 0)
+			{
+				pthread_mutex_lock(&compileMutex);
+				while (nCompileThreadState == 0)
+					pthread_cond_wait(&compileCondition, &compileMutex);
+				pthread_mutex_unlock(&compileMutex);
+
+				if (nCompileThreadState > 0)
+				{
+					asyncReloadMode = ASYNCRELOAD_THREAD;
+					printf("[Renderer] Shader reloads compile on a worker thread\n");
+					return;
+				}
+				pthread_join(compileThread, NULL);
+			}
+			eglDestroyContext(s_display, s_compileContext);
+			s_compileContext = EGL_NO_CONTEXT;
+		}
+
+		PFNMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSKHRPROC)eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (maxShaderCompilerThreads && HasExtension("GL_KHR_parallel_shader_compile"))
+		{
+			maxShaderCompilerThreads(0xFFFFFFFF);
+			asyncReloadMode = ASYNCRELOAD_PARALLEL;
+			printf("[Renderer] Shader reloads use GL_KHR_parallel_shader_compile\n");
+			return;
+		}
+
+		asyncReloadMode = ASYNCRELOAD_SYNC;
+		printf("[Renderer] No shared context or parallel compile support; shader reloads are synchronous\n");
+	}
+
+	static void DeinitAsyncReload()
+	{
+		if (asyncReloadMode == ASYNCRELOAD_THREAD)
+		{
+			pthread_mutex_lock(&compileMutex);
+			bCompileThreadQuit = true;
+			pthread_cond_broadcast(&compileCondition);
+			pthread_mutex_unlock(&compileMutex);
+			pthread_join(compileThread, NULL);
+			eglDestroyContext(s_display, s_compileContext);
+			s_compileContext = EGL_NO_CONTEXT;
+		}
+		if (asyncReload.program)
+			glDeleteProgram(asyncReload.program);
+		if (asyncReload.shader)
+			glDeleteShader(asyncReload.shader);
+		asyncReload.program = 0;
+		asyncReload.shader = 0;
+		bAsyncReloadPending = false;
+		bAsyncReloadInitialized = false;
+		asyncReloadMode = ASYNCRELOAD_SYNC;
+	}
+
+	void ReloadShaderAsync(const char * szShaderCode, int nShaderCodeSize, ShaderReloadCallback callback, void * pUserData)
+	{
+		if (!bAsyncReloadInitialized)
+			InitAsyncReload();
+
+		if (asyncReloadMode == ASYNCRELOAD_THREAD)
+			pthread_mutex_lock(&compileMutex);
+
+		if (asyncReload.program)
+		{
+			glDeleteProgram(asyncReload.program);
+			asyncReload.program = 0;
+		}
+		if (asyncReload.shader)
+		{
+			glDeleteShader(asyncReload.shader);
+			asyncReload.shader = 0;
+		}
+		asyncReload.callback = callback;
+		asyncReload.pUserData = pUserData;
+		asyncReload.sCode.assign(szShaderCode, nShaderCodeSize);
+		asyncReload.nRequest++;
+		asyncReload.bFinished = false;
+		asyncReload.bSuccess = false;
+		asyncReload.szError[0] = 0;
+		bAsyncReloadPending = true;
+
+		if (asyncReloadMode == ASYNCRELOAD_THREAD)
+		{
+			pthread_cond_broadcast(&compileCondition);
+			pthread_mutex_unlock(&compileMutex);
+		}
+		else if (asyncReloadMode == ASYNCRELOAD_PARALLEL)
+		{
+			// Issue compile and link now and poll for completion; the driver works in the
+			// background. The program cache is keyed and filled as in LinkProgram; a hit is
+			// complete already.
+			std::string sShaderCode = InjectShaderPrologue(&asyncReload.sCode[0], asyncReload.sCode.size());
+			const char * sources[2] = { szFullscreenVertexShader, sShaderCode.c_str() };
+			int sourceSizes[2] = { (int)strlen(szFullscreenVertexShader), (int)sShaderCode.size() };
+			asyncReload.key = ProgramCache::MakeKey(sources, sourceSizes, 2);
+			asyncReload.program = ProgramCache::Load(asyncReload.key);
+			if (asyncReload.program)
+				return;
+
+			asyncReload.shader = glCreateShader(GL_FRAGMENT_SHADER);
+			glShaderSource(asyncReload.shader, 1, (const GLchar**)&sources[1], &sourceSizes[1]);
+			glCompileShader(asyncReload.shader);
+			asyncReload.program = glCreateProgram();
+			ProgramCache::PrepareProgram(asyncReload.program);
+			glAttachShader(asyncReload.program, glhVertexShader);
+			glAttachShader(asyncReload.program, asyncReload.shader);
+			glLinkProgram(asyncReload.program);
+			glDetachShader(asyncReload.program, asyncReload.shader);
+		}
+	}
+
+	bool IsShaderReloadPending()
+	{
+		return bAsyncReloadPending;
+	}
+
+	// Called at the start of every frame: swaps in a finished program and reports the result
+	static void PollShaderReload()
+	{
+		if (!bAsyncReloadPending)
+			return;
+
+		switch (asyncReloadMode)
+		{
+		case ASYNCRELOAD_THREAD:
+			pthread_mutex_lock(&compileMutex);
+			if (!asyncReload.bFinished)
+			{
+				pthread_mutex_unlock(&compileMutex);
+				return;
+			}
+			pthread_mutex_unlock(&compileMutex);
+			break;
+		case ASYNCRELOAD_PARALLEL:
+			{
+				GLint result = 0;
+				glGetProgramiv(asyncReload.program, GL_COMPLETION_STATUS_KHR, &result);
+				if (!result)
+					return;
+
+				// The compiler's log, with its line numbers, goes ahead of the link log, as in
+				// LinkProgram; a shader that didn't compile only adds noise at the link. A
+				// program from the cache has no shader and no log.
+				GLint nSize = 0;
+				bool bBuilt = asyncReload.shader != 0;
+				if (bBuilt)
+				{
+					glGetShaderInfoLog(asyncReload.shader, sizeof(asyncReload.szError), &nSize, asyncReload.szError);
+					glGetShaderiv(asyncReload.shader, GL_COMPILE_STATUS, &result);
+					glDeleteShader(asyncReload.shader);
+					asyncReload.shader = 0;
+				}
+				if (result)
+				{
+					glGetProgramInfoLog(asyncReload.program, sizeof(asyncReload.szError) - nSize, NULL, asyncReload.szError + nSize);
+					glGetProgramiv(asyncReload.program, GL_LINK_STATUS, &result);
+				}
+				if (result && bBuilt)
+					ProgramCache::Store(asyncReload.key, asyncReload.program);
+				asyncReload.bSuccess = result != 0;
+				if (!result)
+				{
+					glDeleteProgram(asyncReload.program);
+					asyncReload.program = 0;
+				}
+			}
+			break;
+		case ASYNCRELOAD_SYNC:
+			asyncReload.program = CompileUserProgram(&asyncReload.sCode[0], asyncReload.sCode.size(), asyncReload.szError, sizeof(asyncReload.szError));
+			asyncReload.bSuccess = asyncReload.program != 0;
+			break;
+		}
+
+		// Nothing else touches the reload state until the next request, which comes from this thread
+		bAsyncReloadPending = false;
+		if (asyncReload.bSuccess)
+		{
+			SwapMainShader(asyncReload.program);
+			asyncReload.program = 0;
+		}
+		if (asyncReload.callback)
+			asyncReload.callback(asyncReload.bSuccess, asyncReload.szError, asyncReload.pUserData);
+	}
+
+	void SetShaderConstant(std::string szConstName, float x)
+	{
+		GLint location = glGetUniformLocation(theShader, szConstName.c_str());
+		if (location != -1)
+		{
+			glProgramUniform1f(theShader, location, x);
+		}
+	}
+
+	void SetShaderConstant(std::string szConstName, float x, float y)
+	{
+		GLint location = glGetUniformLocation(theShader, szConstName.c_str());
+		if (location != -1)
+		{
+			glProgramUniform2f(theShader, location, x, y);
+		}
+	}
+
+	void SetShaderConstant(UniformHandle hUniform, float x)
+	{
+		for (size_t i = 0; i < GetUniformTableCount(); i++)
+		{
+			const UniformTable & table = GetUniformTable(i);
+			GLint location = table.locations[hUniform];
+			if (location != -1)
+			{
+				glProgramUniform1f(table.program, location, x);
+			}
+		}
+	}
+
+	void SetShaderConstant(UniformHandle hUniform, float x, float y)
+	{
+		for (size_t i = 0; i < GetUniformTableCount(); i++)
+		{
+			const UniformTable & table = GetUniformTable(i);
+			GLint location = table.locations[hUniform];
+			if (location != -1)
+			{
+				glProgramUniform2f(table.program, location, x, y);
+			}
+		}
+	}
+
+	struct GLTexture : public Texture
+	{
+		GLuint ID;
+		int unit;
+		bool bAtlas;
+		bool bDistanceField;
+		int atlasX, atlasY; // texels, for images in the GUI atlas
+	};
+
+	// User textures take units up from 0; the GUI atlas's unit and the render graph's above
+	// it are the renderer's, so the textures stop short of them
+	static const int nAtlasUnit = nGraphTextureUnitBase - 1;
+	int textureUnit = 0;
+	Texture * CreateRGBA8TextureFromFile(char * szFilename)
+	{
+		if (textureUnit >= nAtlasUnit)
+		{
+			printf("[Renderer] Out of texture units for %s; at most %d textures\n", szFilename, nAtlasUnit);
+			return NULL;
+		}
 
-	int textureUnit = 0;
-	Texture * CreateRGBA8TextureFromFile(char * szFilename)
-	{
 		int comp = 0;
 		int width = 0;
 		int height = 0;
@@ -561,181 +2307,734 @@ namespace Renderer
 
 	Texture * Create1DR32Texture(int w)
 	{
+		if (textureUnit >= nAtlasUnit)
+		{
+			printf("[Renderer] Out of texture units; at most %d textures\n", nAtlasUnit);
+			return NULL;
+		}
+
 		GLuint glTexId = 0;
 		glGenTextures(1, &glTexId);
 		glBindTexture(GL_TEXTURE_1D, glTexId);
 
-		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		float * data = new float[w];
+		for (int i = 0; i < w; ++i)
+			data[i] = 0.0f;
+
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_R32F, w, 0, GL_RED, GL_FLOAT, data);
+
+		delete[] data;
+
+		glBindTexture(GL_TEXTURE_1D, 0);
+
+		GLTexture * tex = new GLTexture();
+		tex->width = w;
+		tex->height = 1;
+		tex->ID = glTexId;
+		tex->type = TEXTURETYPE_1D;
+		tex->unit = textureUnit++;
+		return tex;
+	}
+
+	void SetShaderTexture(std::string szTextureName, Texture * tex)
+	{
+		if (!tex)
+			return;
+
+		GLint location = glGetUniformLocation(theShader, szTextureName.c_str());
+		if (location != -1)
+		{
+			glProgramUniform1i(theShader, location, ((GLTexture*)tex)->unit);
+			glActiveTexture(GL_TEXTURE0 + ((GLTexture*)tex)->unit);
+			switch (tex->type)
+			{
+			case TEXTURETYPE_1D: glBindTexture(GL_TEXTURE_1D, ((GLTexture*)tex)->ID); break;
+			case TEXTURETYPE_2D: glBindTexture(GL_TEXTURE_2D, ((GLTexture*)tex)->ID); break;
+			}
+		}
+	}
+
+	void SetShaderTexture(UniformHandle hUniform, Texture * tex)
+	{
+		if (!tex)
+			return;
+
+		bool bUsed = false;
+		int unit = ((GLTexture*)tex)->unit;
+		for (size_t i = 0; i < GetUniformTableCount(); i++)
+		{
+			UniformTable & table = GetUniformTable(i);
+			GLint location = table.locations[hUniform];
+			if (location != -1)
+			{
+				if (table.samplerUnits[hUniform] != unit)
+				{
+					glProgramUniform1i(table.program, location, unit);
+					table.samplerUnits[hUniform] = unit;
+				}
+				bUsed = true;
+			}
+		}
+		if (bUsed)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			switch (tex->type)
+			{
+			case TEXTURETYPE_1D: glBindTexture(GL_TEXTURE_1D, ((GLTexture*)tex)->ID); break;
+			case TEXTURETYPE_2D: glBindTexture(GL_TEXTURE_2D, ((GLTexture*)tex)->ID); break;
+			}
+		}
+	}
+
+	bool UpdateR32Texture(Texture * tex, float * data)
+	{
+		glActiveTexture(GL_TEXTURE0 + ((GLTexture*)tex)->unit);
+		glBindTexture(GL_TEXTURE_1D, ((GLTexture*)tex)->ID);
+		glTexSubImage1D(GL_TEXTURE_1D, 0, 0, tex->width, GL_RED, GL_FLOAT, data);
+
+		return true;
+	}
+
+	Texture * CreateA8TextureFromData(int w, int h, unsigned char * data)
+	{
+		GLuint glTexId = 0;
+		glGenTextures(1, &glTexId);
+		glBindTexture(GL_TEXTURE_2D, glTexId);
+		unsigned int * p32bitData = new unsigned int[w * h];
+		for (int i = 0; i<w*h; i++) p32bitData[i] = (data[i] << 24) | 0xFFFFFF;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, p32bitData);
+		delete[] p32bitData;
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		GLTexture * tex = new GLTexture();
+		tex->width = w;
+		tex->height = h;
+		tex->ID = glTexId;
+		tex->type = TEXTURETYPE_2D;
+		tex->unit = 0; // this is always 0 cos we're not using shaders here
+		return tex;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// GUI atlas
+
+	// Images are kept one texel apart, with their edge texels repeated into the gap so
+	// bilinear filtering at the borders doesn't pick up the neighbours. A CPU copy of the
+	// atlas is kept so it can be repacked: when an image doesn't fit, the live images are
+	// packed again from scratch (reclaiming the space of released ones), and if that
+	// still fails the atlas doubles in size. The atlas has a unit of its own, just below
+	// the render graph's, which the user shader's textures (numbered up from 0) and the
+	// renderer's passes leave alone.
+	static const int nAtlasPadding = 1;
+	static const int nAtlasInitialSize = 512;
+	GLuint glhAtlas = 0;
+	std::vector<unsigned int> atlasPixels;
+	AtlasPacker atlasPacker;
+	std::vector<GLTexture *> atlasImages;
+	int nAtlasReleasedArea = 0;
+	extern Texture * lastTexture;
+	extern GLuint nGUITextureID;
+	void __FlushRenderCache();
+
+	static int PaddedAtlasSize(int n)
+	{
+		return n + nAtlasPadding * 2;
+	}
+
+	// Copies a w x h image to (x, y) in the atlas copy, extruding it into the padding
+	static void WriteAtlasImage(std::vector<unsigned int> & pixels, int nAtlasWidth, int x, int y, int w, int h, const unsigned int * pSource, int nSourceStride)
+	{
+		for (int j = -nAtlasPadding; j < h + nAtlasPadding; j++)
+		{
+			int sy = j < 0 ? 0 : (j >= h ? h - 1 : j);
+			unsigned int * pDest = &pixels[(y + j) * nAtlasWidth + x];
+			const unsigned int * pRow = pSource + sy * nSourceStride;
+			for (int i = -nAtlasPadding; i < w + nAtlasPadding; i++)
+				pDest[i] = pRow[i < 0 ? 0 : (i >= w ? w - 1 : i)];
+		}
+	}
+
+	static bool GreaterHeight(const GLTexture * a, const GLTexture * b)
+	{
+		return a->height > b->height;
+	}
+
+	// Packs all live images into a w x h atlas; on success the CPU copy is rebuilt, the
+	// texture is re-uploaded and the images' positions updated
+	static bool RepackAtlas(int w, int h)
+	{
+		std::vector<GLTexture *> order = atlasImages;
+		std::stable_sort(order.begin(), order.end(), GreaterHeight);
+
+		AtlasPacker packer;
+		packer.Reset(w, h);
+		std::vector<int> positions(order.size() * 2);
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			if (!packer.Add(PaddedAtlasSize(order[i]->width), PaddedAtlasSize(order[i]->height), &positions[i * 2], &positions[i * 2 + 1]))
+				return false;
+		}
+
+		// Anything already batched was written with the old positions
+		__FlushRenderCache();
+
+		std::vector<unsigned int> pixels(w * h, 0);
+		int nOldWidth = atlasPacker.GetWidth();
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			GLTexture * image = order[i];
+			const unsigned int * pSource = &atlasPixels[image->atlasY * nOldWidth + image->atlasX];
+			image->atlasX = positions[i * 2] + nAtlasPadding;
+			image->atlasY = positions[i * 2 + 1] + nAtlasPadding;
+			if (image->bAtlas) // not the image being made room for
+				WriteAtlasImage(pixels, w, image->atlasX, image->atlasY, image->width, image->height, pSource, nOldWidth);
+		}
+		atlasPixels.swap(pixels);
+		atlasPacker = packer;
+		nAtlasReleasedArea = 0;
+
+		ScopedTextureBindings bindings;
+		bindings.Bind(nAtlasUnit, glhAtlas);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, &atlasPixels[0]);
+		printf("[Renderer] GUI atlas repacked at %dx%d, %d images\n", w, h, (int)atlasImages.size());
+		return true;
+	}
+
+	static Texture * CreateAtlasTexture(int w, int h, const unsigned int * pSource)
+	{
+		// Textures created later (the user's, loaded after the text renderer made the atlas)
+		// bind on the active unit, which mustn't be left on the atlas's
+		bool bCreated = !glhAtlas;
+		if (bCreated)
+			glGenTextures(1, &glhAtlas);
+		ScopedTextureBindings bindings;
+		bindings.Bind(nAtlasUnit, glhAtlas);
+		if (bCreated)
+		{
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			atlasPacker.Reset(nAtlasInitialSize, nAtlasInitialSize);
+			atlasPixels.assign(nAtlasInitialSize * nAtlasInitialSize, 0);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, nAtlasInitialSize, nAtlasInitialSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, &atlasPixels[0]);
+		}
+
+		int x = 0;
+		int y = 0;
+		if (!atlasPacker.Add(PaddedAtlasSize(w), PaddedAtlasSize(h), &x, &y))
+		{
+			GLint nMaxSize = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_SIZE, &nMaxSize);
+
+			// Make room by repacking, growing until the live images plus this one fit
+			GLTexture placeholder;
+			placeholder.width = w;
+			placeholder.height = h;
+			placeholder.bAtlas = false;
+			placeholder.atlasX = 0;
+			placeholder.atlasY = 0;
+			atlasImages.push_back(&placeholder);
+			int nAtlasWidth = atlasPacker.GetWidth();
+			int nAtlasHeight = atlasPacker.GetHeight();
+			bool bPacked = nAtlasReleasedArea > 0 && RepackAtlas(nAtlasWidth, nAtlasHeight);
+			while (!bPacked)
+			{
+				if (nAtlasWidth <= nAtlasHeight)
+					nAtlasWidth *= 2;
+				else
+					nAtlasHeight *= 2;
+				if (nAtlasWidth > nMaxSize || nAtlasHeight > nMaxSize)
+					break;
+				bPacked = RepackAtlas(nAtlasWidth, nAtlasHeight);
+			}
+			atlasImages.pop_back();
+			if (!bPacked)
+			{
+				printf("[Renderer] GUI atlas is full, can't add a %dx%d image\n", w, h);
+				return NULL;
+			}
+			x = placeholder.atlasX - nAtlasPadding;
+			y = placeholder.atlasY - nAtlasPadding;
+		}
+
+		GLTexture * tex = new GLTexture();
+		tex->width = w;
+		tex->height = h;
+		tex->ID = glhAtlas;
+		tex->type = TEXTURETYPE_2D;
+		tex->unit = nAtlasUnit;
+		tex->bAtlas = true;
+		tex->atlasX = x + nAtlasPadding;
+		tex->atlasY = y + nAtlasPadding;
+		atlasImages.push_back(tex);
+
+		int nAtlasWidth = atlasPacker.GetWidth();
+		WriteAtlasImage(atlasPixels, nAtlasWidth, tex->atlasX, tex->atlasY, w, h, pSource, w);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, nAtlasWidth);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, PaddedAtlasSize(w), PaddedAtlasSize(h), GL_RGBA, GL_UNSIGNED_BYTE, &atlasPixels[y * nAtlasWidth + x]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		return tex;
+	}
+
+	Texture * CreateAtlasRGBA8TextureFromData(int w, int h, const unsigned char * data)
+	{
+		return CreateAtlasTexture(w, h, (const unsigned int *)data);
+	}
 
-		float * data = new float[w];
-		for (int i = 0; i < w; ++i)
-			data[i] = 0.0f;
+	Texture * CreateAtlasA8TextureFromData(int w, int h, const unsigned char * data, bool bDistanceField)
+	{
+		std::vector<unsigned int> pixels(w * h);
+		for (int i = 0; i < w * h; i++) pixels[i] = (data[i] << 24) | 0xFFFFFF;
+		Texture * tex = CreateAtlasTexture(w, h, &pixels[0]);
+		if (tex)
+			((GLTexture*)tex)->bDistanceField = bDistanceField;
+		return tex;
+	}
 
-		glTexImage1D(GL_TEXTURE_1D, 0, GL_R32F, w, 0, GL_RED, GL_FLOAT, data);
+	bool UpdateAtlasA8Texture(Texture * tex, int x, int y, int w, int h, const unsigned char * data)
+	{
+		GLTexture * image = (GLTexture*)tex;
+		if (!image || !image->bAtlas || x < 0 || y < 0 || x + w > image->width || y + h > image->height)
+			return false;
 
-		delete[] data;
+		// Whatever is batched may still use the old contents
+		__FlushRenderCache();
 
-		glBindTexture(GL_TEXTURE_1D, 0);
+		int nAtlasWidth = atlasPacker.GetWidth();
+		int nLeft = image->atlasX + x;
+		int nTop = image->atlasY + y;
+		for (int j = 0; j < h; j++)
+		{
+			unsigned int * pDest = &atlasPixels[(nTop + j) * nAtlasWidth + nLeft];
+			for (int i = 0; i < w; i++)
+				pDest[i] = (data[j * w + i] << 24) | 0xFFFFFF;
+		}
+		ScopedTextureBindings bindings;
+		bindings.Bind(nAtlasUnit, glhAtlas);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, nAtlasWidth);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, nLeft, nTop, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &atlasPixels[nTop * nAtlasWidth + nLeft]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		return true;
+	}
 
-		GLTexture * tex = new GLTexture();
-		tex->width = w;
-		tex->height = 1;
-		tex->ID = glTexId;
-		tex->type = TEXTURETYPE_1D;
-		tex->unit = textureUnit++;
-		return tex;
+	static void ReleaseAtlasTexture(GLTexture * tex)
+	{
+		for (size_t i = 0; i < atlasImages.size(); i++)
+		{
+			if (atlasImages[i] == tex)
+			{
+				atlasImages.erase(atlasImages.begin() + i);
+				break;
+			}
+		}
+		nAtlasReleasedArea += PaddedAtlasSize(tex->width) * PaddedAtlasSize(tex->height);
 	}
 
-	void SetShaderTexture(std::string szTextureName, Texture * tex)
+	void ReleaseTexture(Texture * tex)
 	{
 		if (!tex)
 			return;
 
-		GLint location = glGetUniformLocation(theShader, szTextureName.c_str());
-		if (location != -1)
+		if (lastTexture == tex)
+			lastTexture = NULL;
+		if (((GLTexture*)tex)->bAtlas)
 		{
-			glProgramUniform1i(theShader, location, ((GLTexture*)tex)->unit);
-			glActiveTexture(GL_TEXTURE0 + ((GLTexture*)tex)->unit);
-			switch (tex->type)
-			{
-			case TEXTURETYPE_1D: glBindTexture(GL_TEXTURE_1D, ((GLTexture*)tex)->ID); break;
-			case TEXTURETYPE_2D: glBindTexture(GL_TEXTURE_2D, ((GLTexture*)tex)->ID); break;
-			}
+			ReleaseAtlasTexture((GLTexture*)tex);
+		}
+		else
+		{
+			if (nGUITextureID == ((GLTexture*)tex)->ID)
+				nGUITextureID = 0;
+			glDeleteTextures(1, &((GLTexture*)tex)->ID);
 		}
+		delete (GLTexture*)tex;
 	}
 
-	bool UpdateR32Texture(Texture * tex, float * data)
+	//////////////////////////////////////////////////////////////////////////
+	// text rendering
+
+	int nDrawCallCount = 0;
+	Texture * lastTexture = NULL;
+	GLuint nGUITextureID = 0;
+	int nGUITextureUnit = -1;
+
+	// GUI geometry streams through a ring of regions. Rectangles and line segments go
+	// into an instance buffer, one compact record each, so they batch together; anything
+	// else (quads that are not axis aligned, lines out of range) goes into a vertex
+	// buffer. Both buffers are written straight through a persistent, coherent mapping
+	// and each flush draws what was added since the previous flush. When either stream
+	// fills its region, and at the end of every frame, the region is fenced and the next
+	// one is used, after waiting for its fence if the GPU is still reading it. Without
+	// ARB_buffer_storage the data is staged in memory and uploaded per flush with
+	// glBufferSubData into the same ring.
+	struct GUIQuadInstance
 	{
-		glActiveTexture(GL_TEXTURE0 + ((GLTexture*)tex)->unit);
-		glBindTexture(GL_TEXTURE_1D, ((GLTexture*)tex)->ID);
-		glTexSubImage1D(GL_TEXTURE_1D, 0, 0, tex->width, GL_RED, GL_FLOAT, data);
+		short x, y, w, h; // quarter pixels; for lines, both end points
+		unsigned short u0, v0, u1, v1; // unorm16; for lines, u0 and v0 hold the end colour
+		unsigned int c;
+		unsigned char factor; // 255 for untextured
+		unsigned char sdf; // 255 for distance field images
+		unsigned char width; // quarter pixels, 0 for rectangles
+		unsigned char pad;
+	};
+	static const int nGUIVertexSize = sizeof(float) * 7;
+	static const int nGUIQuadInstanceSize = sizeof(GUIQuadInstance);
+	static const int nGUIRegionQuads = GUIQUADVB_SIZE / 6;
+	static const int nGUIRingRegions = 3;
+	static const int nGUIRegionSize = GUIQUADVB_SIZE * nGUIVertexSize;
+	static const int nGUIQuadRegionSize = nGUIRegionQuads * nGUIQuadInstanceSize;
+	enum GUIBATCH
+	{
+		GUIBATCH_INSTANCES,
+		GUIBATCH_TRIANGLES,
+		GUIBATCH_LINES,
+	};
+	unsigned char * pGUIRing = NULL;
+	unsigned char * pGUIQuadRing = NULL;
+	unsigned char buffer[nGUIRegionSize];
+	unsigned char quadBuffer[nGUIQuadRegionSize];
+	GLsync guiRegionFences[nGUIRingRegions] = { 0 };
+	int nGUIRegion = 0;
+	int nGUIBatchStart = 0;
+	int bufferPointer = 0;
+	int quadBufferPointer = 0;
+	GUIBATCH guiBatchMode = GUIBATCH_INSTANCES;
+	PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC drawArraysInstancedBaseInstance = NULL;
 
-		return true;
+	static unsigned char * CreateGUIRingBuffer(GLuint * pBuffer, GLsizeiptr nSize)
+	{
+		glGenBuffers(1, pBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, *pBuffer);
+
+		PFNGLBUFFERSTORAGEPROC bufferStorage = (PFNGLBUFFERSTORAGEPROC)eglGetProcAddress("glBufferStorage");
+		if (bufferStorage && HasExtension("GL_ARB_buffer_storage"))
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			bufferStorage(GL_ARRAY_BUFFER, nSize, NULL, flags);
+			unsigned char * pMapping = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, nSize, flags);
+			if (pMapping)
+				return pMapping;
+		}
+		glBufferData(GL_ARRAY_BUFFER, nSize, NULL, GL_STREAM_DRAW);
+		return NULL;
 	}
 
-	Texture * CreateA8TextureFromData(int w, int h, unsigned char * data)
+	// Without base instances (GL 4.2) the instance attributes are pointed at the batch instead
+	static void SetGUIQuadAttributes(GLintptr nOffset)
 	{
-		GLuint glTexId = 0;
-		glGenTextures(1, &glTexId);
-		glBindTexture(GL_TEXTURE_2D, glTexId);
-		unsigned int * p32bitData = new unsigned int[w * h];
-		for (int i = 0; i<w*h; i++) p32bitData[i] = (data[i] << 24) | 0xFFFFFF;
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, p32bitData);
-		delete[] p32bitData;
+		GLint rect = glGetAttribLocation(glhGUIQuadProgram, "in_rect");
+		GLint uvrect = glGetAttribLocation(glhGUIQuadProgram, "in_uvrect");
+		GLint color = glGetAttribLocation(glhGUIQuadProgram, "in_color");
+		GLint factor = glGetAttribLocation(glhGUIQuadProgram, "in_factor");
+		GLint sdf = glGetAttribLocation(glhGUIQuadProgram, "in_sdf");
+		GLint width = glGetAttribLocation(glhGUIQuadProgram, "in_width");
+		glVertexAttribPointer(rect, 4, GL_SHORT, GL_FALSE, nGUIQuadInstanceSize, (GLvoid*)(nOffset + offsetof(GUIQuadInstance, x)));
+		glVertexAttribPointer(uvrect, 4, GL_UNSIGNED_SHORT, GL_TRUE, nGUIQuadInstanceSize, (GLvoid*)(nOffset + offsetof(GUIQuadInstance, u0)));
+		glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, nGUIQuadInstanceSize, (GLvoid*)(nOffset + offsetof(GUIQuadInstance, c)));
+		glVertexAttribPointer(factor, 1, GL_UNSIGNED_BYTE, GL_TRUE, nGUIQuadInstanceSize, (GLvoid*)(nOffset + offsetof(GUIQuadInstance, factor)));
+		glVertexAttribPointer(sdf, 1, GL_UNSIGNED_BYTE, GL_TRUE, nGUIQuadInstanceSize, (GLvoid*)(nOffset + offsetof(GUIQuadInstance, sdf)));
+		glVertexAttribPointer(width, 1, GL_UNSIGNED_BYTE, GL_FALSE, nGUIQuadInstanceSize, (GLvoid*)(nOffset + offsetof(GUIQuadInstance, width)));
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	static bool InitGUIRing()
+	{
+		glGenVertexArrays(1, &glhGUIVA);
+		glBindVertexArray(glhGUIVA);
+		pGUIRing = CreateGUIRingBuffer(&glhGUIVB, nGUIRegionSize * nGUIRingRegions);
+
+		// The vertex layouts never change, so the VAOs are set up once
+		GLint position = glGetAttribLocation(glhGUIProgram, "in_pos");
+		GLint sdf = glGetAttribLocation(glhGUIProgram, "in_sdf");
+		GLint color = glGetAttribLocation(glhGUIProgram, "in_color");
+		GLint texcoord = glGetAttribLocation(glhGUIProgram, "in_texcoord");
+		GLint factor = glGetAttribLocation(glhGUIProgram, "in_factor");
+		if (position < 0 || sdf < 0 || color < 0 || texcoord < 0 || factor < 0)
+		{
+			printf("[Renderer] GUI program is missing vertex attributes\n");
+			return false;
+		}
+		glVertexAttribPointer(position, 2, GL_FLOAT, GL_FALSE, nGUIVertexSize, (GLvoid*)(0 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(position);
+		glVertexAttribPointer(sdf, 1, GL_FLOAT, GL_FALSE, nGUIVertexSize, (GLvoid*)(2 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(sdf);
+		glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, nGUIVertexSize, (GLvoid*)(3 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(color);
+		glVertexAttribPointer(texcoord, 2, GL_FLOAT, GL_FALSE, nGUIVertexSize, (GLvoid*)(4 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(texcoord);
+		glVertexAttribPointer(factor, 1, GL_FLOAT, GL_FALSE, nGUIVertexSize, (GLvoid*)(6 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(factor);
 
-		GLTexture * tex = new GLTexture();
-		tex->width = w;
-		tex->height = h;
-		tex->ID = glTexId;
-		tex->type = TEXTURETYPE_2D;
-		tex->unit = 0; // this is always 0 cos we're not using shaders here
-		return tex;
+		glGenVertexArrays(1, &glhGUIQuadVA);
+		glBindVertexArray(glhGUIQuadVA);
+		pGUIQuadRing = CreateGUIRingBuffer(&glhGUIQuadVB, nGUIQuadRegionSize * nGUIRingRegions);
+		const char * szQuadAttributes[] = { "in_rect", "in_uvrect", "in_color", "in_factor", "in_sdf", "in_width" };
+		for (int i = 0; i < 6; i++)
+		{
+			GLint location = glGetAttribLocation(glhGUIQuadProgram, szQuadAttributes[i]);
+			if (location < 0)
+			{
+				printf("[Renderer] GUI quad program is missing vertex attributes\n");
+				return false;
+			}
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+		}
+		SetGUIQuadAttributes(0);
+
+		if (HasExtension("GL_ARB_base_instance"))
+			drawArraysInstancedBaseInstance = (PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC)eglGetProcAddress("glDrawArraysInstancedBaseInstance");
+
+		if (!pGUIRing || !pGUIQuadRing)
+			printf("[Renderer] No persistent buffer mapping; GUI vertices are uploaded per batch\n");
+
+		glBindVertexArray(0);
+		return true;
 	}
 
-	//////////////////////////////////////////////////////////////////////////
-	// text rendering
+	// The projection only changes with the output resolution
+	int nGUIProjectionWidth = 0;
+	int nGUIProjectionHeight = 0;
 
-	int nDrawCallCount = 0;
-	Texture * lastTexture = NULL;
 	void StartTextRendering()
 	{
-		glUseProgram(glhGUIProgram);
-		glBindVertexArray(glhGUIVA);
+		if (nGUIProjectionWidth != nWidth || nGUIProjectionHeight != nHeight)
+		{
+			float pGUIMatrix[16];
+			MatrixOrthoOffCenterLH(pGUIMatrix, 0.0f, (float)nWidth, (float)nHeight, 0.0f, -1.0f, 1.0f);
+			GLuint programs[] = { glhGUIProgram, glhGUIQuadProgram };
+			for (int i = 0; i < 2; i++)
+			{
+				GLint location = glGetUniformLocation(programs[i], "matProj");
+				if (location != -1)
+					glProgramUniformMatrix4fv(programs[i], location, 1, GL_FALSE, pGUIMatrix);
+			}
+			nGUIProjectionWidth = nWidth;
+			nGUIProjectionHeight = nHeight;
+		}
+
+		// Anything may have been bound over the GUI's texture since the last frame
+		lastTexture = NULL;
+		nGUITextureID = 0;
+		nGUITextureUnit = -1;
 
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	}
 
-	int bufferPointer = 0;
-	unsigned char buffer[GUIQUADVB_SIZE * sizeof(float) * 7];
-	bool lastModeIsQuad = true;
 	void __FlushRenderCache()
 	{
-		if (!bufferPointer) return;
-
-		glBindBuffer(GL_ARRAY_BUFFER, glhGUIVB);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 7 * bufferPointer, buffer, GL_DYNAMIC_DRAW);
+		bool bInstances = guiBatchMode == GUIBATCH_INSTANCES;
+		int nCount = (bInstances ? quadBufferPointer : bufferPointer) - nGUIBatchStart;
+		if (!nCount) return;
 
-		GLuint position = glGetAttribLocation(glhGUIProgram, "in_pos");
-		glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 7, (GLvoid*)(0 * sizeof(GLfloat)));
-		glEnableVertexAttribArray(position);
+		Profiler::ScopedMarker guiMarker(hGUIMarker);
+		if (bInstances)
+		{
+			glUseProgram(glhGUIQuadProgram);
+			glBindVertexArray(glhGUIQuadVA);
+			GLintptr nOffset = nGUIRegion * nGUIQuadRegionSize + nGUIBatchStart * nGUIQuadInstanceSize;
+			if (!pGUIQuadRing)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, glhGUIQuadVB);
+				glBufferSubData(GL_ARRAY_BUFFER, nOffset, nCount * nGUIQuadInstanceSize, quadBuffer + nGUIBatchStart * nGUIQuadInstanceSize);
+			}
+			if (drawArraysInstancedBaseInstance)
+			{
+				drawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, nCount, nGUIRegion * nGUIRegionQuads + nGUIBatchStart);
+			}
+			else
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, glhGUIQuadVB);
+				SetGUIQuadAttributes(nOffset);
+				glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, nCount);
+			}
+		}
+		else
+		{
+			glUseProgram(glhGUIProgram);
+			glBindVertexArray(glhGUIVA);
+			if (!pGUIRing)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, glhGUIVB);
+				glBufferSubData(GL_ARRAY_BUFFER, nGUIRegion * nGUIRegionSize + nGUIBatchStart * nGUIVertexSize, nCount * nGUIVertexSize, buffer + nGUIBatchStart * nGUIVertexSize);
+			}
+			glDrawArrays(guiBatchMode == GUIBATCH_LINES ? GL_LINES : GL_TRIANGLES, nGUIRegion * GUIQUADVB_SIZE + nGUIBatchStart, nCount);
+		}
+		nDrawCallCount++;
 
-		GLuint color = glGetAttribLocation(glhGUIProgram, "in_color");
-		glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(float) * 7, (GLvoid*)(3 * sizeof(GLfloat)));
-		glEnableVertexAttribArray(color);
+		nGUIBatchStart = bInstances ? quadBufferPointer : bufferPointer;
+	}
 
-		GLuint texcoord = glGetAttribLocation(glhGUIProgram, "in_texcoord");
-		glVertexAttribPointer(texcoord, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 7, (GLvoid*)(4 * sizeof(GLfloat)));
-		glEnableVertexAttribArray(texcoord);
+	void EndTextRendering()
+	{
+		__FlushRenderCache();
+		glDisable(GL_BLEND);
+	}
 
-		GLuint factor = glGetAttribLocation(glhGUIProgram, "in_factor");
-		glVertexAttribPointer(factor, 1, GL_FLOAT, GL_FALSE, sizeof(float) * 7, (GLvoid*)(6 * sizeof(GLfloat)));
-		glEnableVertexAttribArray(factor);
+	// Moves on to the next ring region once the current one is full or the frame ends
+	static void RetireGUIRegion()
+	{
+		if (!bufferPointer && !quadBufferPointer)
+			return;
 
-		if (lastModeIsQuad)
+		__FlushRenderCache();
+		guiRegionFences[nGUIRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nGUIRegion = (nGUIRegion + 1) % nGUIRingRegions;
+		if (guiRegionFences[nGUIRegion])
 		{
-			glDrawArrays(GL_TRIANGLES, 0, bufferPointer);
+			glClientWaitSync(guiRegionFences[nGUIRegion], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+			glDeleteSync(guiRegionFences[nGUIRegion]);
+			guiRegionFences[nGUIRegion] = 0;
 		}
-		else
+		bufferPointer = 0;
+		quadBufferPointer = 0;
+		nGUIBatchStart = 0;
+	}
+
+	// Switching between the streams or primitive types ends the current batch
+	static void SetGUIBatchMode(GUIBATCH mode)
+	{
+		if (guiBatchMode != mode)
 		{
-			glDrawArrays(GL_LINES, 0, bufferPointer);
+			__FlushRenderCache();
+			guiBatchMode = mode;
+			nGUIBatchStart = mode == GUIBATCH_INSTANCES ? quadBufferPointer : bufferPointer;
 		}
+	}
 
-		bufferPointer = 0;
+	// Primitives never straddle two regions, so check for room before writing one
+	static void ReserveGUIVertices(int nVertices)
+	{
+		if (bufferPointer + nVertices > GUIQUADVB_SIZE)
+			RetireGUIRegion();
 	}
-	void __WriteVertexToBuffer(const Vertex & v)
+
+	static bool IsDistanceFieldBound()
+	{
+		return lastTexture && ((GLTexture*)lastTexture)->bDistanceField;
+	}
+
+	// Maps texture coordinates of the bound texture to where it sits in the atlas
+	static void MapGUITexcoord(float & u, float & v)
 	{
-		if (bufferPointer >= GUIQUADVB_SIZE)
+		GLTexture * tex = (GLTexture*)lastTexture;
+		if (tex && tex->bAtlas)
 		{
-			__FlushRenderCache();
+			u = (tex->atlasX + u * tex->width) / (float)atlasPacker.GetWidth();
+			v = (tex->atlasY + v * tex->height) / (float)atlasPacker.GetHeight();
 		}
+	}
 
-		float * f = (float*)(buffer + bufferPointer * sizeof(float) * 7);
+	void __WriteVertexToBuffer(const Vertex & v)
+	{
+		unsigned char * pRegion = pGUIRing ? pGUIRing + nGUIRegion * nGUIRegionSize : buffer;
+		float * f = (float*)(pRegion + bufferPointer * nGUIVertexSize);
+		float u = v.u;
+		float t = v.v;
+		MapGUITexcoord(u, t);
 		*(f++) = v.x;
 		*(f++) = v.y;
-		*(f++) = 0.0;
+		*(f++) = IsDistanceFieldBound() ? 1.0f : 0.0f;
 		*(unsigned int *)(f++) = v.c;
-		*(f++) = v.u;
-		*(f++) = v.v;
+		*(f++) = u;
+		*(f++) = t;
 		*(f++) = lastTexture ? 0.0f : 1.0f;
 		bufferPointer++;
 	}
+	// Only a change of the underlying GL texture ends the batch; atlas images share one
 	void BindTexture(Texture * tex)
 	{
 		if (lastTexture != tex)
 		{
 			lastTexture = tex;
-			if (tex)
+			GLTexture * glTex = (GLTexture*)tex;
+			if (tex && (glTex->ID != nGUITextureID || glTex->unit != nGUITextureUnit))
 			{
 				__FlushRenderCache();
+				nGUITextureID = glTex->ID;
+				nGUITextureUnit = glTex->unit;
 
-				GLint location = glGetUniformLocation(glhGUIProgram, "tex");
-				if (location != -1)
+				GLuint programs[] = { glhGUIProgram, glhGUIQuadProgram };
+				for (int i = 0; i < 2; i++)
 				{
-					glProgramUniform1i(glhGUIProgram, location, ((GLTexture*)tex)->unit);
-					glActiveTexture(GL_TEXTURE0 + ((GLTexture*)tex)->unit);
-					switch (tex->type)
-					{
-					case TEXTURETYPE_1D: glBindTexture(GL_TEXTURE_1D, ((GLTexture*)tex)->ID); break;
-					case TEXTURETYPE_2D: glBindTexture(GL_TEXTURE_2D, ((GLTexture*)tex)->ID); break;
-					}
+					GLint location = glGetUniformLocation(programs[i], "tex");
+					if (location != -1)
+						glProgramUniform1i(programs[i], location, glTex->unit);
+				}
+				glActiveTexture(GL_TEXTURE0 + glTex->unit);
+				switch (tex->type)
+				{
+				case TEXTURETYPE_1D: glBindTexture(GL_TEXTURE_1D, glTex->ID); break;
+				case TEXTURETYPE_2D: glBindTexture(GL_TEXTURE_2D, glTex->ID); break;
 				}
-
 			}
 		}
 	}
 
+	static bool FitsQuarterPixels(float f)
+	{
+		return f >= -8192.0f && f < 8192.0f;
+	}
+
+	static bool FitsUnorm16(float f)
+	{
+		return f >= 0.0f && f <= 1.0f;
+	}
+
+	static GUIQuadInstance * AddGUIInstance()
+	{
+		SetGUIBatchMode(GUIBATCH_INSTANCES);
+		if (quadBufferPointer + 1 > nGUIRegionQuads)
+			RetireGUIRegion();
+
+		unsigned char * pRegion = pGUIQuadRing ? pGUIQuadRing + nGUIRegion * nGUIQuadRegionSize : quadBuffer;
+		return (GUIQuadInstance *)(pRegion + quadBufferPointer++ * nGUIQuadInstanceSize);
+	}
+
+	void RenderRect(float x, float y, float w, float h, unsigned int c, float u0, float v0, float u1, float v1)
+	{
+		GUIQuadInstance * q = AddGUIInstance();
+		q->x = (short)floorf(x * 4.0f + 0.5f);
+		q->y = (short)floorf(y * 4.0f + 0.5f);
+		q->w = (short)floorf((x + w) * 4.0f + 0.5f) - q->x;
+		q->h = (short)floorf((y + h) * 4.0f + 0.5f) - q->y;
+		MapGUITexcoord(u0, v0);
+		MapGUITexcoord(u1, v1);
+		q->u0 = (unsigned short)(u0 * 65535.0f + 0.5f);
+		q->v0 = (unsigned short)(v0 * 65535.0f + 0.5f);
+		q->u1 = (unsigned short)(u1 * 65535.0f + 0.5f);
+		q->v1 = (unsigned short)(v1 * 65535.0f + 0.5f);
+		q->c = c;
+		q->factor = lastTexture ? 0 : 255;
+		q->sdf = IsDistanceFieldBound() ? 255 : 0;
+		q->width = 0;
+	}
+
+	// Kept for callers that build quads from vertices: the usual axis aligned, single
+	// colour quad (a top left, then clockwise) becomes one instance, anything else is
+	// drawn as two triangles
 	void RenderQuad(const Vertex & a, const Vertex & b, const Vertex & c, const Vertex & d)
 	{
-		if (!lastModeIsQuad)
+		bool bRect = a.y == b.y && b.x == c.x && c.y == d.y && d.x == a.x
+			&& a.c == b.c && a.c == c.c && a.c == d.c
+			&& a.v == b.v && b.u == c.u && c.v == d.v && d.u == a.u
+			&& FitsQuarterPixels(a.x) && FitsQuarterPixels(a.y) && FitsQuarterPixels(c.x) && FitsQuarterPixels(c.y)
+			&& FitsQuarterPixels(c.x - a.x) && FitsQuarterPixels(c.y - a.y)
+			&& FitsUnorm16(a.u) && FitsUnorm16(a.v) && FitsUnorm16(c.u) && FitsUnorm16(c.v);
+		if (bRect)
 		{
-			__FlushRenderCache();
-			lastModeIsQuad = true;
+			RenderRect(a.x, a.y, c.x - a.x, c.y - a.y, a.c, a.u, a.v, c.u, c.v);
+			return;
 		}
+
+		SetGUIBatchMode(GUIBATCH_TRIANGLES);
+		ReserveGUIVertices(6);
 		__WriteVertexToBuffer(a);
 		__WriteVertexToBuffer(b);
 		__WriteVertexToBuffer(d);
@@ -744,47 +3043,350 @@ namespace Renderer
 		__WriteVertexToBuffer(d);
 	}
 
-	void RenderLine(const Vertex & a, const Vertex & b)
+	// Lines are untextured and blend from a's colour to b's. Widths up to 63.75 pixels
+	// batch with rectangles; anything that doesn't fit an instance falls back to a one
+	// pixel GL_LINES pair.
+	void RenderLine(const Vertex & a, const Vertex & b, float fWidth)
 	{
-		if (lastModeIsQuad)
+		int nWidth = (int)floorf(fWidth * 4.0f + 0.5f);
+		if (nWidth > 0 && nWidth <= 255
+			&& FitsQuarterPixels(a.x) && FitsQuarterPixels(a.y) && FitsQuarterPixels(b.x) && FitsQuarterPixels(b.y))
 		{
-			__FlushRenderCache();
-			lastModeIsQuad = false;
+			GUIQuadInstance * q = AddGUIInstance();
+			q->x = (short)floorf(a.x * 4.0f + 0.5f);
+			q->y = (short)floorf(a.y * 4.0f + 0.5f);
+			q->w = (short)floorf(b.x * 4.0f + 0.5f);
+			q->h = (short)floorf(b.y * 4.0f + 0.5f);
+			q->u0 = (unsigned short)(b.c & 0xFFFF);
+			q->v0 = (unsigned short)(b.c >> 16);
+			q->u1 = 0;
+			q->v1 = 0;
+			q->c = a.c;
+			q->factor = 255;
+			q->sdf = 0;
+			q->width = (unsigned char)nWidth;
+			return;
 		}
+
+		SetGUIBatchMode(GUIBATCH_LINES);
+		ReserveGUIVertices(2);
 		__WriteVertexToBuffer(a);
 		__WriteVertexToBuffer(b);
 	}
 
 	//////////////////////////////////////////////////////////////////////////
+	// frame capture
+
+#ifndef GL_PACK_INVERT_MESA
+#define GL_PACK_INVERT_MESA 0x8758
+#endif
+
+	// Same scheme as the tile readbacks: a FIFO of PBOs, each guarded by a fence, so the
+	// transfer of a frame overlaps with rendering the next few and nothing ever waits for
+	// the GPU unless asked to. Every slot remembers the size and format it was captured
+	// at. Mesa can flip the rows as part of an RGBA transfer; otherwise, and always for the
+	// YUV conversion, a flipping blit into the readback target comes first.
+	struct FrameReadback
+	{
+		GLuint pbo;
+		GLsync fence;
+		int nSize;               // allocated bytes
+		int nFrame;
+		float fTime;
+		int width, height;
+		RENDERER_CAPTUREFORMAT format;
+	};
+	RenderTarget frameReadbackTarget = { 0, 0, 0, 0, 0 };
+	std::vector<FrameReadback> frameReadbacks;
+	int nFrameReadbackHead = 0;  // oldest in-flight readback
+	int nFrameReadbackCount = 0; // number in flight
+	bool bFrameMapped = false;
+	bool bPackInvert = false;
+
+	// The YUV conversion renders the luma plane and the subsampled chroma into their own
+	// small targets and only those are read back: 1.5 bytes a pixel instead of 4.
+	RenderTarget frameLumaTarget = { 0, 0, 0, 0, 0 };   // R8, output size
+	RenderTarget frameChromaTarget = { 0, 0, 0, 0, 0 }; // RG8 with U and V, half size rounded up
+	GLuint glhLumaProgram = 0;
+	GLuint glhChromaProgram = 0;
+
+	void GetYUVMatrix(int matrix[3][3])
+	{
+		const double fKr = 0.2126, fKb = 0.0722, fKg = 1.0 - fKr - fKb;
+		const double fY = 219.0 / 255.0 * 65536.0, fC = 224.0 / 255.0 * 65536.0;
+		matrix[0][0] = (int)(fKr * fY + 0.5);
+		matrix[0][1] = (int)(fKg * fY + 0.5);
+		matrix[0][2] = (int)(fKb * fY + 0.5);
+		matrix[1][0] = -(int)(fKr / (2.0 * (1.0 - fKb)) * fC + 0.5);
+		matrix[1][1] = -(int)(fKg / (2.0 * (1.0 - fKb)) * fC + 0.5);
+		matrix[1][2] = -matrix[1][0] - matrix[1][1];
+		matrix[2][1] = -(int)(fKg / (2.0 * (1.0 - fKr)) * fC + 0.5);
+		matrix[2][2] = -(int)(fKb / (2.0 * (1.0 - fKr)) * fC + 0.5);
+		matrix[2][0] = -matrix[2][1] - matrix[2][2];
+	}
+
+	int GetFrameGrabSize(RENDERER_CAPTUREFORMAT format, int width, int height)
+	{
+		if (format == RENDERER_CAPTUREFORMAT_RGBA)
+			return width * height * 4;
+		return width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+	}
+
+	// Nothing is allocated until the first capture
+	static bool InitFrameReadbacks(int nDepth)
+	{
+		bPackInvert = HasExtension("GL_MESA_pack_invert");
+		FrameReadback slot = { 0, 0, 0, 0, 0.0f, 0, 0, RENDERER_CAPTUREFORMAT_RGBA };
+		frameReadbacks.assign(nDepth, slot);
+		nFrameReadbackHead = 0;
+		nFrameReadbackCount = 0;
+		bFrameMapped = false;
+
+		// Both conversion passes do the fixed point arithmetic of a CPU converter on the
+		// 8 bit values, so they produce exactly the same bytes. The source is the flipped
+		// copy of the output, top row first, which makes the planes come back top-down.
+		static const char * szLumaPixelShader =
+			"#version 410 core\n"
+			"uniform sampler2D tex;\n"
+			"uniform ivec3 v3Y;\n"
+			"out vec4 out_color;\n"
+			"void main()\n"
+			"{\n"
+			"  ivec3 c = ivec3( texelFetch( tex, ivec2( gl_FragCoord.xy ), 0 ).rgb * 255.0 + 0.5 );\n"
+			"  int y = ( ( 16 << 16 ) + ( 1 << 15 ) + c.r * v3Y.x + c.g * v3Y.y + c.b * v3Y.z ) >> 16;\n"
+			"  out_color = vec4( float( y ) / 255.0 );\n"
+			"}\n";
+
+		// Each chroma sample filters the luma positions around its siting: 1-1 between two
+		// samples, 1-2-1 centred on one, per axis. Edges repeat the last column and row.
+		static const char * szChromaPixelShader =
+			"#version 410 core\n"
+			"uniform sampler2D tex;\n"
+			"uniform ivec3 v3U;\n"
+			"uniform ivec3 v3V;\n"
+			"uniform ivec2 v2Size;\n"
+			"uniform ivec2 v2Cosited;\n"
+			"out vec4 out_color;\n"
+			"int weight( int d, int nCosited )\n"
+			"{\n"
+			"  return nCosited != 0 ? ( d == 0 ? 2 : 1 ) : ( d < 0 ? 0 : 1 );\n"
+			"}\n"
+			"void main()\n"
+			"{\n"
+			"  ivec2 p = ivec2( gl_FragCoord.xy ) * 2;\n"
+			"  ivec3 c = ivec3( 0 );\n"
+			"  for ( int y = -1; y <= 1; y++ )\n"
+			"  {\n"
+			"    for ( int x = -1; x <= 1; x++ )\n"
+			"    {\n"
+			"      int w = weight( x, v2Cosited.x ) * weight( y, v2Cosited.y );\n"
+			"      if ( w == 0 )\n"
+			"        continue;\n"
+			"      ivec2 t = clamp( p + ivec2( x, y ), ivec2( 0 ), v2Size - 1 );\n"
+			"      c += w * ivec3( texelFetch( tex, t, 0 ).rgb * 255.0 + 0.5 );\n"
+			"    }\n"
+			"  }\n"
+			"  int nShift = 18 + v2Cosited.x + v2Cosited.y;\n"
+			"  int nBias = ( 128 << nShift ) + ( 1 << ( nShift - 1 ) );\n"
+			"  int u = ( nBias + c.r * v3U.x + c.g * v3U.y + c.b * v3U.z ) >> nShift;\n"
+			"  int v = ( nBias + c.r * v3V.x + c.g * v3V.y + c.b * v3V.z ) >> nShift;\n"
+			"  out_color = vec4( float( u ) / 255.0, float( v ) / 255.0, 0.0, 0.0 );\n"
+			"}\n";
+
+		glhLumaProgram = LinkFullscreenProgram(szLumaPixelShader, "Luma conversion");
+		glhChromaProgram = LinkFullscreenProgram(szChromaPixelShader, "Chroma conversion");
+		if (!glhLumaProgram || !glhChromaProgram)
+			return false;
+
+		int matrix[3][3];
+		GetYUVMatrix(matrix);
+		glProgramUniform1i(glhLumaProgram, glGetUniformLocation(glhLumaProgram, "tex"), 0);
+		glProgramUniform3i(glhLumaProgram, glGetUniformLocation(glhLumaProgram, "v3Y"), matrix[0][0], matrix[0][1], matrix[0][2]);
+		glProgramUniform1i(glhChromaProgram, glGetUniformLocation(glhChromaProgram, "tex"), 0);
+		glProgramUniform3i(glhChromaProgram, glGetUniformLocation(glhChromaProgram, "v3U"), matrix[1][0], matrix[1][1], matrix[1][2]);
+		glProgramUniform3i(glhChromaProgram, glGetUniformLocation(glhChromaProgram, "v3V"), matrix[2][0], matrix[2][1], matrix[2][2]);
+		return true;
+	}
+
+	static void ReleaseFrameReadbackTarget()
+	{
+		ReleaseRenderTarget(frameReadbackTarget);
+		ReleaseRenderTarget(frameLumaTarget);
+		ReleaseRenderTarget(frameChromaTarget);
+	}
+
+	// Runs the conversion on the flipped copy in the readback target and queues the
+	// planes into the bound pack buffer: Y, then U and V, or U and V interleaved
+	static void ReadFrameAsYUV(RENDERER_CAPTUREFORMAT format, RENDERER_CHROMASITING siting)
+	{
+		int nChromaWidth = (nWidth + 1) / 2, nChromaHeight = (nHeight + 1) / 2;
+		ScopedTextureBindings bindings;
+		bindings.Bind(0, frameReadbackTarget.texture);
+		glBindVertexArray(glhFullscreenQuadVA);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, frameLumaTarget.fbo);
+		glViewport(0, 0, nWidth, nHeight);
+		glUseProgram(glhLumaProgram);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, frameChromaTarget.fbo);
+		glViewport(0, 0, nChromaWidth, nChromaHeight);
+		glUseProgram(glhChromaProgram);
+		glProgramUniform2i(glhChromaProgram, glGetUniformLocation(glhChromaProgram, "v2Size"), nWidth, nHeight);
+		glProgramUniform2i(glhChromaProgram, glGetUniformLocation(glhChromaProgram, "v2Cosited"),
+			siting != RENDERER_CHROMASITING_CENTER, siting == RENDERER_CHROMASITING_TOPLEFT);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glUseProgram(0);
+
+		size_t nChromaOffset = nWidth * nHeight;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, frameLumaTarget.fbo);
+		glReadPixels(0, 0, nWidth, nHeight, GL_RED, GL_UNSIGNED_BYTE, NULL);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, frameChromaTarget.fbo);
+		if (format == RENDERER_CAPTUREFORMAT_NV12)
+		{
+			glReadPixels(0, 0, nChromaWidth, nChromaHeight, GL_RG, GL_UNSIGNED_BYTE, (void *)nChromaOffset);
+		}
+		else
+		{
+			glReadPixels(0, 0, nChromaWidth, nChromaHeight, GL_RED, GL_UNSIGNED_BYTE, (void *)nChromaOffset);
+			glReadPixels(0, 0, nChromaWidth, nChromaHeight, GL_GREEN, GL_UNSIGNED_BYTE, (void *)(nChromaOffset + nChromaWidth * nChromaHeight));
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, nSurfaceHeight - nHeight, nWidth, nHeight);
+	}
 
-	bool GrabFrame(void * pPixelBuffer)
+	bool GrabFrame(RENDERER_CAPTUREFORMAT format, RENDERER_CHROMASITING siting)
 	{
-		writeIndex = (writeIndex + 1) % 2;
-		readIndex = (readIndex + 1) % 2;
+		if (nFrameReadbackCount == (int)frameReadbacks.size())
+			return false;
+
+		bool bConvert = format != RENDERER_CAPTUREFORMAT_RGBA;
+		bool bFlipBlit = bConvert || !bPackInvert;
+		if (bFlipBlit && !frameReadbackTarget.fbo && !CreateRenderTarget(frameReadbackTarget, nWidth, nHeight))
+		{
+			ReleaseRenderTarget(frameReadbackTarget);
+			return false;
+		}
+		if (bConvert && !frameLumaTarget.fbo)
+		{
+			if (!CreateRenderTarget(frameLumaTarget, nWidth, nHeight, GL_R8)
+				|| !CreateRenderTarget(frameChromaTarget, (nWidth + 1) / 2, (nHeight + 1) / 2, GL_RG8))
+			{
+				ReleaseRenderTarget(frameLumaTarget);
+				ReleaseRenderTarget(frameChromaTarget);
+				return false;
+			}
+		}
 
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[writeIndex]);
-		glReadPixels(0, 0, nWidth, nHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[readIndex]);
-		unsigned char * downsampleData = (unsigned char *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-		if (downsampleData)
+		FrameReadback & slot = frameReadbacks[(nFrameReadbackHead + nFrameReadbackCount) % frameReadbacks.size()];
+		int nSize = GetFrameGrabSize(format, nWidth, nHeight);
+		if (!slot.pbo)
+			glGenBuffers(1, &slot.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		if (slot.nSize != nSize)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, nSize, NULL, GL_STREAM_READ);
+			slot.nSize = nSize;
+		}
+		slot.nFrame = nFrameIndex;
+		slot.fTime = Timer::GetTime();
+		slot.width = nWidth;
+		slot.height = nHeight;
+		slot.format = format;
+
+		Profiler::BeginMarker(hReadbackMarker);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		if (!bFlipBlit)
+		{
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			glPixelStorei(GL_PACK_INVERT_MESA, GL_TRUE);
+			glReadPixels(0, nSurfaceHeight - nHeight, nWidth, nHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glPixelStorei(GL_PACK_INVERT_MESA, GL_FALSE);
+		}
+		else
 		{
-			unsigned char * src = downsampleData;
-			unsigned char * dst = (unsigned char*)pPixelBuffer + nWidth * (nHeight - 1) * sizeof(unsigned int);
-			for (int i = 0; i<nHeight; i++)
+			// Flip the output region into the readback target, so the rows come back top-down
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frameReadbackTarget.fbo);
+			glBlitFramebuffer(0, nSurfaceHeight - nHeight, nWidth, nSurfaceHeight,
+				0, nHeight, nWidth, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			if (bConvert)
+			{
+				ReadFrameAsYUV(format, siting);
+			}
+			else
 			{
-				memcpy(dst, src, sizeof(unsigned int) * nWidth);
-				src += sizeof(unsigned int) * nWidth;
-				dst -= sizeof(unsigned int) * nWidth;
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, frameReadbackTarget.fbo);
+				glReadPixels(0, 0, nWidth, nHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 			}
-			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		}
-		glBindBuffer(GL_PIXEL_PACK_BUFFER, NULL);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		Profiler::EndMarker(hReadbackMarker);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		nFrameReadbackCount++;
+		return true;
+	}
+
+	bool TryGrabFrame(GRABBEDFRAME * pFrame, bool bWait)
+	{
+		if (!nFrameReadbackCount || bFrameMapped)
+			return false;
+
+		FrameReadback & slot = frameReadbacks[nFrameReadbackHead];
+		GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, bWait ? 1000000000ull : 0);
+		while (bWait && status == GL_TIMEOUT_EXPIRED)
+			status = glClientWaitSync(slot.fence, 0, 1000000000ull);
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+			return false;
 
+		int nSize = GetFrameGrabSize(slot.format, slot.width, slot.height);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		pFrame->pData = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, nSize, GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!pFrame->pData)
+			return false;
+
+		pFrame->nFrame = slot.nFrame;
+		pFrame->fTime = slot.fTime;
+		pFrame->width = slot.width;
+		pFrame->height = slot.height;
+		pFrame->format = slot.format;
+		pFrame->nSize = nSize;
+		bFrameMapped = true;
 		return true;
 	}
 
+	void ReleaseGrabbedFrame()
+	{
+		if (!bFrameMapped)
+			return;
+
+		FrameReadback & slot = frameReadbacks[nFrameReadbackHead];
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+
+		nFrameReadbackHead = (nFrameReadbackHead + 1) % frameReadbacks.size();
+		nFrameReadbackCount--;
+		bFrameMapped = false;
+	}
+
+	int GetFrameGrabsInFlight()
+	{
+		return nFrameReadbackCount;
+	}
+
 	static void sceneExit()
 	{
+		DeinitAsyncReload();
+		ProgramCache::Close();
+		Profiler::Close();
+		FramePacer::Close();
+
 		//glDeleteBuffers(1, &s_instance_vbo);
 		//glDeleteBuffers(1, &s_vbo);
 		//glDeleteVertexArrays(1, &s_vao);
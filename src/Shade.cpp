@@ -4,6 +4,15 @@
 #include <vector>
 #include <assert.h>
 #include "Renderer.h"
+#include "Display.h"
+#include "Poster.h"
+#include "Offline.h"
+#include "Recorder.h"
+#include "CaptureFile.h"
+#include "Profiler.h"
+#include "FramePacer.h"
+#include "TextRenderer.h"
+#include "Editor.h"
 #include "jsonxx.h"
 #include "Timer.h"
 #include <fstream>
@@ -17,6 +26,7 @@
 
 using namespace std;
 
+#ifdef __SWITCH__
 static int s_nxlinkSock = -1;
 
 static void initNxLink()
@@ -50,6 +60,7 @@ extern "C" void userAppExit()
 {
     deinitNxLink();
 }
+#endif
 
 void ReplaceTokens(std::string &sDefShader, const char * sTokenBegin, const char * sTokenName, const char * sTokenEnd, std::vector<std::string> &tokens)
 {
@@ -105,7 +116,566 @@ void printInteraction(void)
 	cout << "Press esc to quit." << endl;
 }
 
+// Measures the CPU cost of the per-frame uniform updates done by the main loop,
+// once through the string-based setters and once through cached uniform handles.
+void benchmarkUniformUpdates(int nFrames, std::map<std::string, Renderer::Texture*> &textures)
+{
+	Renderer::UniformHandle hGlobalTime = Renderer::RegisterUniform("fGlobalTime");
+	Renderer::UniformHandle hResolution = Renderer::RegisterUniform("v2Resolution");
+	std::vector<Renderer::UniformHandle> textureHandles;
+	for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
+		textureHandles.push_back(Renderer::RegisterUniform(it->first.c_str()));
+
+	glFinish();
+	double fStart = Timer::GetTimePrecise();
+	for (int i = 0; i < nFrames; i++)
+	{
+		Renderer::SetShaderConstant(string("fGlobalTime"), (float)i);
+		Renderer::SetShaderConstant(string("v2Resolution"), Renderer::nWidth, Renderer::nHeight);
+		for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
+			Renderer::SetShaderTexture((char*)it->first.c_str(), it->second);
+	}
+	glFinish();
+	double fStringTime = Timer::GetTimePrecise() - fStart;
+
+	fStart = Timer::GetTimePrecise();
+	for (int i = 0; i < nFrames; i++)
+	{
+		Renderer::SetShaderConstant(hGlobalTime, (float)i);
+		Renderer::SetShaderConstant(hResolution, Renderer::nRenderWidth, Renderer::nRenderHeight);
+		int n = 0;
+		for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
+			Renderer::SetShaderTexture(textureHandles[n++], it->second);
+	}
+	glFinish();
+	double fHandleTime = Timer::GetTimePrecise() - fStart;
+
+	printf("[Benchmark] Uniform updates over %d frames (%d textures):\n", nFrames, (int)textures.size());
+	printf("* string lookups: %.3f us/frame\n", fStringTime * 1000000.0 / nFrames);
+	printf("* cached handles: %.3f us/frame\n", fHandleTime * 1000000.0 / nFrames);
+}
+
+// Live coding: the shader file is polled for changes and recompiled in the background,
+// so saving never stalls the frame that is being rendered.
+static time_t s_shaderModifiedTime = 0;
+static float s_fNextShaderPoll = 0.0f;
+static std::string s_sShaderError;
+
+static void onShaderReloaded(bool bSuccess, const char * szErrorLog, void * pUserData)
+{
+	if (bSuccess)
+		printf("Shader reloaded.\n");
+	else
+		printf("Shader error:\n%s\n", szErrorLog);
+	s_sShaderError = bSuccess ? "" : szErrorLog;
+}
+
+static void pollShaderFile(float time)
+{
+	if (time < s_fNextShaderPoll)
+		return;
+	s_fNextShaderPoll = time + 0.25f;
+
+	struct stat st;
+	if (stat(Renderer::defaultShaderFilename.c_str(), &st) != 0 || st.st_mtime == s_shaderModifiedTime)
+		return;
+	bool bFirstPoll = s_shaderModifiedTime == 0;
+	s_shaderModifiedTime = st.st_mtime;
+	if (bFirstPoll)
+		return;
+
+	ifstream shaderFile(Renderer::defaultShaderFilename.c_str(), ios::in | ios::binary);
+	std::string sShader((std::istreambuf_iterator<char>(shaderFile)), std::istreambuf_iterator<char>());
+	Editor::SetText(sShader.c_str(), sShader.size());
+	Renderer::ReloadShaderAsync(sShader.c_str(), sShader.size(), onShaderReloaded, NULL);
+}
+
+#ifdef __SWITCH__
+// Compiles what is in the editor and saves it, so the file and the running shader agree
+static void compileEditorShader()
+{
+	std::string sShader = Editor::GetText();
+	FILE * f = fopen(Renderer::defaultShaderFilename.c_str(), "wb");
+	if (f)
+	{
+		fwrite(sShader.c_str(), 1, sShader.size(), f);
+		fclose(f);
+		struct stat st;
+		if (stat(Renderer::defaultShaderFilename.c_str(), &st) == 0)
+			s_shaderModifiedTime = st.st_mtime;
+	}
+	Renderer::ReloadShaderAsync(sShader.c_str(), sShader.size(), onShaderReloaded, NULL);
+}
+
+// USB keyboard input for the editor, US layout. A held key repeats after a short delay.
+// F5 or Ctrl+R compiles, F11 shows or hides the editor.
+static const char * s_szKeyboardChars = " -=[]\\#;'`,./";
+static const char * s_szKeyboardShiftedChars = " _+{}|~:\"~<>?";
+static HidKeyboardState s_previousKeyboardState;
+static int s_nRepeatKey = -1;
+static float s_fNextRepeat = 0.0f;
+
+static void handleKeyboardKey(int nKey, const HidKeyboardState & state)
+{
+	bool bShift = (state.modifiers & HidKeyboardModifier_Shift) != 0;
+	bool bCapsLock = (state.modifiers & HidKeyboardModifier_CapsLock) != 0;
+	bool bControl = (state.modifiers & HidKeyboardModifier_Control) != 0;
+
+	if (nKey == HidKeyboardKey_F11)
+	{
+		Editor::SetVisible(!Editor::IsVisible());
+		return;
+	}
+	if (nKey == HidKeyboardKey_F5 || (bControl && nKey == HidKeyboardKey_R))
+	{
+		compileEditorShader();
+		return;
+	}
+	if (!Editor::IsVisible() || bControl)
+		return;
+
+	char szChar[2] = { 0, 0 };
+	if (nKey >= HidKeyboardKey_A && nKey <= HidKeyboardKey_Z)
+		szChar[0] = (char)((bShift != bCapsLock ? 'A' : 'a') + nKey - HidKeyboardKey_A);
+	else if (nKey >= HidKeyboardKey_D1 && nKey <= HidKeyboardKey_D0)
+		szChar[0] = (bShift ? "!@#$%^&*()" : "1234567890")[nKey - HidKeyboardKey_D1];
+	else if (nKey >= HidKeyboardKey_Space && nKey <= HidKeyboardKey_Slash)
+		szChar[0] = (bShift ? s_szKeyboardShiftedChars : s_szKeyboardChars)[nKey - HidKeyboardKey_Space];
+	if (szChar[0])
+	{
+		Editor::InsertText(szChar);
+		return;
+	}
+
+	switch (nKey)
+	{
+	case HidKeyboardKey_LeftArrow: Editor::HandleKey(EDITOR_KEY_LEFT); break;
+	case HidKeyboardKey_RightArrow: Editor::HandleKey(EDITOR_KEY_RIGHT); break;
+	case HidKeyboardKey_UpArrow: Editor::HandleKey(EDITOR_KEY_UP); break;
+	case HidKeyboardKey_DownArrow: Editor::HandleKey(EDITOR_KEY_DOWN); break;
+	case HidKeyboardKey_Home: Editor::HandleKey(EDITOR_KEY_HOME); break;
+	case HidKeyboardKey_End: Editor::HandleKey(EDITOR_KEY_END); break;
+	case HidKeyboardKey_PageUp: Editor::HandleKey(EDITOR_KEY_PAGEUP); break;
+	case HidKeyboardKey_PageDown: Editor::HandleKey(EDITOR_KEY_PAGEDOWN); break;
+	case HidKeyboardKey_Backspace: Editor::HandleKey(EDITOR_KEY_BACKSPACE); break;
+	case HidKeyboardKey_Delete: Editor::HandleKey(EDITOR_KEY_DELETE); break;
+	case HidKeyboardKey_Return: Editor::HandleKey(EDITOR_KEY_ENTER); break;
+	case HidKeyboardKey_Tab: Editor::HandleKey(EDITOR_KEY_TAB); break;
+	}
+}
+
+static void pollKeyboard(float time)
+{
+	if (!Editor::IsOpen())
+		return;
+	HidKeyboardState state;
+	if (!hidGetKeyboardStates(&state, 1))
+		return;
+
+	for (int nKey = HidKeyboardKey_A; nKey <= HidKeyboardKey_UpArrow; nKey++)
+	{
+		if (hidKeyboardStateGetKey(&state, (HidKeyboardKey)nKey) && !hidKeyboardStateGetKey(&s_previousKeyboardState, (HidKeyboardKey)nKey))
+		{
+			handleKeyboardKey(nKey, state);
+			s_nRepeatKey = nKey;
+			s_fNextRepeat = time + 0.4f;
+		}
+	}
+	if (s_nRepeatKey != -1)
+	{
+		if (!hidKeyboardStateGetKey(&state, (HidKeyboardKey)s_nRepeatKey))
+			s_nRepeatKey = -1;
+		else if (time >= s_fNextRepeat)
+		{
+			handleKeyboardKey(s_nRepeatKey, state);
+			s_fNextRepeat = time + 0.04f;
+		}
+	}
+	s_previousKeyboardState = state;
+}
+#endif
+
+// On-screen overlay: frame rate and the last shader error, drawn over the shader. The
+// frame rate text only changes twice a second so its layout stays cached in between.
+static bool s_bOverlayFps = false;
+static bool s_bOverlayErrors = false;
+static char s_szFpsText[64] = "";
+static int s_nFpsFrames = 0;
+static float s_fFpsStart = 0.0f;
+static const int nOverlayMaxErrorLines = 12;
+
+static void drawOverlay(float time)
+{
+	if (!TextRenderer::IsOpen())
+		return;
+
+	s_nFpsFrames++;
+	if (time - s_fFpsStart >= 0.5f)
+	{
+		float fFrameTime = (time - s_fFpsStart) / s_nFpsFrames;
+		snprintf(s_szFpsText, sizeof(s_szFpsText), "%.1f fps  %.2f ms", 1.0f / fFrameTime, fFrameTime * 1000.0f);
+		s_nFpsFrames = 0;
+		s_fFpsStart = time;
+	}
+
+	bool bShowError = s_bOverlayErrors && !s_sShaderError.empty();
+	if (!(s_bOverlayFps && s_szFpsText[0]) && !bShowError)
+		return;
+
+	float fMargin = 8.0f;
+	float fLineHeight = TextRenderer::GetLineHeight();
+	float y = fMargin;
+	Renderer::StartTextRendering();
+	if (s_bOverlayFps && s_szFpsText[0])
+	{
+		float w = 0.0f, h = 0.0f;
+		TextRenderer::MeasureString(s_szFpsText, 0.0f, &w, &h);
+		Renderer::BindTexture(NULL);
+		Renderer::RenderRect(fMargin - 4.0f, y - 2.0f, w + 8.0f, h + 4.0f, 0xA0000000);
+		TextRenderer::DrawString(fMargin, y, s_szFpsText, 0xFFFFFFFF);
+		y += fLineHeight + fMargin;
+	}
+	if (bShowError)
+	{
+		// Only the first lines; the full log goes to stdout
+		size_t nEnd = 0;
+		for (int i = 0; i < nOverlayMaxErrorLines && nEnd != std::string::npos; i++)
+			nEnd = s_sShaderError.find('\n', nEnd ? nEnd + 1 : 0);
+		std::string sError = s_sShaderError.substr(0, nEnd);
+		while (!sError.empty() && sError[sError.size() - 1] == '\n')
+			sError.erase(sError.size() - 1);
+
+		float w = 0.0f, h = 0.0f;
+		TextRenderer::MeasureString(sError.c_str(), 0.0f, &w, &h);
+		Renderer::BindTexture(NULL);
+		Renderer::RenderRect(fMargin - 4.0f, y - 2.0f, w + 8.0f, h + 4.0f, 0xC0000000);
+		TextRenderer::DrawString(fMargin, y, sError.c_str(), 0xFF6060FF);
+	}
+	Renderer::EndTextRendering();
+}
+
+static void drawEditor()
+{
+	if (!Editor::IsOpen() || !Editor::IsVisible())
+		return;
+	Renderer::StartTextRendering();
+	Editor::Draw();
+	Renderer::EndTextRendering();
+}
+
+static const char * profileNames[] = { "release", "profile", "debug" };
+
+static bool parseProfile(const std::string & sName, RENDERER_PROFILE * profile)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		if (sName == profileNames[i])
+		{
+			*profile = (RENDERER_PROFILE)i;
+			return true;
+		}
+	}
+	printf("Unknown profile '%s'\n", sName.c_str());
+	return false;
+}
+
+static const char * recorderFormatNames[] = { "ppm", "y4m", "raw", "nv12", "sfc", "png" };
+static const char * backpressureNames[] = { "block", "drop", "slow" };
+static const char * chromaSitingNames[] = { "center", "left", "topleft" };
+
+// An empty format name picks the format from the output's extension
+static RECORDER_FORMAT parseRecorderFormat(const std::string & sName, const std::string & sOutput)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (sName == recorderFormatNames[i])
+			return (RECORDER_FORMAT)i;
+	}
+	if (!sName.empty())
+		printf("Unknown recording format '%s'\n", sName.c_str());
+
+	size_t nDot = sOutput.rfind('.');
+	std::string sExtension = nDot == std::string::npos ? "" : sOutput.substr(nDot + 1);
+	if (sExtension == "y4m")
+		return RECORDER_FORMAT_Y4M;
+	if (sExtension == "raw" || sExtension == "rgba")
+		return RECORDER_FORMAT_RAW;
+	if (sExtension == "nv12" || sExtension == "yuv")
+		return RECORDER_FORMAT_NV12;
+	if (sExtension == "sfc")
+		return RECORDER_FORMAT_SFC;
+	if (sExtension == "png")
+		return RECORDER_FORMAT_PNG;
+	return RECORDER_FORMAT_PPM;
+}
+
+static bool parseBackpressure(const std::string & sName, RECORDER_BACKPRESSURE * backpressure)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		if (sName == backpressureNames[i])
+		{
+			*backpressure = (RECORDER_BACKPRESSURE)i;
+			return true;
+		}
+	}
+	printf("Unknown backpressure policy '%s'\n", sName.c_str());
+	return false;
+}
+
+static void parseChromaSiting(const std::string & sName, RENDERER_CHROMASITING * siting)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		if (sName == chromaSitingNames[i])
+		{
+			*siting = (RENDERER_CHROMASITING)i;
+			return;
+		}
+	}
+	printf("Unknown chroma siting '%s'\n", sName.c_str());
+}
+
+// The recording keys are shared by the "record" and "offline" blocks
+static void parseRecorderSettings(jsonxx::Object & object, std::string & sOutput, std::string & sFormat, RECORDER_SETTINGS * settings)
+{
+	sOutput = object.get<jsonxx::String>("output", sOutput);
+	sFormat = object.get<jsonxx::String>("format", sFormat);
+	if (object.has<jsonxx::Number>("fps"))
+		settings->fFrameRate = (float)object.get<jsonxx::Number>("fps");
+	if (object.has<jsonxx::Number>("queueDepth"))
+		settings->nQueueDepth = (int)object.get<jsonxx::Number>("queueDepth");
+	if (object.has<jsonxx::String>("backpressure"))
+		parseBackpressure(object.get<jsonxx::String>("backpressure"), &settings->backpressure);
+	if (object.has<jsonxx::String>("chromaSiting"))
+		parseChromaSiting(object.get<jsonxx::String>("chromaSiting"), &settings->chromaSiting);
+	settings->bConvertOnCPU = object.get<jsonxx::Boolean>("convertOnCPU", settings->bConvertOnCPU);
+	if (object.has<jsonxx::Number>("encoderThreads"))
+		settings->nEncoderThreads = (int)object.get<jsonxx::Number>("encoderThreads");
+	if (object.has<jsonxx::Number>("compressionLevel"))
+		settings->nCompressionLevel = (int)object.get<jsonxx::Number>("compressionLevel");
+}
+
+// Measures what the selected runtime profile costs: one compile of the current shader
+// and the average frame time over nFrames. Run once per profile to compare them.
+void benchmarkProfile(int nFrames, const char * szShader, Renderer::UniformHandle hGlobalTime, Renderer::UniformHandle hResolution)
+{
+	char szError[4096];
+	std::string sShader = szShader;
+
+	double fStart = Timer::GetTimePrecise();
+	bool bCompiled = Renderer::ReloadShader(&sShader[0], sShader.size(), szError, sizeof(szError));
+	double fCompileTime = Timer::GetTimePrecise() - fStart;
+	if (!bCompiled)
+	{
+		printf("[Benchmark] Shader compile failed:\n%s\n", szError);
+		return;
+	}
+
+	double fTotal = 0.0;
+	double fWorst = 0.0;
+	for (int i = 0; i < nFrames; i++)
+	{
+		fStart = Timer::GetTimePrecise();
+		Renderer::StartFrame();
+		Renderer::SetShaderConstant(hGlobalTime, i / 60.0f);
+		Renderer::SetShaderConstant(hResolution, Renderer::nRenderWidth, Renderer::nRenderHeight);
+		Renderer::RenderFullscreenQuad();
+		glFinish();
+		Renderer::EndFrame();
+		double fFrameTime = Timer::GetTimePrecise() - fStart;
+		fTotal += fFrameTime;
+		if (fFrameTime > fWorst)
+			fWorst = fFrameTime;
+	}
+
+	printf("[Benchmark] Profile '%s' at %dx%d:\n", profileNames[Renderer::GetProfile()], Renderer::nRenderWidth, Renderer::nRenderHeight);
+	printf("* shader compile: %.1f ms\n", fCompileTime * 1000.0);
+	printf("* frame time: %.2f ms average, %.2f ms worst over %d frames\n", fTotal * 1000.0 / nFrames, fWorst * 1000.0, nFrames);
+	if (Renderer::GetProfile() == RENDERER_PROFILE_PROFILE && Profiler::IsOpen())
+		Profiler::DumpStats();
+}
+
+// Checks the GPU's YUV conversion against Recorder's CPU one over nFrames frames of the
+// current shader. The frames are rendered once and captured as RGBA, then rendered again
+// and captured both as RGBA and converted on the GPU, each frame in the next layout and
+// chroma siting; the second RGBA has to match the first, which catches state a
+// conversion leaves behind for the frames after it, and the GPU planes have to match the
+// CPU conversion of the first RGBA. Both runs start by rendering the last two frames,
+// so half-rate rendering starts them from the same fields. Needs a fixed render
+// resolution.
+bool checkCaptureConversion(int nFrames, const char * szShader, Renderer::UniformHandle hGlobalTime, Renderer::UniformHandle hResolution,
+	const std::vector<std::pair<Renderer::UniformHandle, Renderer::Texture*> > & textureUniforms)
+{
+	char szError[4096];
+	std::string sShader = szShader;
+	if (!Renderer::ReloadShader(&sShader[0], sShader.size(), szError, sizeof(szError)))
+	{
+		printf("[CaptureCheck] Shader compile failed:\n%s\n", szError);
+		return false;
+	}
+
+	// An even count keeps half-rate rendering on the same field in both runs
+	nFrames = nFrames < 2 ? 2 : (nFrames + 1) & ~1;
+	static const RENDERER_CAPTUREFORMAT formats[2] = { RENDERER_CAPTUREFORMAT_YUV420, RENDERER_CAPTUREFORMAT_NV12 };
+	std::vector<std::vector<unsigned char> > references(nFrames);
+	std::vector<unsigned char> converted;
+	int nMismatches = 0;
+	for (int nRun = 0; nRun < 2; nRun++)
+	{
+		for (int i = -2; i < nFrames; i++)
+		{
+			RENDERER_CAPTUREFORMAT format = formats[(i + nFrames) % 2];
+			RENDERER_CHROMASITING siting = (RENDERER_CHROMASITING)((i + nFrames) / 2 % 3);
+
+			Renderer::StartFrame();
+			Renderer::SetShaderConstant(hGlobalTime, (i + nFrames) % nFrames / 60.0f);
+			Renderer::SetShaderConstant(hResolution, Renderer::nRenderWidth, Renderer::nRenderHeight);
+			for (size_t j = 0; j < textureUniforms.size(); j++)
+				Renderer::SetShaderTexture(textureUniforms[j].first, textureUniforms[j].second);
+			Renderer::RenderFullscreenQuad();
+			if (i < 0)
+			{
+				Renderer::EndFrame();
+				continue;
+			}
+			bool bGrabbed = Renderer::GrabFrame();
+			if (nRun == 1)
+				bGrabbed = Renderer::GrabFrame(format, siting) && bGrabbed;
+			Renderer::EndFrame();
+			if (!bGrabbed)
+			{
+				printf("[CaptureCheck] Frame %d couldn't be captured\n", i);
+				return false;
+			}
+
+			Renderer::GRABBEDFRAME grabbed;
+			while (Renderer::TryGrabFrame(&grabbed, true))
+			{
+				std::vector<unsigned char> & reference = references[i];
+				const char * szWhat = NULL;
+				if (nRun == 0)
+				{
+					reference.assign(grabbed.pData, grabbed.pData + grabbed.nSize);
+				}
+				else if (grabbed.format == RENDERER_CAPTUREFORMAT_RGBA)
+				{
+					if (reference.size() != (size_t)grabbed.nSize || memcmp(&reference[0], grabbed.pData, grabbed.nSize) != 0)
+						szWhat = "the render differs from the first run";
+				}
+				else
+				{
+					converted.resize(Renderer::GetFrameGrabSize(format, grabbed.width, grabbed.height));
+					Recorder::ConvertToYUV420(&reference[0], grabbed.width, grabbed.height, siting, format == RENDERER_CAPTUREFORMAT_NV12, &converted[0]);
+					if (converted.size() != (size_t)grabbed.nSize || memcmp(&converted[0], grabbed.pData, grabbed.nSize) != 0)
+						szWhat = "the GPU conversion differs from the CPU one";
+				}
+				Renderer::ReleaseGrabbedFrame();
+				if (szWhat)
+				{
+					printf("[CaptureCheck] Frame %d (%s, siting %d): %s\n", i, format == RENDERER_CAPTUREFORMAT_NV12 ? "NV12" : "I420", siting, szWhat);
+					nMismatches++;
+				}
+				if (!Renderer::GetFrameGrabsInFlight())
+					break;
+			}
+		}
+	}
+
+	if (nMismatches)
+		printf("[CaptureCheck] %d mismatches over %d frames\n", nMismatches, nFrames);
+	else
+		printf("[CaptureCheck] %d frames at %dx%d: the GPU conversion matches the CPU one in every layout and siting\n", nFrames, Renderer::nWidth, Renderer::nHeight);
+	return nMismatches == 0;
+}
+
+// Measures the editor's CPU cost per frame while typing into a shader of nLines lines:
+// a keystroke a frame, jumping around the file now and then, and opening and closing a
+// block comment near the top, which changes how every line below it is coloured.
+void benchmarkEditor(int nLines, const char * szShader)
+{
+	if (!Editor::IsOpen())
+	{
+		printf("[Benchmark] The editor benchmark needs an \"editor\" block in the config\n");
+		return;
+	}
+
+	std::string sShader;
+	std::string sSource = szShader[0] ? szShader : Renderer::defaultShader;
+	if (sSource[sSource.size() - 1] != '\n')
+		sSource += '\n';
+	int nLineCount = 0;
+	while (nLineCount < nLines)
+	{
+		for (size_t i = 0; i < sSource.size() && nLineCount < nLines; i++)
+		{
+			sShader += sSource[i];
+			if (sSource[i] == '\n')
+				nLineCount++;
+		}
+	}
+	Editor::SetText(sShader.c_str(), sShader.size());
+	Editor::SetCaret(nLines / 2, 0);
+
+	// Warm up the glyph cache and the layouts of the first screen
+	Renderer::StartFrame();
+	drawEditor();
+	Renderer::EndFrame();
+	Editor::ResetStats();
+
+	const char * szTyping = "col += vec3(0.1, 0.2, 0.3) * sin(fGlobalTime);";
+	int nTypingLength = strlen(szTyping);
+	int nFrames = 1000;
+	int nMaxLinesLexed = 0;
+	int nMaxRunsBuilt = 0;
+	for (int i = 0; i < nFrames; i++)
+	{
+		int nStep = i % 200;
+		if (nStep == 0)
+			Editor::SetCaret((i * 7919) % nLines, 0);
+		if (nStep == 100)
+		{
+			Editor::SetCaret(3, 0);
+			Editor::InsertText("/*");
+		}
+		else if (nStep == 101)
+		{
+			Editor::HandleKey(EDITOR_KEY_BACKSPACE);
+			Editor::HandleKey(EDITOR_KEY_BACKSPACE);
+		}
+		else if (nStep % 50 == 49)
+			Editor::HandleKey(EDITOR_KEY_ENTER);
+		else if (nStep % 10 == 9)
+			Editor::HandleKey(EDITOR_KEY_BACKSPACE);
+		else
+		{
+			char szChar[2] = { szTyping[i % nTypingLength], 0 };
+			Editor::InsertText(szChar);
+		}
+
+		Renderer::StartFrame();
+		drawEditor();
+		Renderer::EndFrame();
+
+		EDITOR_STATS editorStats;
+		Editor::GetStats(&editorStats);
+		if (editorStats.nLinesLexed > nMaxLinesLexed)
+			nMaxLinesLexed = editorStats.nLinesLexed;
+		if (editorStats.nRunsBuilt > nMaxRunsBuilt)
+			nMaxRunsBuilt = editorStats.nRunsBuilt;
+	}
+
+	EDITOR_STATS editorStats;
+	Editor::GetStats(&editorStats);
+	printf("[Benchmark] Editor, typing into %d lines over %d frames:\n", editorStats.nLines, nFrames);
+	printf("* CPU time: %.3f ms average, %.3f ms worst per frame\n", editorStats.fAverageTime, editorStats.fWorstTime);
+	printf("* per frame at most %d lines tokenised, %d lines laid out\n", nMaxLinesLexed, nMaxRunsBuilt);
+}
+
 void update(bool *isClosed) {
+	if (!Display::Update())
+		*isClosed = true;
+
 	/*SDL_Event e;
 
 	while (SDL_PollEvent(&e)) {
@@ -139,16 +709,267 @@ int main(int argc, char *argv[])
 	options.parse(file);
 
 	RENDERER_SETTINGS settings;
-	settings.bVsync = false;
+	settings.bVsync = true;
+	settings.nSwapInterval = 1;
+	settings.fFrameRateLimit = 0.0f;
+	settings.nMaxFramesInFlight = 2;
+	if (options.has<jsonxx::Object>("framePacing"))
+	{
+		jsonxx::Object & framePacing = options.get<jsonxx::Object>("framePacing");
+		settings.bVsync = framePacing.get<jsonxx::Boolean>("vsync", true);
+		if (framePacing.has<jsonxx::Number>("swapInterval"))
+			settings.nSwapInterval = (int)framePacing.get<jsonxx::Number>("swapInterval");
+		if (framePacing.has<jsonxx::Number>("frameRateLimit"))
+			settings.fFrameRateLimit = framePacing.get<jsonxx::Number>("frameRateLimit");
+		if (framePacing.has<jsonxx::Number>("maxFramesInFlight"))
+			settings.nMaxFramesInFlight = (int)framePacing.get<jsonxx::Number>("maxFramesInFlight");
+	}
+	settings.nFrameGrabDepth = (int)options.get<jsonxx::Number>("frameGrabDepth", 0);
+	settings.profile = RENDERER_PROFILE_RELEASE;
+	if (options.has<jsonxx::String>("profile"))
+		parseProfile(options.get<jsonxx::String>("profile"), &settings.profile);
+
+	int nBenchmarkProfileFrames = 0;
+	if (options.has<jsonxx::Number>("benchmarkProfile"))
+		nBenchmarkProfileFrames = (int)options.get<jsonxx::Number>("benchmarkProfile");
+
+	// Recording the viewer, or the output of an offline render
+	bool bRecord = false;
+	std::string sRecordOutput = "capture.y4m";
+	std::string sRecordFormat;
+	RECORDER_SETTINGS recorderSettings;
+	recorderSettings.fFrameRate = 60.0f;
+	recorderSettings.nFirstFrame = 0;
+	recorderSettings.nQueueDepth = 0;
+	recorderSettings.backpressure = RECORDER_BACKPRESSURE_DROP;
+	recorderSettings.chromaSiting = RENDERER_CHROMASITING_CENTER;
+	recorderSettings.bConvertOnCPU = false;
+	recorderSettings.nEncoderThreads = 0;
+	recorderSettings.nCompressionLevel = 0;
+	if (options.has<jsonxx::Object>("record"))
+	{
+		jsonxx::Object & record = options.get<jsonxx::Object>("record");
+		bRecord = record.get<jsonxx::Boolean>("enabled", true);
+		parseRecorderSettings(record, sRecordOutput, sRecordFormat, &recorderSettings);
+	}
+
+	bool bOffline = false;
+	OFFLINE_SETTINGS offlineSettings;
+	offlineSettings.nStartFrame = 0;
+	offlineSettings.nEndFrame = 600;
+	offlineSettings.fFrameRate = 60.0f;
+	if (options.has<jsonxx::Object>("offline"))
+	{
+		jsonxx::Object & offline = options.get<jsonxx::Object>("offline");
+		bOffline = offline.get<jsonxx::Boolean>("enabled", true);
+		offlineSettings.nStartFrame = (int)offline.get<jsonxx::Number>("start", offlineSettings.nStartFrame);
+		offlineSettings.nEndFrame = (int)offline.get<jsonxx::Number>("end", offlineSettings.nEndFrame);
+		offlineSettings.fFrameRate = (float)offline.get<jsonxx::Number>("fps", offlineSettings.fFrameRate);
+		if (bOffline)
+		{
+			sRecordOutput = "frames/%05d.ppm";
+			parseRecorderSettings(offline, sRecordOutput, sRecordFormat, &recorderSettings);
+		}
+	}
+
+	// Command line: --profile <release|profile|debug>, --benchmark-profile <frames>,
+	// --offline <output>, --start <frame>, --end <frame>, --fps <rate> (any of these
+	// four renders offline), --record <output>, --format <ppm|y4m|raw|nv12|sfc|png>,
+	// --backpressure <block|drop|slow>. Capture tools, which exit without rendering:
+	// --capture-bench <capture|ppm|pattern>, --capture-extract <capture>, with
+	// --capture-threads <n> and --capture-output <file|pattern>
+	std::string sCaptureBenchmark;
+	std::string sCaptureExtract;
+	std::string sCaptureOutput;
+	int nCaptureThreads = 0;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--profile") == 0)
+			parseProfile(argv[++i], &settings.profile);
+		else if (strcmp(argv[i], "--benchmark-profile") == 0)
+			nBenchmarkProfileFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--offline") == 0)
+			sRecordOutput = argv[++i], bOffline = true;
+		else if (strcmp(argv[i], "--start") == 0)
+			offlineSettings.nStartFrame = atoi(argv[++i]), bOffline = true;
+		else if (strcmp(argv[i], "--end") == 0)
+			offlineSettings.nEndFrame = atoi(argv[++i]), bOffline = true;
+		else if (strcmp(argv[i], "--fps") == 0)
+			offlineSettings.fFrameRate = (float)atof(argv[++i]), bOffline = true;
+		else if (strcmp(argv[i], "--record") == 0)
+			sRecordOutput = argv[++i], bRecord = true;
+		else if (strcmp(argv[i], "--format") == 0)
+			sRecordFormat = argv[++i];
+		else if (strcmp(argv[i], "--backpressure") == 0)
+			parseBackpressure(argv[++i], &recorderSettings.backpressure);
+		else if (strcmp(argv[i], "--capture-bench") == 0)
+			sCaptureBenchmark = argv[++i];
+		else if (strcmp(argv[i], "--capture-extract") == 0)
+			sCaptureExtract = argv[++i];
+		else if (strcmp(argv[i], "--capture-threads") == 0)
+			nCaptureThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--capture-output") == 0)
+			sCaptureOutput = argv[++i];
+	}
+	if (!sCaptureBenchmark.empty())
+		return CaptureFile::Benchmark(sCaptureBenchmark.c_str(), nCaptureThreads, sCaptureOutput.empty() ? NULL : sCaptureOutput.c_str()) ? 0 : -1;
+	if (!sCaptureExtract.empty())
+		return CaptureFile::Extract(sCaptureExtract.c_str(), sCaptureOutput.empty() ? "frames/%05d.ppm" : sCaptureOutput.c_str()) ? 0 : -1;
+	if (bOffline)
+	{
+		// An offline render always records, with its own frame numbers and rate
+		bRecord = true;
+		recorderSettings.fFrameRate = offlineSettings.fFrameRate;
+		recorderSettings.nFirstFrame = offlineSettings.nStartFrame;
+	}
+	recorderSettings.szOutputFilename = sRecordOutput.c_str();
+	recorderSettings.format = parseRecorderFormat(sRecordFormat, sRecordOutput);
+	settings.renderMode = RENDERER_RENDERMODE_FULL;
+	if (options.has<jsonxx::String>("renderMode"))
+	{
+		std::string renderMode = options.get<jsonxx::String>("renderMode");
+		if (renderMode == "checkerboard")
+			settings.renderMode = RENDERER_RENDERMODE_CHECKERBOARD;
+		else if (renderMode == "interlaced")
+			settings.renderMode = RENDERER_RENDERMODE_INTERLACED;
+	}
+	settings.bDynamicResolution = false;
+	settings.fTargetFrameRate = 60.0f;
+	settings.fMinRenderScale = 0.25f;
+	settings.fMaxRenderScale = 1.0f;
+	if (options.has<jsonxx::Object>("dynamicResolution"))
+	{
+		jsonxx::Object & dynamicResolution = options.get<jsonxx::Object>("dynamicResolution");
+		settings.bDynamicResolution = dynamicResolution.get<jsonxx::Boolean>("enabled", true);
+		if (dynamicResolution.has<jsonxx::Number>("targetFps"))
+			settings.fTargetFrameRate = dynamicResolution.get<jsonxx::Number>("targetFps");
+		if (dynamicResolution.has<jsonxx::Number>("minScale"))
+			settings.fMinRenderScale = dynamicResolution.get<jsonxx::Number>("minScale");
+		if (dynamicResolution.has<jsonxx::Number>("maxScale"))
+			settings.fMaxRenderScale = dynamicResolution.get<jsonxx::Number>("maxScale");
+		if (settings.fMinRenderScale < 0.25f) settings.fMinRenderScale = 0.25f;
+		if (settings.fMaxRenderScale > 1.0f) settings.fMaxRenderScale = 1.0f;
+		if (settings.fMinRenderScale > settings.fMaxRenderScale) settings.fMinRenderScale = settings.fMaxRenderScale;
+	}
+
+	settings.renderTarget.nWidth = 0;
+	settings.renderTarget.nHeight = 0;
+	settings.renderTarget.fScale = 1.0f;
+	settings.renderTarget.format = RENDERER_TARGETFORMAT_RGBA8;
+	settings.renderTarget.resample = RENDERER_RESAMPLE_LINEAR;
+	if (options.has<jsonxx::Object>("renderTarget"))
+	{
+		jsonxx::Object & renderTarget = options.get<jsonxx::Object>("renderTarget");
+		settings.renderTarget.nWidth = (int)renderTarget.get<jsonxx::Number>("width", 0);
+		settings.renderTarget.nHeight = (int)renderTarget.get<jsonxx::Number>("height", 0);
+		settings.renderTarget.fScale = (float)renderTarget.get<jsonxx::Number>("scale", 1.0);
+		std::string sFormat = renderTarget.get<jsonxx::String>("format", "rgba8");
+		if (sFormat == "rgba16f")
+			settings.renderTarget.format = RENDERER_TARGETFORMAT_RGBA16F;
+		else if (sFormat == "rgba32f")
+			settings.renderTarget.format = RENDERER_TARGETFORMAT_RGBA32F;
+		if (renderTarget.get<jsonxx::String>("resample", "linear") == "nearest")
+			settings.renderTarget.resample = RENDERER_RESAMPLE_NEAREST;
+	}
+
+	if (bOffline)
+	{
+		// Nothing is presented, and a frame must only depend on its time: not on the frame
+		// rate (dynamic resolution) or on where the render started (half-rate fields)
+		settings.bVsync = false;
+		settings.fFrameRateLimit = 0.0f;
+		settings.bDynamicResolution = false;
+		settings.renderMode = RENDERER_RENDERMODE_FULL;
+	}
+
+	std::string sProgramCacheDirectory = "shadercache";
+	settings.szProgramCacheDirectory = sProgramCacheDirectory.c_str();
+	settings.nProgramCacheSize = 32 * 1024 * 1024;
+	if (options.has<jsonxx::Object>("programCache"))
+	{
+		jsonxx::Object & programCache = options.get<jsonxx::Object>("programCache");
+		sProgramCacheDirectory = programCache.get<jsonxx::String>("directory", sProgramCacheDirectory);
+		settings.szProgramCacheDirectory = programCache.get<jsonxx::Boolean>("enabled", true) ? sProgramCacheDirectory.c_str() : NULL;
+		if (programCache.has<jsonxx::Number>("maxSizeMB"))
+			settings.nProgramCacheSize = (unsigned int)(programCache.get<jsonxx::Number>("maxSizeMB") * 1024 * 1024);
+	}
+	if (nBenchmarkProfileFrames > 0)
+	{
+		// The benchmark measures real compiles
+		settings.szProgramCacheDirectory = NULL;
+		setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+	}
+
+	DISPLAY_SETTINGS displaySettings;
+	Display::GetDefaultSettings(&displaySettings);
+	if (options.has<jsonxx::Object>("display"))
+	{
+		jsonxx::Object & display = options.get<jsonxx::Object>("display");
+		if (display.has<jsonxx::String>("backend"))
+			displaySettings.backend = display.get<jsonxx::String>("backend") == "simulated" ? DISPLAY_BACKEND_SIMULATED : DISPLAY_BACKEND_APPLET;
+		if (display.has<jsonxx::String>("mode"))
+			displaySettings.initialMode = display.get<jsonxx::String>("mode") == "docked" ? DISPLAY_MODE_DOCKED : DISPLAY_MODE_HANDHELD;
+		if (display.has<jsonxx::Number>("simulatedSwitchInterval"))
+			displaySettings.fSimulatedSwitchInterval = display.get<jsonxx::Number>("simulatedSwitchInterval");
+	}
 
 	bool isClosed = false;
 
+	if (!Display::Open(&displaySettings))
+	{
+		printf("Display::Open failed\n");
+		return -1;
+	}
+
 	if (!Renderer::Open(&settings))
 	{
 		printf("Renderer::Open failed\n");
 		return -1;
 	}
 
+	// The editor draws with the overlay's font settings
+	std::string sOverlayFont;
+	if (options.has<jsonxx::Object>("overlay") || options.has<jsonxx::Object>("editor"))
+	{
+		jsonxx::Object overlay;
+		if (options.has<jsonxx::Object>("overlay"))
+		{
+			overlay = options.get<jsonxx::Object>("overlay");
+			s_bOverlayFps = overlay.get<jsonxx::Boolean>("fps", true);
+			s_bOverlayErrors = overlay.get<jsonxx::Boolean>("errors", true);
+		}
+		sOverlayFont = overlay.get<jsonxx::String>("font", "");
+
+		TEXTRENDERER_SETTINGS textSettings;
+		textSettings.szFontFile = sOverlayFont.empty() ? NULL : sOverlayFont.c_str();
+		textSettings.fSize = (float)overlay.get<jsonxx::Number>("fontSize", 16);
+		textSettings.bDistanceField = overlay.get<jsonxx::Boolean>("distanceField", false);
+		textSettings.nCacheSize = (int)overlay.get<jsonxx::Number>("cacheSize", textSettings.bDistanceField ? 512 : 256);
+		if (!TextRenderer::Open(&textSettings))
+			printf("TextRenderer::Open failed, no overlay\n");
+	}
+
+	if (options.has<jsonxx::Object>("editor"))
+	{
+		jsonxx::Object & editor = options.get<jsonxx::Object>("editor");
+		EDITOR_SETTINGS editorSettings;
+		editorSettings.fX = (float)editor.get<jsonxx::Number>("x", 8);
+		editorSettings.fY = (float)editor.get<jsonxx::Number>("y", 40);
+		editorSettings.fWidth = (float)editor.get<jsonxx::Number>("width", 0);
+		editorSettings.fHeight = (float)editor.get<jsonxx::Number>("height", 0);
+		editorSettings.fFontSize = (float)editor.get<jsonxx::Number>("fontSize", 0);
+		editorSettings.nBackgroundColor = (unsigned int)((int)(editor.get<jsonxx::Number>("opacity", 0.5) * 255.0) << 24);
+		if (Editor::Open(&editorSettings))
+		{
+			Editor::SetVisible(editor.get<jsonxx::Boolean>("visible", true));
+#ifdef __SWITCH__
+			hidInitializeKeyboard();
+#endif
+		}
+		else
+			printf("Editor::Open failed\n");
+	}
+
 	std::map<std::string, Renderer::Texture*> textures;
 
 	if (!options.empty())
@@ -176,6 +997,57 @@ int main(int argc, char *argv[])
 	char szShader[65535];
 	char szError[4096];
 
+	std::vector<std::string> passNames;
+	if (options.has<jsonxx::Array>("passes"))
+	{
+		printf("Loading render passes...\n");
+		jsonxx::Array & passes = options.get<jsonxx::Array>("passes");
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			if (!passes.has<jsonxx::Object>(i))
+				continue;
+			jsonxx::Object & pass = passes.get<jsonxx::Object>(i);
+			std::string sName = pass.get<jsonxx::String>("name", "");
+			std::string sShader = pass.get<jsonxx::String>("shader", "");
+			printf("* %s (%s)...\n", sName.c_str(), sShader.c_str());
+
+			FILE * fPass = fopen(sShader.c_str(), "rb");
+			if (!fPass)
+			{
+				printf("Can't open render pass shader '%s'\n", sShader.c_str());
+				return -1;
+			}
+			memset(szShader, 0, 65535);
+			fread(szShader, 1, 65534, fPass);
+			fclose(fPass);
+
+			Renderer::PASSFORMAT format = Renderer::PASSFORMAT_RGBA8;
+			std::string sFormat = pass.get<jsonxx::String>("format", "rgba8");
+			if (sFormat == "rgba16f")
+				format = Renderer::PASSFORMAT_RGBA16F;
+			else if (sFormat == "rgba32f")
+				format = Renderer::PASSFORMAT_RGBA32F;
+
+			float fScale = (float)pass.get<jsonxx::Number>("scale", 1.0);
+			if (!Renderer::AddRenderPass(sName.c_str(), szShader, strlen(szShader), fScale, format, szError, 4096))
+			{
+				printf("Render pass '%s' error:\n%s\n", sName.c_str(), szError);
+				return -1;
+			}
+
+			if (pass.has<jsonxx::Object>("inputs"))
+			{
+				std::map<std::string, jsonxx::Value*> inputs = pass.get<jsonxx::Object>("inputs").kv_map();
+				for (std::map<std::string, jsonxx::Value*>::iterator it = inputs.begin(); it != inputs.end(); it++)
+				{
+					if (it->second->is<jsonxx::String>())
+						Renderer::AddRenderPassInput(sName.c_str(), it->first.c_str(), it->second->get<jsonxx::String>().c_str());
+				}
+			}
+			passNames.push_back(sName);
+		}
+	}
+
 	FILE * f = fopen(Renderer::defaultShaderFilename.c_str(), "rb");
 	if (f)
 	{
@@ -184,6 +1056,7 @@ int main(int argc, char *argv[])
 		memset(szShader, 0, 65535);
 		int n = fread(szShader, 1, 65535, f);
 		fclose(f);
+		Editor::SetText(szShader, strlen(szShader));
 		if (Renderer::ReloadShader(szShader, strlen(szShader), szError, 4096))
 		{
 			printf("Last shader works fine.\n");
@@ -191,6 +1064,7 @@ int main(int argc, char *argv[])
 		}
 		else {
 			printf("Shader error:\n%s\n", szError);
+			s_sShaderError = szError;
 		}
 	}
 	if (!shaderInitSuccessful)
@@ -201,11 +1075,13 @@ int main(int argc, char *argv[])
 		std::vector<std::string> tokens;
 		for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
 			tokens.push_back(it->first);
+		tokens.insert(tokens.end(), passNames.begin(), passNames.end());
 		ReplaceTokens(sDefShader, "{%textures:begin%}", "{%textures:name%}", "{%textures:end%}", tokens);
 
 		tokens.clear();
 
 		strncpy(szShader, sDefShader.c_str(), 65535);
+		Editor::SetText(szShader, strlen(szShader));
 		if (!Renderer::ReloadShader(szShader, strlen(szShader), szError, 4096))
 		{
 			printf("Default shader compile failed:\n");
@@ -214,46 +1090,149 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	Renderer::UniformHandle hGlobalTime = Renderer::RegisterUniform("fGlobalTime");
+	Renderer::UniformHandle hResolution = Renderer::RegisterUniform("v2Resolution");
+	std::vector<std::pair<Renderer::UniformHandle, Renderer::Texture*> > textureUniforms;
+	for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
+		textureUniforms.push_back(std::make_pair(Renderer::RegisterUniform(it->first.c_str()), it->second));
+
 	bool bShowGui = false;
 	Timer::Start();
+
+	if (options.has<jsonxx::Number>("benchmarkUniforms"))
+		benchmarkUniformUpdates((int)options.get<jsonxx::Number>("benchmarkUniforms"), textures);
+
+	if (options.has<jsonxx::Number>("benchmarkEditor"))
+	{
+		benchmarkEditor((int)options.get<jsonxx::Number>("benchmarkEditor"), szShader);
+		Editor::Close();
+		TextRenderer::Close();
+		Renderer::WantsToQuit();
+		return 0;
+	}
+
+	if (nBenchmarkProfileFrames > 0)
+	{
+		benchmarkProfile(nBenchmarkProfileFrames, szShader, hGlobalTime, hResolution);
+		Renderer::WantsToQuit();
+		return 0;
+	}
+
+	if (options.has<jsonxx::Number>("checkCapture"))
+	{
+		bool bMatched = checkCaptureConversion((int)options.get<jsonxx::Number>("checkCapture"), szShader, hGlobalTime, hResolution, textureUniforms);
+		Renderer::WantsToQuit();
+		return bMatched ? 0 : -1;
+	}
+
+	if (options.has<jsonxx::Object>("poster"))
+	{
+		jsonxx::Object & poster = options.get<jsonxx::Object>("poster");
+		std::string sOutputFilename = poster.get<jsonxx::String>("output", "poster.ppm");
+
+		POSTER_SETTINGS posterSettings;
+		posterSettings.nWidth = (int)poster.get<jsonxx::Number>("width", 7680);
+		posterSettings.nHeight = (int)poster.get<jsonxx::Number>("height", 4320);
+		posterSettings.nTileSize = (int)poster.get<jsonxx::Number>("tileSize", 1024);
+		posterSettings.fTime = (float)poster.get<jsonxx::Number>("time", 0);
+		posterSettings.szOutputFilename = sOutputFilename.c_str();
+
+		for (size_t i = 0; i < textureUniforms.size(); i++)
+		{
+			Renderer::SetShaderTexture(textureUniforms[i].first, textureUniforms[i].second);
+		}
+
+		bool bPosterRendered = Poster::Render(&posterSettings);
+
+		for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
+		{
+			Renderer::ReleaseTexture(it->second);
+		}
+		Renderer::WantsToQuit();
+		return bPosterRendered ? 0 : -1;
+	}
+
+	if (bRecord && !Recorder::Open(&recorderSettings) && bOffline)
+		isClosed = true;
+	if (bOffline && !isClosed && !Offline::Open(&offlineSettings))
+		isClosed = true;
+
 	float fNextTick = 0.1;
+	float fNextProfilerDump = 10.0f;
 	while (!isClosed)
 	{
 		TRACE("1");
 		float time = Timer::GetTime();
+		if (!bOffline)
+		{
+			pollShaderFile(time);
+#ifdef __SWITCH__
+			pollKeyboard(time);
+#endif
+		}
 		TRACE("2");
 		Renderer::StartFrame();
 		TRACE("3");
 
-		Renderer::SetShaderConstant(string("fGlobalTime"), time);
+		Renderer::SetShaderConstant(hGlobalTime, time);
 		TRACE("4");
 		// I don't know why I have to double the 720p resolution here...
 		//int renderHeight = Renderer::nHeight == 1080 ? 1080 : 1440;
-		Renderer::SetShaderConstant(string("v2Resolution"), Renderer::nWidth, Renderer::nHeight);
+		Renderer::SetShaderConstant(hResolution, Renderer::nRenderWidth, Renderer::nRenderHeight);
 		TRACE("5");
 
-		for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
+		for (size_t i = 0; i < textureUniforms.size(); i++)
 		{
-			Renderer::SetShaderTexture((char*)it->first.c_str(), it->second);
+			Renderer::SetShaderTexture(textureUniforms[i].first, textureUniforms[i].second);
 		}
 		TRACE("6");
 
 		Renderer::RenderFullscreenQuad();
 		TRACE("7");
 
-		Renderer::EndFrame();
-		TRACE("8");
+		// The recording leaves out the editor and the overlay
+		bool bRecorded = !Recorder::IsOpen() || Recorder::CaptureFrame();
 
-		update(&isClosed);
+		if (bOffline)
+		{
+			if (!Offline::EndFrame(bRecorded))
+				isClosed = true;
+		}
+		else
+		{
+			drawEditor();
+			drawOverlay(time);
+			Renderer::EndFrame();
+			TRACE("8");
+
+			update(&isClosed);
+		}
 		TRACE("9");
+
+		if (Renderer::GetProfile() == RENDERER_PROFILE_PROFILE && Profiler::IsOpen() && time >= fNextProfilerDump)
+		{
+			Profiler::DumpStats();
+			FramePacer::DumpHistogram();
+			fNextProfilerDump = time + 10.0f;
+		}
 	}
 
+	bool bRecordingWritten = !Recorder::IsOpen() || Recorder::Close();
+	bool bOfflineRendered = Offline::Close() && bRecordingWritten;
+
+	if (Renderer::GetProfile() == RENDERER_PROFILE_PROFILE && Profiler::IsOpen())
+		Profiler::DumpStats();
+	if (!bOffline)
+		FramePacer::DumpHistogram();
+
 	for (std::map<std::string, Renderer::Texture*>::iterator it = textures.begin(); it != textures.end(); it++)
 	{
 		Renderer::ReleaseTexture(it->second);
 	}
+	Editor::Close();
+	TextRenderer::Close();
 
 	Renderer::WantsToQuit();
 
-	return 0;
+	return bOffline && !bOfflineRendered ? -1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,640 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Shade.h"
+#include "Renderer.h"
+#include "TextRenderer.h"
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "stb_truetype.h"
+
+namespace TextRenderer
+{
+	// Distance field glyphs are rasterised at this size and scaled to whatever is drawn;
+	// the distance ramps over nDistanceFieldPadding pixels on both sides of the edge
+	static const float fDistanceFieldSize = 32.0f;
+	static const int nDistanceFieldPadding = 4;
+	static const int nDistanceFieldOversampling = 4;
+	static const int nMaxLayouts = 256;
+	static const int nTabSize = 4;
+
+	struct GLYPH
+	{
+		int nCell;                 // -1 for glyphs with nothing to draw
+		int nWidth, nHeight;       // pixels at the cached size
+		float fXOffset, fYOffset;  // from the pen position on the baseline
+	};
+
+	struct PLACEDGLYPH
+	{
+		int nCodepoint;
+		float x, y;                // pen position, y on the baseline
+	};
+
+	struct LAYOUT
+	{
+		std::string sText;
+		float fSize;
+		std::vector<PLACEDGLYPH> glyphs;
+		float fWidth, fHeight;
+		unsigned int nLastUse;
+	};
+
+	static bool bOpen = false;
+	static TEXTRENDERER_SETTINGS settings;
+	static std::vector<unsigned char> fontFile;
+	static const unsigned char * pFontData = NULL;
+	static stbtt_fontinfo font;
+	static float fCachedSize = 0.0f;   // size the glyphs in the cache are rasterised at
+	static float fAscent = 0.0f;       // at fCachedSize
+	static float fLineHeight = 0.0f;   // at fCachedSize
+
+	static Renderer::Texture * pPage = NULL;
+	static int nCellSize = 0;
+	static int nCellsPerRow = 0;
+	static std::vector<int> cellCodepoints;  // -1 for a free cell
+	static std::vector<unsigned int> cellLastUse;
+	static std::map<int, GLYPH> glyphs;
+	static std::map<unsigned long long, LAYOUT> layouts;
+	static std::vector<unsigned char> cellPixels;
+	static unsigned int nUseCounter = 0;
+	static unsigned int nCacheGeneration = 0;  // bumped whenever a cell changes hands
+	static TEXTRENDERER_STATS stats;
+
+	static bool LoadFont(const char * szFontFile)
+	{
+		if (szFontFile)
+		{
+			FILE * f = fopen(szFontFile, "rb");
+			if (!f)
+			{
+				printf("[TextRenderer] Can't open font '%s'\n", szFontFile);
+				return false;
+			}
+			fseek(f, 0, SEEK_END);
+			long nSize = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			fontFile.resize(nSize);
+			bool bRead = nSize > 0 && fread(&fontFile[0], 1, nSize, f) == (size_t)nSize;
+			fclose(f);
+			if (!bRead)
+			{
+				printf("[TextRenderer] Can't read font '%s'\n", szFontFile);
+				return false;
+			}
+			pFontData = &fontFile[0];
+			return true;
+		}
+
+#ifdef __SWITCH__
+		PlFontData sharedFont;
+		if (R_SUCCEEDED(plInitialize(PlServiceType_User)))
+		{
+			if (R_SUCCEEDED(plGetSharedFontByType(&sharedFont, PlSharedFontType_Standard)))
+			{
+				pFontData = (const unsigned char *)sharedFont.address;
+				return true;
+			}
+			plExit();
+		}
+		printf("[TextRenderer] Can't get the system font\n");
+#else
+		printf("[TextRenderer] No font file given\n");
+#endif
+		return false;
+	}
+
+	static void UnloadFont()
+	{
+#ifdef __SWITCH__
+		if (pFontData && fontFile.empty())
+			plExit();
+#endif
+		pFontData = NULL;
+		fontFile.clear();
+	}
+
+	bool Open(TEXTRENDERER_SETTINGS * pSettings)
+	{
+		settings = *pSettings;
+		if (!LoadFont(settings.szFontFile))
+			return false;
+		if (!stbtt_InitFont(&font, pFontData, stbtt_GetFontOffsetForIndex(pFontData, 0)))
+		{
+			printf("[TextRenderer] Unsupported font\n");
+			UnloadFont();
+			return false;
+		}
+
+		fCachedSize = settings.bDistanceField ? fDistanceFieldSize : settings.fSize;
+		float fScale = stbtt_ScaleForPixelHeight(&font, fCachedSize);
+		int nAscent = 0, nDescent = 0, nLineGap = 0;
+		stbtt_GetFontVMetrics(&font, &nAscent, &nDescent, &nLineGap);
+		fAscent = nAscent * fScale;
+		fLineHeight = (nAscent - nDescent + nLineGap) * fScale;
+
+		// Cells fit a line's height plus a pixel of border that stays empty, so glyphs
+		// don't bleed into each other; the odd glyph wider than that gets clipped
+		nCellSize = (int)ceilf(fCachedSize * 1.25f) + 2;
+		if (settings.bDistanceField)
+			nCellSize += nDistanceFieldPadding * 2;
+		nCellsPerRow = settings.nCacheSize / nCellSize;
+		if (nCellsPerRow < 1)
+		{
+			printf("[TextRenderer] Glyph cache of %d pixels is too small\n", settings.nCacheSize);
+			UnloadFont();
+			return false;
+		}
+
+		std::vector<unsigned char> empty(settings.nCacheSize * settings.nCacheSize, 0);
+		pPage = Renderer::CreateAtlasA8TextureFromData(settings.nCacheSize, settings.nCacheSize, &empty[0], settings.bDistanceField);
+		if (!pPage)
+		{
+			UnloadFont();
+			return false;
+		}
+		cellCodepoints.assign(nCellsPerRow * nCellsPerRow, -1);
+		cellLastUse.assign(cellCodepoints.size(), 0);
+		cellPixels.resize(nCellSize * nCellSize);
+		memset(&stats, 0, sizeof(stats));
+		nCacheGeneration++;
+		bOpen = true;
+		return true;
+	}
+
+	void Close()
+	{
+		if (!bOpen)
+			return;
+		Renderer::ReleaseTexture(pPage);
+		pPage = NULL;
+		glyphs.clear();
+		layouts.clear();
+		cellCodepoints.clear();
+		cellLastUse.clear();
+		UnloadFont();
+		bOpen = false;
+	}
+
+	bool IsOpen()
+	{
+		return bOpen;
+	}
+
+	// The bundled stb_truetype predates its distance field support, so the glyph is
+	// rasterised nDistanceFieldOversampling times larger and run through a Euclidean
+	// distance transform (8SSEDT), once towards the inside and once towards the outside;
+	// the signed distance is then sampled at the centre of every output pixel.
+	struct SEED
+	{
+		int dx, dy;
+		int Distance() const { return dx * dx + dy * dy; }
+	};
+
+	static void CompareSeed(const std::vector<SEED> & grid, int w, int h, SEED & seed, int x, int y, int ox, int oy)
+	{
+		x += ox;
+		y += oy;
+		if (x < 0 || y < 0 || x >= w || y >= h)
+			return;
+		SEED other = grid[y * w + x];
+		other.dx += ox;
+		other.dy += oy;
+		if (other.Distance() < seed.Distance())
+			seed = other;
+	}
+
+	static void DistanceTransform(std::vector<SEED> & grid, int w, int h)
+	{
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				SEED & seed = grid[y * w + x];
+				CompareSeed(grid, w, h, seed, x, y, -1, 0);
+				CompareSeed(grid, w, h, seed, x, y, 0, -1);
+				CompareSeed(grid, w, h, seed, x, y, -1, -1);
+				CompareSeed(grid, w, h, seed, x, y, 1, -1);
+			}
+			for (int x = w - 1; x >= 0; x--)
+				CompareSeed(grid, w, h, grid[y * w + x], x, y, 1, 0);
+		}
+		for (int y = h - 1; y >= 0; y--)
+		{
+			for (int x = w - 1; x >= 0; x--)
+			{
+				SEED & seed = grid[y * w + x];
+				CompareSeed(grid, w, h, seed, x, y, 1, 0);
+				CompareSeed(grid, w, h, seed, x, y, 0, 1);
+				CompareSeed(grid, w, h, seed, x, y, -1, 1);
+				CompareSeed(grid, w, h, seed, x, y, 1, 1);
+			}
+			for (int x = 0; x < w; x++)
+				CompareSeed(grid, w, h, grid[y * w + x], x, y, -1, 0);
+		}
+	}
+
+	static bool RasterizeDistanceField(int nCodepoint, float fScale, std::vector<unsigned char> & field, int * pWidth, int * pHeight, int * pXOffset, int * pYOffset)
+	{
+		const int O = nDistanceFieldOversampling;
+		const int P = nDistanceFieldPadding;
+		float fScaleHigh = fScale * O;
+		int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+		stbtt_GetCodepointBitmapBox(&font, nCodepoint, fScaleHigh, fScaleHigh, &x0, &y0, &x1, &y1);
+		if (x1 <= x0 || y1 <= y0)
+			return false;
+
+		// Output pixels cover whole O x O blocks of the large bitmap
+		int nLeft = (int)floorf((float)x0 / O);
+		int nTop = (int)floorf((float)y0 / O);
+		int w = (int)ceilf((float)x1 / O) - nLeft + P * 2;
+		int h = (int)ceilf((float)y1 / O) - nTop + P * 2;
+		int nHighWidth = w * O;
+		int nHighHeight = h * O;
+		std::vector<unsigned char> coverage(nHighWidth * nHighHeight, 0);
+		int nOffsetX = x0 - nLeft * O + P * O;
+		int nOffsetY = y0 - nTop * O + P * O;
+		stbtt_MakeCodepointBitmap(&font, &coverage[nOffsetY * nHighWidth + nOffsetX], x1 - x0, y1 - y0, nHighWidth, fScaleHigh, fScaleHigh, nCodepoint);
+
+		SEED near = { 0, 0 };
+		SEED far = { 9999, 9999 };
+		std::vector<SEED> toInside(coverage.size());
+		std::vector<SEED> toOutside(coverage.size());
+		for (size_t i = 0; i < coverage.size(); i++)
+		{
+			bool bInside = coverage[i] >= 128;
+			toInside[i] = bInside ? near : far;
+			toOutside[i] = bInside ? far : near;
+		}
+		DistanceTransform(toInside, nHighWidth, nHighHeight);
+		DistanceTransform(toOutside, nHighWidth, nHighHeight);
+
+		// 128 on the edge, ramping over P output pixels either way, higher inside
+		field.resize(w * h);
+		float fValuePerPixel = 128.0f / (P * O);
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				int i = (y * O + O / 2) * nHighWidth + x * O + O / 2;
+				float fDistance = sqrtf((float)toInside[i].Distance()) - sqrtf((float)toOutside[i].Distance());
+				float fValue = 128.0f - fDistance * fValuePerPixel;
+				field[y * w + x] = (unsigned char)(fValue < 0.0f ? 0.0f : (fValue > 255.0f ? 255.0f : fValue));
+			}
+		}
+		*pWidth = w;
+		*pHeight = h;
+		*pXOffset = nLeft - P;
+		*pYOffset = nTop - P;
+		return true;
+	}
+
+	// Returns a free cell, or evicts the glyph that was drawn longest ago
+	static int AllocateCell()
+	{
+		for (size_t i = 0; i < cellCodepoints.size(); i++)
+		{
+			if (cellCodepoints[i] == -1)
+				return (int)i;
+		}
+
+		int nCell = 0;
+		unsigned int nOldest = 0xFFFFFFFF;
+		for (size_t i = 0; i < cellLastUse.size(); i++)
+		{
+			if (cellLastUse[i] < nOldest)
+			{
+				nOldest = cellLastUse[i];
+				nCell = (int)i;
+			}
+		}
+		glyphs.erase(cellCodepoints[nCell]);
+		stats.nGlyphEvictions++;
+		nCacheGeneration++;
+		return nCell;
+	}
+
+	static const GLYPH & GetGlyph(int nCodepoint)
+	{
+		std::map<int, GLYPH>::iterator it = glyphs.find(nCodepoint);
+		if (it != glyphs.end())
+		{
+			if (it->second.nCell >= 0)
+				cellLastUse[it->second.nCell] = nUseCounter;
+			return it->second;
+		}
+		stats.nGlyphMisses++;
+
+		GLYPH glyph;
+		glyph.nCell = -1;
+		glyph.nWidth = 0;
+		glyph.nHeight = 0;
+		glyph.fXOffset = 0.0f;
+		glyph.fYOffset = 0.0f;
+
+		float fScale = stbtt_ScaleForPixelHeight(&font, fCachedSize);
+		int nMaxSize = nCellSize - 2;
+		memset(&cellPixels[0], 0, cellPixels.size());
+		if (settings.bDistanceField)
+		{
+			int w = 0, h = 0, xoff = 0, yoff = 0;
+			std::vector<unsigned char> field;
+			if (RasterizeDistanceField(nCodepoint, fScale, field, &w, &h, &xoff, &yoff))
+			{
+				glyph.nWidth = w < nMaxSize ? w : nMaxSize;
+				glyph.nHeight = h < nMaxSize ? h : nMaxSize;
+				glyph.fXOffset = (float)xoff;
+				glyph.fYOffset = (float)yoff;
+				for (int j = 0; j < glyph.nHeight; j++)
+					memcpy(&cellPixels[(j + 1) * nCellSize + 1], &field[j * w], glyph.nWidth);
+			}
+		}
+		else
+		{
+			int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+			stbtt_GetCodepointBitmapBox(&font, nCodepoint, fScale, fScale, &x0, &y0, &x1, &y1);
+			glyph.nWidth = x1 - x0 < nMaxSize ? x1 - x0 : nMaxSize;
+			glyph.nHeight = y1 - y0 < nMaxSize ? y1 - y0 : nMaxSize;
+			glyph.fXOffset = (float)x0;
+			glyph.fYOffset = (float)y0;
+			if (glyph.nWidth > 0 && glyph.nHeight > 0)
+				stbtt_MakeCodepointBitmap(&font, &cellPixels[nCellSize + 1], glyph.nWidth, glyph.nHeight, nCellSize, fScale, fScale, nCodepoint);
+		}
+
+		if (glyph.nWidth > 0 && glyph.nHeight > 0)
+		{
+			glyph.nCell = AllocateCell();
+			cellCodepoints[glyph.nCell] = nCodepoint;
+			cellLastUse[glyph.nCell] = nUseCounter;
+			int nCellX = (glyph.nCell % nCellsPerRow) * nCellSize;
+			int nCellY = (glyph.nCell / nCellsPerRow) * nCellSize;
+			Renderer::UpdateAtlasA8Texture(pPage, nCellX, nCellY, nCellSize, nCellSize, &cellPixels[0]);
+		}
+		return glyphs[nCodepoint] = glyph;
+	}
+
+	static int DecodeUTF8(const unsigned char *& p)
+	{
+		int c = *p++;
+		if (c < 0x80)
+			return c;
+		int nExtra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+		if (nExtra == 0)
+			return 0xFFFD;
+		c &= 0xFF >> (nExtra + 2);
+		for (int i = 0; i < nExtra; i++)
+		{
+			if ((*p & 0xC0) != 0x80)
+				return 0xFFFD;
+			c = (c << 6) | (*p++ & 0x3F);
+		}
+		return c;
+	}
+
+	static void BuildLayout(LAYOUT & layout)
+	{
+		float fScale = stbtt_ScaleForPixelHeight(&font, layout.fSize);
+		float fSizeScale = layout.fSize / fCachedSize;
+		float x = 0.0f;
+		float y = fAscent * fSizeScale;
+		int nPrevious = 0;
+		layout.glyphs.clear();
+		layout.fWidth = 0.0f;
+
+		const unsigned char * p = (const unsigned char *)layout.sText.c_str();
+		while (*p)
+		{
+			int nCodepoint = DecodeUTF8(p);
+			if (nCodepoint == '\n')
+			{
+				x = 0.0f;
+				y += fLineHeight * fSizeScale;
+				nPrevious = 0;
+				continue;
+			}
+			if (nPrevious)
+				x += stbtt_GetCodepointKernAdvance(&font, nPrevious, nCodepoint) * fScale;
+
+			PLACEDGLYPH placed = { nCodepoint, x, y };
+			layout.glyphs.push_back(placed);
+
+			int nAdvance = 0, nLeftBearing = 0;
+			stbtt_GetCodepointHMetrics(&font, nCodepoint, &nAdvance, &nLeftBearing);
+			x += nAdvance * fScale;
+			if (x > layout.fWidth)
+				layout.fWidth = x;
+			nPrevious = nCodepoint;
+		}
+		layout.fHeight = y - fAscent * fSizeScale + fLineHeight * fSizeScale;
+	}
+
+	// Layouts are keyed by an FNV-1a hash of the string and the size; a hash collision
+	// just replaces the entry
+	static const LAYOUT & GetLayout(const char * szText, float fSize)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		for (const unsigned char * p = (const unsigned char *)szText; *p; p++)
+			hash = (hash ^ *p) * 1099511628211ull;
+		unsigned int nSizeBits = 0;
+		memcpy(&nSizeBits, &fSize, sizeof(nSizeBits));
+		hash = (hash ^ nSizeBits) * 1099511628211ull;
+
+		std::map<unsigned long long, LAYOUT>::iterator it = layouts.find(hash);
+		if (it != layouts.end() && it->second.fSize == fSize && it->second.sText == szText)
+		{
+			it->second.nLastUse = nUseCounter;
+			return it->second;
+		}
+		stats.nLayoutMisses++;
+
+		if (it == layouts.end() && (int)layouts.size() >= nMaxLayouts)
+		{
+			std::map<unsigned long long, LAYOUT>::iterator oldest = layouts.begin();
+			for (std::map<unsigned long long, LAYOUT>::iterator l = layouts.begin(); l != layouts.end(); l++)
+			{
+				if (l->second.nLastUse < oldest->second.nLastUse)
+					oldest = l;
+			}
+			layouts.erase(oldest);
+		}
+
+		LAYOUT & layout = layouts[hash];
+		layout.sText = szText;
+		layout.fSize = fSize;
+		layout.nLastUse = nUseCounter;
+		BuildLayout(layout);
+		return layout;
+	}
+
+	float DrawString(float x, float y, const char * szText, unsigned int nColor, float fSize)
+	{
+		if (!bOpen)
+			return 0.0f;
+		if (fSize <= 0.0f)
+			fSize = settings.fSize;
+
+		nUseCounter++;
+		const LAYOUT & layout = GetLayout(szText, fSize);
+		float fSizeScale = fSize / fCachedSize;
+		bool bSnap = !settings.bDistanceField && fSizeScale == 1.0f;
+		float fPageSize = (float)settings.nCacheSize;
+
+		Renderer::BindTexture(pPage);
+		for (size_t i = 0; i < layout.glyphs.size(); i++)
+		{
+			const PLACEDGLYPH & placed = layout.glyphs[i];
+			const GLYPH & glyph = GetGlyph(placed.nCodepoint);
+			if (glyph.nCell < 0)
+				continue;
+
+			// Bitmaps drawn at their own size go on whole pixels to stay crisp
+			float fX = x + placed.x + glyph.fXOffset * fSizeScale;
+			float fY = y + placed.y + glyph.fYOffset * fSizeScale;
+			if (bSnap)
+			{
+				fX = floorf(fX + 0.5f);
+				fY = floorf(fY + 0.5f);
+			}
+			float u0 = (glyph.nCell % nCellsPerRow) * nCellSize + 1.0f;
+			float v0 = (glyph.nCell / nCellsPerRow) * nCellSize + 1.0f;
+			Renderer::RenderRect(fX, fY, glyph.nWidth * fSizeScale, glyph.nHeight * fSizeScale, nColor,
+				u0 / fPageSize, v0 / fPageSize, (u0 + glyph.nWidth) / fPageSize, (v0 + glyph.nHeight) / fPageSize);
+		}
+		return layout.fWidth;
+	}
+
+	void MeasureString(const char * szText, float fSize, float * pWidth, float * pHeight)
+	{
+		*pWidth = 0.0f;
+		*pHeight = 0.0f;
+		if (!bOpen)
+			return;
+		if (fSize <= 0.0f)
+			fSize = settings.fSize;
+
+		nUseCounter++;
+		const LAYOUT & layout = GetLayout(szText, fSize);
+		*pWidth = layout.fWidth;
+		*pHeight = layout.fHeight;
+	}
+
+	float GetLineHeight(float fSize)
+	{
+		if (!bOpen)
+			return 0.0f;
+		if (fSize <= 0.0f)
+			fSize = settings.fSize;
+		return fLineHeight * fSize / fCachedSize;
+	}
+
+	float LayoutRun(const char * szText, int nLength, float fSize, std::vector<TEXTRENDERER_GLYPHQUAD> & quads)
+	{
+		quads.clear();
+		if (!bOpen)
+			return 0.0f;
+		if (fSize <= 0.0f)
+			fSize = settings.fSize;
+
+		nUseCounter++;
+		float fScale = stbtt_ScaleForPixelHeight(&font, fSize);
+		float fSizeScale = fSize / fCachedSize;
+		bool bSnap = !settings.bDistanceField && fSizeScale == 1.0f;
+		float fPageSize = (float)settings.nCacheSize;
+		float fBaseline = fAscent * fSizeScale;
+		float x = 0.0f;
+		int nPrevious = 0;
+
+		const unsigned char * pStart = (const unsigned char *)szText;
+		const unsigned char * p = pStart;
+		while (p < pStart + nLength)
+		{
+			int nOffset = (int)(p - pStart);
+			int nCodepoint = DecodeUTF8(p);
+			if (nCodepoint == '\t')
+			{
+				// Tab stops every nTabSize spaces
+				int nSpaceAdvance = 0, nLeftBearing = 0;
+				stbtt_GetCodepointHMetrics(&font, ' ', &nSpaceAdvance, &nLeftBearing);
+				float fTabWidth = nSpaceAdvance * fScale * nTabSize;
+				TEXTRENDERER_GLYPHQUAD quad;
+				memset(&quad, 0, sizeof(quad));
+				quad.nCell = -1;
+				quad.fPen = x;
+				quad.nOffset = nOffset;
+				quads.push_back(quad);
+				x = (floorf(x / fTabWidth + 0.001f) + 1.0f) * fTabWidth;
+				nPrevious = 0;
+				continue;
+			}
+			if (nPrevious)
+				x += stbtt_GetCodepointKernAdvance(&font, nPrevious, nCodepoint) * fScale;
+
+			TEXTRENDERER_GLYPHQUAD quad;
+			memset(&quad, 0, sizeof(quad));
+			quad.fPen = x;
+			quad.nOffset = nOffset;
+			const GLYPH & glyph = GetGlyph(nCodepoint);
+			quad.nCell = glyph.nCell;
+			if (glyph.nCell >= 0)
+			{
+				quad.x = x + glyph.fXOffset * fSizeScale;
+				quad.y = fBaseline + glyph.fYOffset * fSizeScale;
+				if (bSnap)
+				{
+					quad.x = floorf(quad.x + 0.5f);
+					quad.y = floorf(quad.y + 0.5f);
+				}
+				quad.w = glyph.nWidth * fSizeScale;
+				quad.h = glyph.nHeight * fSizeScale;
+				float u0 = (glyph.nCell % nCellsPerRow) * nCellSize + 1.0f;
+				float v0 = (glyph.nCell / nCellsPerRow) * nCellSize + 1.0f;
+				quad.u0 = u0 / fPageSize;
+				quad.v0 = v0 / fPageSize;
+				quad.u1 = (u0 + glyph.nWidth) / fPageSize;
+				quad.v1 = (v0 + glyph.nHeight) / fPageSize;
+			}
+			quads.push_back(quad);
+
+			int nAdvance = 0, nLeftBearing = 0;
+			stbtt_GetCodepointHMetrics(&font, nCodepoint, &nAdvance, &nLeftBearing);
+			x += nAdvance * fScale;
+			nPrevious = nCodepoint;
+		}
+		return x;
+	}
+
+	void DrawRun(float x, float y, const TEXTRENDERER_GLYPHQUAD * pQuads, int nQuads)
+	{
+		if (!bOpen)
+			return;
+
+		// Drawing counts as a use, or the glyphs of runs kept by the caller would look the
+		// oldest in the cache and be the first evicted while on screen
+		nUseCounter++;
+		Renderer::BindTexture(pPage);
+		for (int i = 0; i < nQuads; i++)
+		{
+			const TEXTRENDERER_GLYPHQUAD & quad = pQuads[i];
+			if (quad.nCell >= 0)
+				cellLastUse[quad.nCell] = nUseCounter;
+			if (quad.w > 0.0f)
+				Renderer::RenderRect(x + quad.x, y + quad.y, quad.w, quad.h, quad.nColor, quad.u0, quad.v0, quad.u1, quad.v1);
+		}
+	}
+
+	unsigned int GetCacheGeneration()
+	{
+		return nCacheGeneration;
+	}
+
+	void GetStats(TEXTRENDERER_STATS * pStats)
+	{
+		*pStats = stats;
+		pStats->nGlyphs = (int)glyphs.size();
+		pStats->nLayouts = (int)layouts.size();
+	}
+}
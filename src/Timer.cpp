@@ -1,6 +1,14 @@
+#ifdef __SWITCH__
 #include <switch.h>
+#else
+#include <time.h>
+#endif
 namespace Timer
 {
+  bool s_frozen = false;
+  float s_frozenTime = 0.0f;
+
+#ifdef __SWITCH__
   u64 s_startTicks;
   double _Time()
   {
@@ -12,8 +20,53 @@ namespace Timer
   {
     s_startTicks = armGetSystemTick();
   }
+
+  void Sleep(double fSeconds)
+  {
+    if (fSeconds > 0.0)
+      svcSleepThread((s64)(fSeconds * 1000000000.0));
+  }
+#else
+  timespec s_startTime;
+  double _Time()
+  {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - s_startTime.tv_sec) + (now.tv_nsec - s_startTime.tv_nsec) / 1000000000.0;
+  }
+
+  void Start()
+  {
+    clock_gettime(CLOCK_MONOTONIC, &s_startTime);
+  }
+
+  void Sleep(double fSeconds)
+  {
+    if (fSeconds <= 0.0)
+      return;
+    timespec duration;
+    duration.tv_sec = (time_t)fSeconds;
+    duration.tv_nsec = (long)((fSeconds - duration.tv_sec) * 1000000000.0);
+    nanosleep(&duration, NULL);
+  }
+#endif
   float GetTime()
   {
+    if (s_frozen)
+      return s_frozenTime;
     return (float)_Time();
   }
+  double GetTimePrecise()
+  {
+    return _Time();
+  }
+  void Freeze(float fTime)
+  {
+    s_frozen = true;
+    s_frozenTime = fTime;
+  }
+  void Unfreeze()
+  {
+    s_frozen = false;
+  }
 }
\ No newline at end of file